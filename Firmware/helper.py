@@ -1,5 +1,6 @@
 import shutil
 import gzip
+import hashlib
 import os
 import time
 import webbrowser
@@ -114,13 +115,21 @@ board = env.BoardConfig()
 mcu = board.get("build.mcu", "esp32") # works for ESP8266 and ESP32
 
 def copy_html(source, target, env):
-    with open(os.path.join(env["PROJECT_DATA_DIR"], "index.html"), "r") as fin:
-        with open(os.path.join(env["PROJECT_DIR"], "include/html.h"), "w") as fout:
-            fout.write('const char html[] PROGMEM = R"html(')
-            for line in fin:
-                fout.write(line)
-            fout.write('\n)html";')
-    
+    """Embed data/index.html gzip-compressed into include/html.h, tagged with a content hash."""
+    with open(os.path.join(env["PROJECT_DATA_DIR"], "index.html"), "rb") as fin:
+        html = fin.read()
+    gz = gzip.compress(html, compresslevel=9, mtime=0)
+    etag = hashlib.sha1(html).hexdigest()[:16]
+    with open(os.path.join(env["PROJECT_DIR"], "include/html.h"), "w") as fout:
+        fout.write('#pragma once\n\n')
+        fout.write('const char html_etag[] PROGMEM = "\\"%s\\"";\n' % etag)
+        fout.write('const size_t html_gz_len = %d;\n' % len(gz))
+        fout.write('const uint8_t html_gz[] PROGMEM = {')
+        for i in range(0, len(gz), 32):
+            fout.write('\n    ' + ', '.join('0x%02x' % b for b in gz[i:i + 32]) + ',')
+        fout.write('\n};\n')
+    print("index.html: %d bytes, gzip: %d bytes, etag %s" % (len(html), len(gz), etag))
+
 def post_build(source, target, env):
     print("Version: " + env.GetProjectOption("custom_version"))
     print("project dir: " + env["PROJECT_DIR"])
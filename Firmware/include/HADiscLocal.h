@@ -3,10 +3,12 @@
 #include "mqtt.h"
 
 class OTThingHADiscovery: public HADiscovery {
+private:
+    uint32_t lastOverflow {0}; // topic hash of last incomplete entity, logged once
 public:
     OTThingHADiscovery();
     void begin();
-    void createSwitch(String name, Mqtt::MqttTopic topic);
+    void createSwitch(HAStr name, Mqtt::MqttTopic topic);
     using HADiscovery::publish;
     bool publish(const bool avail = true);
 };
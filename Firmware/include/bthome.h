@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Decoder for BTHome v2 service data (UUID 0xFCD2), unencrypted only.
+ * Does not allocate, can be used from the BLE scan callback.
+ */
+class BTHome {
+public:
+    enum Field: uint8_t {
+        FIELD_NONE = 0, // decoded but not stored
+        FIELD_PACKET_ID,
+        FIELD_BATTERY,
+        FIELD_TEMP,
+        FIELD_HUMIDITY,
+        FIELD_DEWPOINT,
+        FIELD_PRESSURE,
+        FIELD_ILLUMINANCE,
+        FIELD_VOLTAGE,
+        FIELD_CO2,
+        FIELD_TVOC,
+        FIELD_MOISTURE,
+        FIELD_WINDOW,
+        FIELD_BUTTON,
+        NUM_FIELDS
+    };
+
+    struct Reading {
+        float values[NUM_FIELDS];
+        uint32_t valid; // bit mask of fields set
+        bool has(const Field f) const { return (valid & (1UL << f)) != 0; }
+    };
+
+    static bool findServiceData(const uint8_t *adv, const size_t advLen, const uint8_t *&data, size_t &len);
+    static bool decode(const uint8_t *data, const size_t len, Reading &reading);
+    static const char* fieldName(const Field f);
+};
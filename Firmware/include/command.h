@@ -2,33 +2,68 @@
 #define _command_h
 
 #include <Arduino.h>
-#ifdef ESP32
+#if defined(ESP32) || defined(NATIVE)
 #include <AsyncTCP.h>
 #endif
 #ifdef ESP8266
 #include <ESPAsyncTCP.h>
 #endif
+#include <atomic>
 #include <vector>
+#include <ArduinoJson.h>
+
+#ifndef CMD_CLIENT_BUF_SIZE
+#define CMD_CLIENT_BUF_SIZE 2048 // output buffer per client, bytes
+#endif
+
+#ifndef CMD_MAX_CLIENTS
+#define CMD_MAX_CLIENTS 3 // further clients are rejected
+#endif
 
 
 
 extern class OtGwCommand {
 private:
+    static const uint8_t CMD_LINE_MAX = 32; // longest command line accepted
+    struct ClientCtx {
+        AsyncClient *client;
+        char line[CMD_LINE_MAX]; // partial line of previous TCP segments
+        uint8_t lineLen {0};
+        bool overflow {false}; // line too long, discard until line end
+        char out[CMD_CLIENT_BUF_SIZE]; // ring buffer of output not yet taken by TCP
+        size_t outHead {0}; // index of oldest byte
+        size_t outLen {0};
+        uint32_t dropped {0}; // lines dropped because client fell behind
+        std::atomic<bool> dead {false}; // disconnected, removed by reapClients()
+    };
     bool enableOtEvents;
     AsyncServer server;
-    std::vector<AsyncClient*> clients;
+    std::vector<ClientCtx*> clients;
+    SemaphoreHandle_t mutex;
+    uint32_t droppedLines {0}; // dropped lines of all clients since boot
+    uint32_t rejectedClients {0}; // connections refused because of CMD_MAX_CLIENTS
+    void onLine(ClientCtx *ctx, const char *line, const size_t len);
+    void reply(ClientCtx *ctx, const char *str);
+    void enqueue(ClientCtx *ctx, const char *data, const size_t len);
+    void flush(ClientCtx *ctx);
+    void reapClients();
     friend void handleNewClient(void* arg, AsyncClient* client);
     friend void handleClientData(void* arg, AsyncClient* client, void *data, size_t len);
+    friend void handleClientAck(void* arg, AsyncClient* client, size_t len, uint32_t time);
     friend void handleClientDisconnect(void* arg, AsyncClient* client);
     void onNewClient(void* arg, AsyncClient* client);
     void onClientData(void* arg, AsyncClient* client, void *data, size_t len);
+    void onClientAck(void* arg, AsyncClient* client);
     void onClientDisconnect(void* arg, AsyncClient* client);
 public:
     OtGwCommand();
     void begin();
     void loop();
-    void sendAll(String s);
+    void writeClients(const char *text, const size_t len);
+    void setOtEvents(const bool en);
+    void getJson(JsonObject &obj);
     void sendOtEvent(const char source, const uint32_t data);
+    static size_t formatOtEvent(char *buf, const size_t size, const char source, const uint32_t data);
     
 } command;
 
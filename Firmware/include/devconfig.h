@@ -5,23 +5,48 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 
+#ifndef CFG_MAX_SIZE
+#define CFG_MAX_SIZE 16384 // bytes, larger uploads are rejected
+#endif
+
 extern class DevConfig {
 private:
     void update();
+    void updateETag();
+    static void merge(JsonObject dst, JsonObjectConst src);
+    static bool validate(JsonVariantConst doc, String &err);
+    int activate(String &err);
+    int patch(JsonDocument &patchDoc, String &err);
+    enum UploadState: uint8_t {
+        UPLOAD_IDLE,
+        UPLOAD_ACTIVE,
+        UPLOAD_FAILED
+    } uploadState {UPLOAD_IDLE};
+    File upload; // temporary file receiving an uploaded config
+    uint32_t uploadId {0}; // id of the current upload, 0: none
+    uint32_t lastUploadId {0};
+    uint32_t uploadStart {0};
+    JsonDocument applied; // last applied config, for incremental updates
     bool writeBufFlag;
+    String etag; // content hash of config file, quoted
     String hostname;
     int timezone;
     bool fsOk;
 public:
+    enum UploadMode: uint8_t {
+        UPLOAD_REPLACE,
+        UPLOAD_PATCH // merge into current config
+    };
     DevConfig();
     void begin();
     File getFile();
-    void write(String &str);
+    int receive(uint32_t &id, const UploadMode mode, const uint8_t *data, const size_t len, const size_t index, const size_t total, String &err);
     void remove();
     void loop();
     String getHostname() const;
     int getTimezone() const;
     bool hasFS() const { return fsOk; }
+    String getETag() const;
 } devconfig;
 
 extern const char CFG_FILENAME[];
@@ -13,11 +13,16 @@ friend class DevStatusLock;
 private:
     JsonDocument doc;
     SemaphoreHandle_t mutex;
+    uint32_t loopMax {0}; // us, since boot
+    uint32_t loopMaxWindow {0}; // us, current window
+    uint32_t loopMaxLast {0}; // us, last complete window
+    uint32_t loopWindowStart {0};
 public:
     DevStatus();
     bool lock();
     void unlock();
     void buildDoc(JsonDocument &doc);
+    void loopTime(const uint32_t us);
     uint32_t numWifiDiscon;
 } devstatus;
 
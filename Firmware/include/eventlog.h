@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+enum LogModule: uint8_t {
+    LOGMOD_SYS,
+    LOGMOD_OT,
+    LOGMOD_MQTT,
+    LOGMOD_SENSOR,
+    NUM_LOGMOD // has to be last item in this list!
+};
+
+enum LogLevel: uint8_t {
+    LOGLVL_ERROR,
+    LOGLVL_WARN,
+    LOGLVL_INFO,
+    LOGLVL_DEBUG
+};
+
+// message ids, format strings are in eventlog.cpp
+enum LogMsg: uint8_t {
+    LOGMSG_OT_FRAME,
+    LOGMSG_RX_MASTER_TIMEOUT,
+    LOGMSG_RX_MASTER_INVALID,
+    LOGMSG_RX_SLAVE_INVALID,
+    LOGMSG_NO_SLAVE_VAL,
+    LOGMSG_NO_THERMOSTAT_VAL,
+    LOGMSG_MQTT_CONNECTED,
+    LOGMSG_MQTT_CONNECTED_TLS,
+    LOGMSG_MQTT_DISCONNECTED,
+    LOGMSG_MQTT_CMD,
+    LOGMSG_LOG_LEVEL,
+    LOGMSG_CONFIG_DELAYED,
+    LOGMSG_DISC_OVERFLOW,
+    NUM_LOGMSG // has to be last item in this list!
+};
+
+/**
+ * Log of compact binary records in a RAM ring. Records are only formatted to text when
+ * a live output has a consumer or the log is downloaded.
+ */
+class EventLog {
+public:
+    struct Record {
+        uint32_t time; // ms
+        LogModule module;
+        LogLevel level;
+        LogMsg msg;
+        int32_t args[3];
+    };
+    EventLog();
+    void add(const LogModule module, const LogLevel level, const LogMsg msg, const int32_t a0 = 0, const int32_t a1 = 0, const int32_t a2 = 0);
+    bool enabled(const LogModule module, const LogLevel level) const;
+    static int32_t packFloat(const float f);
+    static void packStr(const char *str, int32_t &a0, int32_t &a1);
+    size_t format(const Record &rec, char *buf, const size_t size);
+    bool setLevel(const char *module, const char *level);
+    void getJson(JsonObject &obj);
+    void writeAll(Print &out);
+private:
+    static const uint8_t NUM_RECORDS = 128;
+    Record ring[NUM_RECORDS];
+    uint8_t head {0}; // index of next record
+    uint8_t count {0};
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    LogLevel levels[NUM_LOGMOD];
+};
+
+extern EventLog eventlog;
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/ringbuf.h>
+#include "eventlog.h"
+
+/**
+ * Central sink for log lines. Writers only copy the line into a ring buffer and never block,
+ * a low priority task hands the lines to the outputs and drops them if an output is stalled.
+ */
+class LogSink {
+public:
+    enum Target: uint8_t {
+        TARGET_SERIAL = 1<<0,
+        TARGET_WS = 1<<1,  // web UI console
+        TARGET_TCP = 1<<2, // OTGW command port
+        TARGET_BLE = 1<<3, // BLE serial, debug builds only
+        ITEM_RECORD = 1<<7 // item is an EventLog record instead of text
+    };
+    LogSink();
+    void begin();
+    void write(const uint8_t targets, const char *text, const size_t len);
+    void write(const uint8_t targets, const String &text);
+    void write(const uint8_t targets, const EventLog::Record &rec);
+    void getJson(JsonObject &obj);
+private:
+    RingbufHandle_t rb;
+    uint32_t queueDropped {0}; // lines dropped because ring buffer was full
+    uint32_t serialDropped {0}; // lines dropped because USB host doesn't read
+    uint32_t wsDropped {0}; // lines dropped because websocket clients fell behind
+    static void task(void *arg);
+    void send(const uint8_t flags, const void *data, const size_t len);
+    void outputRecord(uint8_t targets, const EventLog::Record &rec);
+    void output(const uint8_t targets, const char *text, const size_t len);
+};
+
+extern LogSink logsink;
@@ -1,13 +1,17 @@
 #pragma once
 
-#include <AsyncMqttClient.h>
+#include <mqtt_client.h>
 #include <ArduinoJson.h>
+#include <atomic>
+#include <deque>
+#include <vector>
 #include "otcontrol.h"
 
 struct MqttConfig {
     String host;
     uint16_t port;
     bool tls;
+    String caCert; // PEM, pins the broker's CA if set, otherwise the CA bundle is used
     String user;
     String pass;
     uint16_t keepAlive;
@@ -15,20 +19,80 @@ struct MqttConfig {
 
 class Mqtt {
 private:
+    enum Event: uint8_t {
+        EVENT_CONNECTED = 0x01,
+        EVENT_DISCONNECTED = 0x02,
+        EVENT_HA_ONLINE = 0x04
+    };
     void onConnect();
-    void onDisconnect(AsyncMqttClientDisconnectReason reason);
-    friend void mqttConnectCb(bool sessionPresent);
-    friend void mqttDisconnectCb(AsyncMqttClientDisconnectReason reason);
-    AsyncMqttClient cli;
+    void onDisconnect();
+    void onHAOnline();
+    void loopEvents();
+    friend void mqttEventHandler(void *arg, esp_event_base_t base, int32_t id, void *data);
+    esp_mqtt_client_handle_t cli {nullptr};
+    std::atomic<uint8_t> events {0}; // set by the client task, handled by loop()
+    std::atomic<bool> linkUp {false}; // connection state as last reported by the client task
+    std::atomic<bool> isConnected {false};
+    std::atomic<int> lastError {0}; // last transport error or connect return code
     uint32_t lastConTry;
     uint32_t lastStatus;
     MqttConfig config;
+    MqttConfig activeConfig; // config of running client
     bool configSet;
+    bool configChanged {false};
+    void startClient();
+    void stopClient();
+    bool publishRaw(const char *topic, const char *payload, const size_t len, const bool retain);
     String baseTopic;
     String statusTopic;
     bool discFlag {false}; // discovery flag; set after MQTT (re-) connect
     bool conFlag;
-    OTControl::CtrlMode strToCtrlMode(String &str);
+    OTControl::CtrlMode strToCtrlMode(const char *str);
+    struct DiscMsg {
+        String topic;
+        String payload;
+        uint32_t topicHash;
+        uint32_t payloadHash;
+        uint8_t tries;
+    };
+    struct DiscHash {
+        uint32_t topic;
+        uint32_t payload;
+    };
+    std::vector<DiscHash> discHashes; // hashes of published discovery messages, sorted by topic
+    std::vector<DiscHash> discRun; // hashes of messages queued in the current discovery run, sorted by topic
+    bool discHashesDirty {false};
+    uint32_t discScope {0}; // hash of broker and HA prefix the hashes are valid for
+    bool discForce {false}; // publish discovery even if unchanged, set by HA birth message
+    uint32_t discSkipped {0};
+    void loadDiscHashes();
+    void saveDiscHashes();
+    void checkDiscScope();
+    static std::vector<DiscHash>::iterator lowerBound(std::vector<DiscHash> &list, const uint32_t topicHash);
+    static bool findHash(std::vector<DiscHash> &list, const uint32_t topicHash, const uint32_t payloadHash);
+    static bool storeHash(std::vector<DiscHash> &list, const uint32_t topicHash, const uint32_t payloadHash);
+    static void removeHash(std::vector<DiscHash> &list, const uint32_t topicHash);
+    bool isDiscPublished(const uint32_t topicHash, const uint32_t payloadHash);
+    void setDiscPublished(const uint32_t topicHash, const uint32_t payloadHash);
+    std::deque<DiscMsg> discQueue; // retained discovery messages waiting to be published
+    size_t discQueueBytes {0};
+    SemaphoreHandle_t discMutex;
+    uint32_t lastDiscSlot {0};
+    uint32_t lastDiscRun {0};
+    uint32_t discSent {0};
+    uint32_t discFailed {0};
+    void loopDiscQueue();
+    void clearDiscQueue();
+    std::deque<String> telemQueue; // status records captured while offline, oldest first
+    size_t telemQueueBytes {0};
+    size_t telemPending {0}; // copy of queue size, read by other tasks
+    uint32_t lastTelemCapture {0};
+    uint32_t lastTelemSlot {0};
+    uint32_t telemDropped {0};
+    uint32_t telemReplayed {0};
+    String historyTopic;
+    void captureTelemetry();
+    void loopTelemReplay();
 public:
     enum MqttTopic: uint8_t {
         TOPIC_OUTSIDETEMP,
@@ -53,6 +117,7 @@ public:
         TOPIC_AUTOBYPASS,
         TOPIC_FREEVENTENABLE,
         TOPIC_MAXMODULATION,
+        TOPIC_LOGLEVEL,
         TOPIC_UNKNOWN // has to be at end of list!
     };
     Mqtt();
@@ -61,7 +126,11 @@ public:
     bool connected();
     void setConfig(const MqttConfig conf);
     bool publish(String topic, JsonDocument &payload, const bool retain);
-    void onMessage(const char *topic, String &payload);
+    bool queueDiscovery(const char *topic, const char *payload, const size_t len);
+    void refreshDiscovery();
+    void getDiscStatus(JsonObject &obj);
+    void getTelemStatus(JsonObject &obj);
+    void onMessage(const char *topic, const char *payload, const size_t len);
     String getBaseTopic();
     static String getTopicString(const MqttTopic topic);
     String getCmdTopic(const MqttTopic topic);
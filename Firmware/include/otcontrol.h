@@ -113,11 +113,21 @@ private:
         uint8_t maxModulation;
     } boilerCtrl;
     struct FlameRatio {
+    private:
+        static const uint8_t FLAMERAT_BUFSIZE = 180;
+    public:
+        struct State {
+            uint8_t on[FLAMERAT_BUFSIZE];
+            uint8_t cycles[FLAMERAT_BUFSIZE];
+            uint8_t idx;
+            bool init;
+        };
         void loop();
         uint8_t getDuty() const;
         double getFreq() const;
+        void getState(State &state) const;
+        void setState(const State &state);
     private:
-        static const uint8_t FLAMERAT_BUFSIZE = 180;
         void update();
         void set(const bool flame);
         bool init {false};
@@ -163,13 +173,26 @@ private:
     } master, slave;
     bool slaveEnabled {false};
     uint16_t statusReqOvl {0}; // will be or'ed to status request as this is needed by some boilers
+    JsonDocument pendingConfig; // staged by setConfig(), applied by loop() when the bus is idle
+    JsonDocument pendingPrev;
+    bool configPending {false};
+    bool configWarned {false}; // bus busy warning logged for the pending config
+    unsigned long configStaged; // millis
+    void loopConfig();
+    void applyConfig(JsonObjectConst config, JsonObjectConst prev);
+    struct RuntimeState;
+    void loadState();
+    unsigned long lastStateSave {0};
+    uint32_t stateCrc {0}; // of last saved state, unchanged state isn't written again
+    uint32_t stateWrites {0}; // total number of NVS writes, persisted
+    bool stateRestored {false};
 public:
     OTControl();
     void begin();
     void loop();
     bool slaveRequest(SlaveRequestStruct &srs);
     void getJson(JsonObject &obj);
-    void setConfig(JsonObject &config);
+    void setConfig(JsonObjectConst config, JsonObjectConst prev);
     void setDhwTemp(const double temp);
     void setChTemp(const double temp, const uint8_t channel);
     void setChCtrlMode(const CtrlMode mode, const uint8_t channel);
@@ -184,6 +207,7 @@ public:
     void setMaxMod(const int mm);
     void setRoomComp(const bool en, const uint8_t channel);
     void bypass();
+    void saveState(const bool force = false);
 };
 
 
@@ -2,6 +2,9 @@
 #define _portal_h
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <vector>
 
 class Portal {
 private:
@@ -10,11 +13,20 @@ private:
     bool updateEnable;
     bool checkUpdate {false};
     bool doUpdate {false};
+    JsonDocument statusDoc; // last status pushed to websocket subscribers
+    std::vector<uint32_t> statusClients; // websocket clients subscribed to status
+    std::vector<uint32_t> newStatusClients; // subscribed, waiting for full snapshot
+    SemaphoreHandle_t wsMutex;
+    std::atomic<uint32_t> lastStatusPush {0}; // set by onWsSubscribe() in the web server task
+    void onWsSubscribe(const uint32_t id);
+    void onWsDisconnect(const uint32_t id);
+    void pushStatus();
 public:
     Portal();
     void begin(bool configMode);
     void loop();
-    void textAll(String text);
+    bool wsLog(const char *text, const size_t len);
+    bool hasWsClients();
 };
 
 extern Portal portal;
@@ -22,4 +34,4 @@ extern Portal portal;
 extern const IPAddress apAddress;
 extern const IPAddress apMask;
 #endif
-#endif
\ No newline at end of file
+#endif
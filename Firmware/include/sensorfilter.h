@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+class SensorFilter {
+public:
+    enum Type: uint8_t {
+        FILTER_NONE,
+        FILTER_MEDIAN,
+        FILTER_EMA,
+        FILTER_RATE
+    };
+    static const uint8_t MEDIAN_MAX = 7;
+    SensorFilter();
+    void setConfig(JsonObjectConst obj);
+    void reset();
+    double apply(const double val, const uint32_t now);
+private:
+    Type type;
+    uint8_t n; // median window
+    double alpha; // EMA weight of new value
+    double rate; // K/min, rate limit
+    double hist[MEDIAN_MAX];
+    uint8_t histLen;
+    uint8_t histPos;
+    double last;
+    uint32_t lastTime;
+    bool primed;
+};
@@ -4,66 +4,112 @@
 #include <ArduinoJson.h>
 #include <AsyncTCP.h>
 #include <NimBLEDevice.h>
+#include <vector>
+#include <algorithm>
 #include "util.h"
+#include "bthome.h"
+#include "sensorfilter.h"
+
+#ifndef BLE_MAX_SENSORS
+#define BLE_MAX_SENSORS 16 // max. number of tracked BLE sensors
+#endif
 
 class AddressableSensor {
 friend class Sensor;
 friend class SensorLock;
 private:
     uint8_t adrLen;
+    char adrStr[17]; // hex address, formatted once
     static SemaphoreHandle_t mutex;
 protected:
-    AddressableSensor(const uint8_t *adr, const uint8_t adrLen, AddressableSensor **prev);
-    String getAdr() const;
-    static AddressableSensor* find(String adr, AddressableSensor *last);
-    static void writeJsonAll(JsonObject &status, AddressableSensor *last);
+    typedef std::vector<AddressableSensor*> Registry; // sorted by raw address
+    AddressableSensor(const uint8_t *adr, const uint8_t adrLen, Registry &reg);
+    const char* getAdr() const;
+    static AddressableSensor* find(const uint8_t *adr, const Registry &reg);
+    static void writeJsonAll(JsonObject &status, const Registry &reg);
     virtual void writeJson(JsonVariant val) = 0;
-    static bool sendDiscoveryAll(AddressableSensor *last);
+    static bool sendDiscoveryAll(const Registry &reg);
     virtual bool sendDiscovery() = 0;
     uint8_t adr[8];
-    AddressableSensor *next;
     double temp;
 public:
+    virtual ~AddressableSensor() {}
+    static bool parseAdr(const char *str, uint8_t *adr, const uint8_t len);
     static void begin();
-#ifdef NODO
-    void lock();    // <--- REQUIRED
-    void unlock();  // <--- REQUIRED
-#endif
+    void lock();
+    void unlock();
 };
 
 class BLESensor: public AddressableSensor {
 private:
-    void parse(std::string &data);
-    static BLESensor *last;
-    uint8_t rh;
-    uint8_t bat;
+    void update(const BTHome::Reading &r);
+    static Registry sensors;
+    static uint8_t allowList[BLE_MAX_SENSORS][6];
+    static uint8_t allowCount;
+    static uint32_t numEvicted;
+    static uint32_t numRejected;
+    static uint32_t lastPurge;
+    static NimBLEScan *scan;
+    static uint32_t discoveryStart; // scan for unconfigured sensors after boot and config changes
+    static uint32_t scanStart;
+    static uint32_t scanTime; // ms, total time scanning
+    static uint32_t lastScanCheck;
+    BTHome::Reading reading; // last value of each field received
     int8_t rssi;
+    uint32_t lastSeen; // millis
+    uint32_t advInterval; // ms, learned advertising interval, 0: unknown
+    static bool isAllowed(const uint8_t *adr);
+    static bool isPinned(const uint8_t *adr);
+    static bool evict(const bool staleOnly);
+    static bool scanNeeded(const uint8_t *adr);
+    static bool scanNeeded();
+    static void setScan(const bool on);
 protected:
     void writeJson(JsonVariant val) override;
     bool sendDiscovery() override;
 public:
     BLESensor(const uint8_t *adr);
     static void begin();
+    static void loop();
     static void onDiscovery(const NimBLEAdvertisedDevice* dev);
     static void writeJsonAll(JsonObject &status);
+    static void getStats(JsonObject &status);
+    static void setAllowList(JsonArrayConst list);
     static BLESensor* find(const uint8_t *adr);
     static bool sendDiscoveryAll();
+    bool getTemp(double &t, uint32_t &time) const;
 
 };
 
 class OneWireNode: public AddressableSensor {
 private:
-    static OneWireNode *last;
+    static Registry nodes;
+    static enum State {
+        OW_IDLE,
+        OW_CONVERTING,
+        OW_READING
+    } state;
+    static size_t readIdx; // next node to read in state OW_READING
+    static uint32_t convStart;
+    static uint32_t convTime;
+    static uint32_t crcErrors;
+    uint8_t resolution; // bits, 9..12
+    bool resChanged;
+    static void startConversion();
+    void read();
+    void publish();
 protected:
     void writeJson(JsonVariant val) override;
     bool sendDiscovery() override;
 public:
     OneWireNode(uint8_t *addr);
     static void begin();
-    static OneWireNode* find(String adr);
+    static OneWireNode* find(const uint8_t *adr);
     static void loop();
     static void writeJsonAll(JsonObject &status);
+    static void getStats(JsonObject &status);
     static bool sendDiscoveryAll();
+    void setResolution(const uint8_t bits);
 };
 
 class Sensor {
@@ -77,32 +123,65 @@ public:
         SOURCE_OPENWEATHER = 4,
         SOURCE_AUTO = 5 // has to be last item in this list!
     };
-    OneWireNode *own; // points to a OneWireNode if configured
+    static const uint8_t MAX_INPUTS = 3; // configured source and fallbacks
     Sensor();
     virtual void set(const double val, const Source src);
-    bool get(double &val);
+    void setOneWire(const OneWireNode *node, const double val);
+    void invalidate(const Source src);
+    virtual bool get(double &val);
     virtual void setConfig(JsonObject &obj);
     bool isMqttSource();
     bool isOtSource();
+    Source activeSource();
+    bool usesBle(const uint8_t *adr) const;
+    const uint8_t* getBleAdr(const uint8_t idx) const;
     static void loopAll();
-    explicit operator bool() const;
+    virtual explicit operator bool() const;
 protected:
-    Source src;
-    double value;
-    bool setFlag;
+    struct Input {
+        Source src;
+        OneWireNode *own; // if source is 1wire
+        BLESensor *ble; // if source is BLE, once it has been seen
+        uint8_t bleAdr[6];
+        SensorFilter filter;
+        double value;
+        uint32_t time; // millis of last update
+        bool valid;
+    };
+    Input inputs[MAX_INPUTS];
+    uint8_t numInputs;
+    uint32_t maxAge; // ms, 0: values never expire
+    Source src; // configured (primary) source
+    double defValue; // default, used until an input delivers
+    bool defValid;
     virtual void loop() {}
+    void setInput(Input &in, const double val);
+    void setInputConfig(Input &in, JsonObjectConst obj);
+    bool refresh(Input &in);
+    bool isFresh(const Input &in) const;
+    bool hasSource(const Source s) const;
 private:
     static Sensor *lastSensor;
     Sensor *prevSensor;
-    uint8_t adr[6];
 };
 
 class AutoSensor: public Sensor {
 public:
+    enum OverrideMode: uint8_t {
+        OVERRIDE_NONE,
+        OVERRIDE_TEMP, // until the configured source changes its value
+        OVERRIDE_CONST // until cancelled
+    };
     AutoSensor();
     void set(const double val, const Source src);
+    void setOverride(const double val, const OverrideMode mode);
+    bool get(double &val);
+    explicit operator bool() const;
 private:
     double values[SOURCE_AUTO + 1];
+    uint8_t seen; // bit mask of sources which delivered a value
+    OverrideMode ovrMode;
+    double ovrValue;
 };
 
 class OutsideTemp: public Sensor {
@@ -113,17 +192,50 @@ public:
 protected:
     void loop();
 private:
+    static const size_t LINE_MAX_LEN = 128;
+    static const size_t BODY_MAX_LEN = 1536;
     uint32_t nextMillis;
+    uint32_t timeout;
     uint32_t interval;
+    uint32_t backoff; // ms, grows with consecutive errors
     double lat, lon;
     String apikey;
+    String host;
+    uint16_t port;
     AsyncClient acli;
-    String replyBuf;
+    // response parser, runs in the AsyncTCP task
+    enum ParseState: uint8_t {
+        PARSE_STATUS,
+        PARSE_HEADER,
+        PARSE_BODY,
+        PARSE_CHUNK_SIZE,
+        PARSE_CHUNK_DATA,
+        PARSE_CHUNK_END,
+        PARSE_TRAILER,
+        PARSE_DONE,
+        PARSE_ERROR
+    };
+    volatile ParseState parseState;
+    char line[LINE_MAX_LEN];
+    size_t lineLen;
+    char body[BODY_MAX_LEN];
+    size_t bodyLen;
+    size_t remaining; // bytes of body or current chunk left
+    bool hasLength;
+    bool chunked;
+    bool keepAlive;
+    int httpStatus;
     enum {
         HTTP_IDLE,
         HTTP_CONNECTING,
         HTTP_RECEIVING
     } httpState;
+    void sendRequest();
+    void onData(const char *data, size_t len);
+    bool onLine();
+    bool appendBody(const char *data, const size_t len);
+    void onResponse();
+    void onError(const String &msg);
 };
 
 extern Sensor roomTemp[2];
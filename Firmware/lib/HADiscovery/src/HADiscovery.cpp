@@ -53,187 +53,381 @@ const char HA_RETAIN[]                          PROGMEM = "retain";
 String HADiscovery::ha_prefix = F("homeassistant");
 String HADiscovery::devName;
 
+// bounded writer for JSON text, stops writing once the buffer is full
+class JsonWriter {
+private:
+    char *buf;
+    size_t size;
+    size_t len {0};
+    bool overflow {false};
+public:
+    JsonWriter(char *buf, const size_t size):
+            buf(buf),
+            size(size) {
+        if (size > 0)
+            buf[0] = 0;
+    }
+    void raw(const char *str, const size_t n) {
+        if (overflow || (len + n >= size)) {
+            overflow = true;
+            return;
+        }
+        memcpy(buf + len, str, n);
+        len += n;
+        buf[len] = 0;
+    }
+    void raw(const char *str) {
+        raw(str, strlen(str));
+    }
+    void str(const char *str) {
+        raw("\"", 1);
+        while (*str) {
+            const char c = *str++;
+            switch (c) {
+            case '"':  raw("\\\"", 2); break;
+            case '\\': raw("\\\\", 2); break;
+            case '\n': raw("\\n", 2); break;
+            case '\r': raw("\\r", 2); break;
+            case '\t': raw("\\t", 2); break;
+            default:
+                if ((uint8_t) c < 0x20) {
+                    char esc[7];
+                    snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    raw(esc, 6);
+                }
+                else
+                    raw(&c, 1);
+            }
+        }
+        raw("\"", 1);
+    }
+    void num(const double val) {
+        char tmp[24];
+        raw(tmp, snprintf(tmp, sizeof(tmp), "%g", val));
+    }
+    size_t length() const { return len; }
+    bool ok() const { return !overflow; }
+};
+
 HADiscovery::HADiscovery():
         manufacturer(nullptr) {
+    device[0] = 0;
+    topic[0] = 0;
+    payload[0] = 0;
 }
 
 void HADiscovery::setHAPrefix(String prefix) {
     ha_prefix = prefix;
 }
 
-void HADiscovery::init(String &name, String &id, String component) {
-    doc.clear();
-    JsonObject dev = doc[FPSTR(HA_DEVICE)].to<JsonObject>();
-    dev[FPSTR(HA_IDENTIFIERS)][0] = devPrefix;
-    dev[FPSTR(HA_SW_VERSION)] = BUILD_VERSION;
-    dev[FPSTR(HA_NAME)] = devName;
-    dev[FPSTR(HA_MANUFACTURER)] = FPSTR(manufacturer);
+String HADiscovery::getHAPrefix() {
+    return ha_prefix;
+}
+
+void HADiscovery::buildDevice() {
+    JsonWriter w(device, sizeof(device));
+    w.raw("{");
+    w.str(HA_IDENTIFIERS);
+    w.raw(":[");
+    w.str(devPrefix.c_str());
+    w.raw("],");
+    w.str(HA_SW_VERSION);
+    w.raw(":");
+    w.str(BUILD_VERSION);
+    w.raw(",");
+    w.str(HA_NAME);
+    w.raw(":");
+    w.str(devName.c_str());
+    w.raw(",");
+    w.str(HA_MANUFACTURER);
+    w.raw(":");
+    if (manufacturer != nullptr)
+        w.str(manufacturer);
+    else
+        w.raw("null");
+    w.raw("}");
+    if (!w.ok())
+        strcpy(device, "{}");
+}
+
+void HADiscovery::init(HAStr name, HAStr id, const char *component) {
+    numFields = 0;
+    valuesLen = 0;
+    cleared = false;
+    overflow = false;
+    if (device[0] == 0)
+        buildDevice();
+
+    setString(HA_NAME, name);
 
-    doc[FPSTR(HA_NAME)] = name;
-    doc[FPSTR(HA_UNIQUE_ID)] = devPrefix + "_" + id;
+    char uniqId[96];
+    if (snprintf(uniqId, sizeof(uniqId), "%s_%s", devPrefix.c_str(), id.c_str()) >= (int) sizeof(uniqId))
+        overflow = true;
+    setString(HA_UNIQUE_ID, uniqId);
 
-    topic = ha_prefix;
-    topic += '/' + component + '/' + devPrefix + '/' + id + F("/config");
+    if (snprintf(topic, sizeof(topic), "%s/%s/%s/%s/config", ha_prefix.c_str(), component, devPrefix.c_str(), id.c_str()) >= (int) sizeof(topic))
+        overflow = true;
 
     setStateTopic(defaultStateTopic);
 }
 
+/**
+ * Removes a field and its value, values behind it are moved down to keep the values compact
+ */
+void HADiscovery::removeField(const char *key) {
+    for (uint8_t i=0; i<numFields; i++) {
+        if (strcmp(fields[i].key, key) == 0) {
+            const Field f = fields[i];
+            memmove(values + f.pos, values + f.pos + f.len, valuesLen - f.pos - f.len);
+            valuesLen -= f.len;
+            memmove(&fields[i], &fields[i + 1], (numFields - i - 1) * sizeof(Field));
+            numFields--;
+            for (uint8_t j=0; j<numFields; j++)
+                if (fields[j].pos > f.pos)
+                    fields[j].pos -= f.len;
+            return;
+        }
+    }
+}
+
+/**
+ * Adds the value written by w at the end of values. Replaced fields have to be removed before
+ * the value is written.
+ */
+void HADiscovery::addField(const char *key, const JsonWriter &w) {
+    if (!w.ok() || (numFields >= MAX_FIELDS)) {
+        overflow = true;
+        return;
+    }
+    fields[numFields].key = key;
+    fields[numFields].pos = valuesLen;
+    fields[numFields].len = w.length();
+    numFields++;
+    valuesLen += w.length();
+}
+
+void HADiscovery::setString(const char *key, HAStr val) {
+    removeField(key);
+    JsonWriter w(values + valuesLen, sizeof(values) - valuesLen);
+    w.str(val.c_str());
+    addField(key, w);
+}
+
+void HADiscovery::setNumber(const char *key, const double val) {
+    removeField(key);
+    JsonWriter w(values + valuesLen, sizeof(values) - valuesLen);
+    w.num(val);
+    addField(key, w);
+}
+
+void HADiscovery::setBool(const char *key, const bool val) {
+    setRaw(key, val ? "true" : "false");
+}
+
+void HADiscovery::setRaw(const char *key, const char *json) {
+    removeField(key);
+    JsonWriter w(values + valuesLen, sizeof(values) - valuesLen);
+    w.raw(json);
+    addField(key, w);
+}
+
+/**
+ * Writes the payload of the current entity
+ * @return length of payload, 0 if cleared or on overflow, see isValid()
+ */
+size_t HADiscovery::serialize() {
+    if (cleared || overflow) {
+        payload[0] = 0;
+        return 0;
+    }
+
+    JsonWriter w(payload, sizeof(payload));
+    w.raw("{");
+    w.str(HA_DEVICE);
+    w.raw(":");
+    w.raw(device);
+    for (uint8_t i=0; i<numFields; i++) {
+        w.raw(",");
+        w.str(fields[i].key);
+        w.raw(":");
+        w.raw(values + fields[i].pos, fields[i].len);
+    }
+    w.raw("}");
+    if (!w.ok()) {
+        overflow = true;
+        payload[0] = 0;
+        return 0;
+    }
+    return w.length();
+}
+
+/**
+ * @return false if a field, the topic or the payload didn't fit into its buffer,
+ * the entity must not be published then
+ */
+bool HADiscovery::isValid() const {
+    return !overflow;
+}
+
 void HADiscovery::clearDoc() {
-    doc.clear();
+    cleared = true;
 }
 
 bool HADiscovery::publish() {
     return false;
 }
 
-void HADiscovery::setValueTemplate(String valueTemplate) {
-    doc[FPSTR(HA_VALUE_TEMPLATE)] = valueTemplate;
+void HADiscovery::setValueTemplate(HAStr valueTemplate) {
+    setString(HA_VALUE_TEMPLATE, valueTemplate);
 }
 
-void HADiscovery::setTemperatureStateTopic(String topic) {
-    doc[FPSTR(HA_TEMPERATURE_STATE_TOPIC)] = topic;
+void HADiscovery::setTemperatureStateTopic(HAStr topic) {
+    setString(HA_TEMPERATURE_STATE_TOPIC, topic);
 }
 
-void HADiscovery::setTemperatureStateTemplate(String stateTemplate) {
-    doc[FPSTR(HA_TEMPERATURE_STATE_TEMPLATE)] = stateTemplate;
+void HADiscovery::setTemperatureStateTemplate(HAStr stateTemplate) {
+    setString(HA_TEMPERATURE_STATE_TEMPLATE, stateTemplate);
 }
 
-void HADiscovery::setCurrentTemperatureTopic(String topic) {
-    doc[FPSTR(HA_CURRENT_TEMPERATURE_TOPIC)] = topic;
+void HADiscovery::setCurrentTemperatureTopic(HAStr topic) {
+    setString(HA_CURRENT_TEMPERATURE_TOPIC, topic);
 }
 
-void HADiscovery::setCurrentTemperatureTemplate(String templ) {
-    doc[FPSTR(HA_CURRENT_TEMPERATURE_TEMPLATE)] = templ;
+void HADiscovery::setCurrentTemperatureTemplate(HAStr templ) {
+    setString(HA_CURRENT_TEMPERATURE_TEMPLATE, templ);
 }
 
-void HADiscovery::setStateTopic(String stateTopic) {
+void HADiscovery::setStateTopic(HAStr stateTopic) {
     if (stateTopic.isEmpty())
-        doc.remove(FPSTR(HA_STATE_TOPIC));
+        removeField(HA_STATE_TOPIC);
     else
-        doc[FPSTR(HA_STATE_TOPIC)] = stateTopic;
+        setString(HA_STATE_TOPIC, stateTopic);
 }
 
 void HADiscovery::setMinMax(double min, double max, double step) {
-    doc[FPSTR(HA_MIN)] = min;
-    doc[FPSTR(HA_MAX)] = max;
-    doc[FPSTR(HA_STEP)] = step;
+    setNumber(HA_MIN, min);
+    setNumber(HA_MAX, max);
+    setNumber(HA_STEP, step);
 }
 
 void HADiscovery::setMinMaxTemp(double min, double max, double step) {
-    doc[FPSTR(HA_MIN_TEMP)] = min;
-    doc[FPSTR(HA_MAX_TEMP)] = max;
+    setNumber(HA_MIN_TEMP, min);
+    setNumber(HA_MAX_TEMP, max);
     if (step > 0)
-        doc[FPSTR(HA_TEMP_STEP)] = step;
+        setNumber(HA_TEMP_STEP, step);
 }
 
 void HADiscovery::setInitial(double initial) {
-    doc[FPSTR(HA_INITIAL)] = initial;
+    setNumber(HA_INITIAL, initial);
 }
 
-void HADiscovery::setModeCommandTopic(String topic) {
-    doc[FPSTR(HA_MODE_COMMAND_TOPIC)] = topic;
+void HADiscovery::setModeCommandTopic(HAStr topic) {
+    setString(HA_MODE_COMMAND_TOPIC, topic);
 }
 
 void HADiscovery::setOptimistic(const bool opt) {
-    doc[FPSTR(HA_OPTIMISTIC)] = opt;
+    setBool(HA_OPTIMISTIC, opt);
 }
 
 void HADiscovery::setRetain(const bool retain) {
-    doc[FPSTR(HA_RETAIN)] = retain;
+    setBool(HA_RETAIN, retain);
 }
 
-void HADiscovery::setIcon(String icon) {
-    doc[FPSTR(HA_ICON)] = icon;
+void HADiscovery::setIcon(HAStr icon) {
+    setString(HA_ICON, icon);
 }
 
 void HADiscovery::setModes(const uint8_t modes) {
-    JsonArray jModes = doc[F("modes")].to<JsonArray>();
-    jModes.clear();
-
+    char jModes[32];
+    JsonWriter w(jModes, sizeof(jModes));
+    w.raw("[");
     if ( (modes & (1<<0)) != 0)
-        jModes.add(F("off"));
-    if ( (modes & (1<<1)) != 0)
-        jModes.add(F("heat"));
-    if ( (modes & (1<<2)) != 0)
-        jModes.add(F("auto"));
+        w.str("off");
+    if ( (modes & (1<<1)) != 0) {
+        if (w.length() > 1)
+            w.raw(",");
+        w.str("heat");
+    }
+    if ( (modes & (1<<2)) != 0) {
+        if (w.length() > 1)
+            w.raw(",");
+        w.str("auto");
+    }
+    w.raw("]");
+    setRaw(HA_MODES, jModes);
 }
 
-void HADiscovery::setUnit(const String unit) {
-    doc[FPSTR(HA_UNIT_OF_MEASUREMENT)] = unit;
+void HADiscovery::setUnit(HAStr unit) {
+    setString(HA_UNIT_OF_MEASUREMENT, unit);
 }
 
-void HADiscovery::setDeviceClass(const String dc) {
-    doc[FPSTR(HA_DEVICE_CLASS)] = dc;
+void HADiscovery::setDeviceClass(HAStr dc) {
+    setString(HA_DEVICE_CLASS, dc);
 }
 
-void HADiscovery::setStateClass(const String sc) {
+void HADiscovery::setStateClass(HAStr sc) {
     if (sc.isEmpty())
-        doc.remove(FPSTR(HA_STATE_CLASS));
+        removeField(HA_STATE_CLASS);
     else
-        doc[FPSTR(HA_STATE_CLASS)] = sc;
+        setString(HA_STATE_CLASS, sc);
 }
 
-void HADiscovery::createSensor(String name, String id) {
-    init(name, id, F("sensor"));
-    doc[FPSTR(HA_STATE_CLASS)] = FPSTR(HA_STATE_CLASS_MEASUREMENT);
+void HADiscovery::createSensor(HAStr name, HAStr id) {
+    init(name, id, PSTR("sensor"));
+    setString(HA_STATE_CLASS, HA_STATE_CLASS_MEASUREMENT);
 }
 
-void HADiscovery::createTempSensor(String name, String id) {
+void HADiscovery::createTempSensor(HAStr name, HAStr id) {
     createSensor(name, id);
     setDeviceClass(FPSTR(HA_DEVICE_CLASS_TEMPERATURE));
     setUnit(PSTR(HA_UNIT_CELSIUS));
 }
 
-void HADiscovery::createPowerFactorSensor(String name, String id) {
+void HADiscovery::createPowerFactorSensor(HAStr name, HAStr id) {
     createSensor(name, id);
-    doc[FPSTR(HA_DEVICE_CLASS)] = F("power_factor");
-    doc[FPSTR(HA_UNIT_OF_MEASUREMENT)] = PSTR(HA_UNIT_PERCENT);
+    setString(HA_DEVICE_CLASS, F("power_factor"));
+    setString(HA_UNIT_OF_MEASUREMENT, HA_UNIT_PERCENT);
 }
 
-void HADiscovery::createPressureSensor(String name, String id) {
+void HADiscovery::createPressureSensor(HAStr name, HAStr id) {
     createSensor(name, id);
-    doc[FPSTR(HA_DEVICE_CLASS)] = F("pressure");
-    doc[FPSTR(HA_UNIT_OF_MEASUREMENT)] = F("bar");
+    setString(HA_DEVICE_CLASS, F("pressure"));
+    setString(HA_UNIT_OF_MEASUREMENT, F("bar"));
 }
 
-void HADiscovery::createHourDuration(String name, String id) {
+void HADiscovery::createHourDuration(HAStr name, HAStr id) {
     createSensor(name, id);
-    doc[FPSTR(HA_STATE_CLASS)] = F("total_increasing");
-    doc[FPSTR(HA_DEVICE_CLASS)] = F("duration");
-    doc[FPSTR(HA_UNIT_OF_MEASUREMENT)] = F("h");
-    doc[FPSTR(HA_ICON)] = F("mdi:timer-sand-complete");
+    setString(HA_STATE_CLASS, F("total_increasing"));
+    setString(HA_DEVICE_CLASS, F("duration"));
+    setString(HA_UNIT_OF_MEASUREMENT, F("h"));
+    setString(HA_ICON, F("mdi:timer-sand-complete"));
 }
 
-void HADiscovery::createBinarySensor(String name, String id, String deviceClass) {
-    init(name, id, F("binary_sensor"));
+void HADiscovery::createBinarySensor(HAStr name, HAStr id, HAStr deviceClass) {
+    init(name, id, PSTR("binary_sensor"));
     if (!deviceClass.isEmpty())
-        doc[FPSTR(HA_DEVICE_CLASS)] = deviceClass;
+        setString(HA_DEVICE_CLASS, deviceClass);
 }
 
-void HADiscovery::createNumber(String name, String id, String cmdTopic) {
-    init(name, id, F("number"));
-    doc[FPSTR(HA_PLATFORM)] = F("number");
-    doc[FPSTR(HA_COMMAND_TOPIC)] = cmdTopic;
+void HADiscovery::createNumber(HAStr name, HAStr id, HAStr cmdTopic) {
+    init(name, id, PSTR("number"));
+    setString(HA_PLATFORM, F("number"));
+    setString(HA_COMMAND_TOPIC, cmdTopic);
 }
 
-void HADiscovery::createClima(String name, String id, String tmpCmdTopic) {
-    init(name, id, F("climate"));
-    doc[FPSTR(HA_TEMPERATURE_COMMAND_TOPIC)] = tmpCmdTopic;
+void HADiscovery::createClima(HAStr name, HAStr id, HAStr tmpCmdTopic) {
+    init(name, id, PSTR("climate"));
+    setString(HA_TEMPERATURE_COMMAND_TOPIC, tmpCmdTopic);
     setModes(0x07); // off, heat, auto
 }
 
-void HADiscovery::createrWaterHeater(String name, String id, String tmpCmdTopic) {
-    init(name, id, F("water_heater"));
-
-    JsonArray jModes = doc[F("modes")].to<JsonArray>();
-    jModes.clear();
-    jModes.add(F("off"));
-    jModes.add(F("gas"));
-
-    doc[FPSTR(HA_TEMPERATURE_COMMAND_TOPIC)] = tmpCmdTopic;
+void HADiscovery::createrWaterHeater(HAStr name, HAStr id, HAStr tmpCmdTopic) {
+    init(name, id, PSTR("water_heater"));
+    setRaw(HA_MODES, PSTR("[\"off\",\"gas\"]"));
+    setString(HA_TEMPERATURE_COMMAND_TOPIC, tmpCmdTopic);
 }
 
-void HADiscovery::createSwitch(String name, String id, String cmdTopic) {
-    init(name, id, F("switch"));
-    doc[FPSTR(HA_COMMAND_TOPIC)] = cmdTopic;
-}
\ No newline at end of file
+void HADiscovery::createSwitch(HAStr name, HAStr id, HAStr cmdTopic) {
+    init(name, id, PSTR("switch"));
+    setString(HA_COMMAND_TOPIC, cmdTopic);
+}
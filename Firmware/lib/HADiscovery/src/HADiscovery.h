@@ -1,5 +1,5 @@
 #pragma once
-#include <ArduinoJson.h>
+#include <Arduino.h>
 
 extern const char *HA_DEVICE_CLASS_RUNNING PROGMEM;
 extern const char *HA_DEVICE_CLASS_PROBLEM PROGMEM;
@@ -14,14 +14,50 @@ extern const char *HA_UNIT_PERCENT PROGMEM;
 extern const char *HA_UNIT_CELSIUS PROGMEM;
 extern const char *HA_UNIT_KELVIN PROGMEM;
 
+// non owning string argument, accepts C strings, flash strings and Strings without copying
+class HAStr {
+private:
+    const char *str;
+public:
+    HAStr(const char *str): str(str) {}
+    HAStr(const __FlashStringHelper *str): str((const char*) str) {}
+    HAStr(const String &str): str(str.c_str()) {}
+    const char* c_str() const { return (str != nullptr) ? str : ""; }
+    bool isEmpty() const { return (str == nullptr) || (*str == 0); }
+};
+
+class JsonWriter;
 
 class HADiscovery {
 private:
-    void init(String &name, String &id, String component);
+    static const uint8_t MAX_FIELDS = 24;
+    static const size_t VALUES_SIZE = 1024;
+    static const size_t DEVICE_SIZE = 192;
+    struct Field {
+        const char *key;
+        uint16_t pos; // position of JSON encoded value in values
+        uint16_t len;
+    };
+    Field fields[MAX_FIELDS];
+    uint8_t numFields {0};
+    char values[VALUES_SIZE]; // JSON encoded values of all fields
+    size_t valuesLen {0};
+    char device[DEVICE_SIZE]; // JSON encoded device block, built once
+    bool cleared {false};
+    bool overflow {false}; // a field didn't fit, entity is incomplete
+    void init(HAStr name, HAStr id, const char *component);
+    void removeField(const char *key);
+    void addField(const char *key, const JsonWriter &w);
+    void setString(const char *key, HAStr val);
+    void setNumber(const char *key, const double val);
+    void setBool(const char *key, const bool val);
+    void setRaw(const char *key, const char *json);
     static String ha_prefix;
 protected:
-    JsonDocument doc;
-    String topic;
+    char topic[160];
+    char payload[VALUES_SIZE + MAX_FIELDS * 20 + DEVICE_SIZE + 16];
+    void buildDevice();
+    size_t serialize();
 public:
     HADiscovery();
     static String devName;
@@ -29,34 +65,36 @@ public:
     String devPrefix;
     String defaultStateTopic;
     static void setHAPrefix(String prefix);
+    static String getHAPrefix();
     virtual bool publish();
+    bool isValid() const;
     void clearDoc();
-    void setValueTemplate(String valueTemplate);
-    void setStateTopic(String stateTopic);
+    void setValueTemplate(HAStr valueTemplate);
+    void setStateTopic(HAStr stateTopic);
     void setMinMax(double min, double max, double step);
     void setMinMaxTemp(double min, double max, double step = 0);
-    void setTemperatureStateTopic(String topic);
-    void setTemperatureStateTemplate(String stateTemplate);
-    void setCurrentTemperatureTopic(String topic);
-    void setCurrentTemperatureTemplate(String templ);
+    void setTemperatureStateTopic(HAStr topic);
+    void setTemperatureStateTemplate(HAStr stateTemplate);
+    void setCurrentTemperatureTopic(HAStr topic);
+    void setCurrentTemperatureTemplate(HAStr templ);
     void setInitial(double initial);
-    void setModeCommandTopic(String topic);
+    void setModeCommandTopic(HAStr topic);
     void setOptimistic(const bool opt);
     void setRetain(const bool retain);
-    void setIcon(String icon);
+    void setIcon(HAStr icon);
     void setModes(const uint8_t modes);
-    void setUnit(const String unit);
-    void setDeviceClass(const String dc);
-    void setStateClass(const String sc);
+    void setUnit(HAStr unit);
+    void setDeviceClass(HAStr dc);
+    void setStateClass(HAStr sc);
 
-    void createTempSensor(String name, String id);
-    void createPowerFactorSensor(String name, String id);
-    void createPressureSensor(String name, String id);
-    void createHourDuration(String name, String id);
-    void createSensor(String name, String id);
-    void createBinarySensor(String name, String id, String deviceClass);
-    void createNumber(String name, String id, String cmdTopic);
-    void createClima(String name, String id, String tmpCmdTopic);
-    void createSwitch(String name, String id, String cmdTopic);
-    void createrWaterHeater(String name, String id, String tmpCmdTopic);
+    void createTempSensor(HAStr name, HAStr id);
+    void createPowerFactorSensor(HAStr name, HAStr id);
+    void createPressureSensor(HAStr name, HAStr id);
+    void createHourDuration(HAStr name, HAStr id);
+    void createSensor(HAStr name, HAStr id);
+    void createBinarySensor(HAStr name, HAStr id, HAStr deviceClass);
+    void createNumber(HAStr name, HAStr id, HAStr cmdTopic);
+    void createClima(HAStr name, HAStr id, HAStr tmpCmdTopic);
+    void createSwitch(HAStr name, HAStr id, HAStr cmdTopic);
+    void createrWaterHeater(HAStr name, HAStr id, HAStr tmpCmdTopic);
 };
@@ -0,0 +1,81 @@
+#pragma once
+
+// Host shim of the Arduino core, only what the modules of the native environment use
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "freertos/FreeRTOS.h"
+
+// no separate flash address space on the host, F() only changes the type like on the ESP32
+#define PROGMEM
+#define IRAM_ATTR
+#define PSTR(s) (s)
+#define FPSTR(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define F(s) FPSTR(s)
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+#define pgm_read_word(p) (*(const uint16_t*) (p))
+#define pgm_read_dword(p) (*(const uint32_t*) (p))
+#define pgm_read_float(p) (*(const float*) (p))
+#define pgm_read_ptr(p) (*(void* const*) (p))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(const unsigned long ms);
+void delayMicroseconds(const unsigned int us);
+void yield();
+
+// Simulated time for tests and the bus simulation: once enabled, millis() and micros() only move
+// on with hostClockAdvance() and delays, which return immediately.
+void hostClockManual(const bool manual);
+void hostClockAdvance(const uint64_t us);
+uint64_t hostClockMicros();
+
+// the host has no SNTP client, time is never synchronized
+bool getLocalTime(struct tm *info, const uint32_t ms = 5000);
+
+// newlib has it, glibc only from 2.38
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+long random(const long max);
+long random(const long min, const long max);
+
+void pinMode(const uint8_t pin, const uint8_t mode);
+void digitalWrite(const uint8_t pin, const uint8_t val);
+int digitalRead(const uint8_t pin);
+
+class HardwareSerial: public Print {
+public:
+    void begin(const unsigned long baud) { (void) baud; }
+    size_t write(const uint8_t c) override;
+    size_t write(const uint8_t *buf, const size_t len) override;
+    using Print::write;
+    int availableForWrite() { return 4096; }
+    bool isConnected() { return true; }
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
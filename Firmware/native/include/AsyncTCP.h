@@ -0,0 +1,82 @@
+#pragma once
+
+// Host shim of AsyncTCP: no sockets, tests act as the remote end with the host functions.
+// Callbacks run in the caller's thread, which stands in for the AsyncTCP task.
+
+#include <Arduino.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+class AsyncClient;
+
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void*, AsyncClient*, int8_t error)> AcErrorHandler;
+typedef std::function<void(void*, AsyncClient*, void *data, size_t len)> AcDataHandler;
+
+class AsyncClient {
+public:
+    static const size_t SND_BUF = 5744; // bytes in flight, like the lwIP default
+    AsyncClient() {}
+    bool connect(const char *host, uint16_t port);
+    void close(bool now = false);
+    bool connected() const { return isConnected; }
+    size_t space() const { return isConnected ? SND_BUF - inFlight : 0; }
+    size_t add(const char *data, size_t size, uint8_t apiflags = 0);
+    bool send();
+    size_t write(const char *data, size_t size);
+    size_t write(const char *data) { return write(data, strlen(data)); }
+    void onConnect(AcConnectHandler cb, void *arg = nullptr) { connectCb = cb; connectArg = arg; }
+    void onDisconnect(AcConnectHandler cb, void *arg = nullptr) { disconnectCb = cb; disconnectArg = arg; }
+    void onAck(AcAckHandler cb, void *arg = nullptr) { ackCb = cb; ackArg = arg; }
+    void onError(AcErrorHandler cb, void *arg = nullptr) { errorCb = cb; errorArg = arg; }
+    void onData(AcDataHandler cb, void *arg = nullptr) { dataCb = cb; dataArg = arg; }
+
+    // host side, the remote end
+    /** decides whether connect() succeeds, the remote end may keep the client to answer */
+    static std::function<bool(AsyncClient *client, const char *host, uint16_t port)> hostConnectHandler;
+    /** called with data sent by the client */
+    std::function<void(AsyncClient *client, const char *data, size_t len)> hostSendHandler;
+    void hostAccepted() { isConnected = true; }
+    void hostReceive(const char *data, size_t len);
+    /** acknowledges len bytes in flight, 0 acknowledges everything */
+    void hostAck(size_t len = 0);
+    void hostDisconnect();
+    size_t hostInFlight() const { return inFlight; }
+    std::string sent; // data sent so far, tests may clear it
+private:
+    bool isConnected {false};
+    size_t inFlight {0};
+    std::string queued; // added, not sent yet
+    AcConnectHandler connectCb;
+    void *connectArg {nullptr};
+    AcConnectHandler disconnectCb;
+    void *disconnectArg {nullptr};
+    AcAckHandler ackCb;
+    void *ackArg {nullptr};
+    AcErrorHandler errorCb;
+    void *errorArg {nullptr};
+    AcDataHandler dataCb;
+    void *dataArg {nullptr};
+};
+
+class AsyncServer {
+public:
+    AsyncServer(uint16_t port);
+    ~AsyncServer();
+    void onClient(AcConnectHandler cb, void *arg) { clientCb = cb; clientArg = arg; }
+    void begin() { listening = true; }
+    void end() { listening = false; }
+    // host side
+    /** a remote end connected, the server takes the client like AsyncTCP does */
+    void hostAccept(AsyncClient *client);
+    /** server listening or to listen on port, nullptr if none */
+    static AsyncServer *hostFind(const uint16_t port);
+private:
+    static std::vector<AsyncServer*>& servers(); // servers are globals of other translation units
+    uint16_t port;
+    bool listening {false};
+    AcConnectHandler clientCb;
+    void *clientArg {nullptr};
+};
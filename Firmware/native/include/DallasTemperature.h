@@ -0,0 +1,26 @@
+#pragma once
+
+// Host shim of DallasTemperature, no devices answer
+
+#include <OneWire.h>
+
+#define DEVICE_DISCONNECTED_C -127
+#define DS18S20MODEL 0x10
+#define DS18B20MODEL 0x28
+
+typedef uint8_t DeviceAddress[8];
+typedef uint8_t ScratchPad[9];
+
+class DallasTemperature {
+public:
+    DallasTemperature(OneWire *bus) { (void) bus; }
+    void setWaitForConversion(bool wait) { (void) wait; }
+    void setCheckForConversion(bool check) { (void) check; }
+    uint8_t getResolution(const uint8_t *adr) { (void) adr; return 12; }
+    bool setResolution(const uint8_t *adr, uint8_t res, bool skipGlobal = false) {
+        (void) adr; (void) res; (void) skipGlobal;
+        return true;
+    }
+    void requestTemperatures() {}
+    bool readScratchPad(const uint8_t *adr, uint8_t *sp) { (void) adr; (void) sp; return false; }
+};
@@ -0,0 +1,4 @@
+#pragma once
+
+// the web server isn't built on the host, only headers of modules using it need to compile
+#include <AsyncTCP.h>
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <WString.h>
+
+class MDNSResponder {
+public:
+    bool begin(const char *hostname) { (void) hostname; return true; }
+    bool begin(const String &hostname) { return begin(hostname.c_str()); }
+    void end() {}
+};
+
+extern MDNSResponder MDNS;
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+#include <memory>
+
+namespace fs {
+
+// Host shim of the Arduino file API on top of stdio
+class File: public Stream {
+public:
+    File() {}
+    File(FILE *f, const String &path);
+    size_t write(const uint8_t c) override;
+    size_t write(const uint8_t *buf, const size_t len) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buf, const size_t len);
+    size_t size() const;
+    bool seek(const uint32_t pos);
+    size_t position() const;
+    const char* path() const { return filePath.c_str(); }
+    void close();
+    operator bool() const { return f != nullptr; }
+private:
+    std::shared_ptr<FILE> f;
+    String filePath;
+};
+
+class FS {
+public:
+    FS(const String &root) : root(root) {}
+    File open(const String &path, const char *mode = "r");
+    bool exists(const String &path);
+    bool remove(const String &path);
+    bool rename(const String &from, const String &to);
+    void hostSetRoot(const String &dir) { root = dir; } // host directory holding the files
+protected:
+    String hostPath(const String &path) const;
+    String root;
+};
+
+}
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "FS.h"
+
+class LittleFSFS: public fs::FS {
+public:
+    LittleFSFS();
+    bool begin(const bool formatOnFail = false);
+    bool format();
+    void end() {}
+    size_t totalBytes() const { return 1441792; }
+    size_t usedBytes();
+};
+
+extern LittleFSFS LittleFS;
@@ -0,0 +1,80 @@
+#pragma once
+
+// Host shim of the NimBLE scanner, tests inject advertisements with NimBLEScan::hostAdvertise()
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+class NimBLEAddress {
+public:
+    NimBLEAddress() {}
+    NimBLEAddress(const uint8_t *adr) { memcpy(val, adr, sizeof(val)); }
+    const uint8_t *getVal() const { return val; }
+private:
+    uint8_t val[6] {};
+};
+
+class NimBLEAdvertisedDevice {
+public:
+    NimBLEAdvertisedDevice(const uint8_t *adr, const std::vector<uint8_t> &payload, const int rssi = -60):
+        address(adr), payload(payload), rssi(rssi) {}
+    const std::vector<uint8_t> &getPayload() const { return payload; }
+    const NimBLEAddress &getAddress() const { return address; }
+    int getRSSI() const { return rssi; }
+private:
+    NimBLEAddress address;
+    std::vector<uint8_t> payload;
+    int rssi;
+};
+
+class NimBLEScan;
+
+class NimBLEScanCallbacks {
+public:
+    virtual ~NimBLEScanCallbacks() {}
+    virtual void onResult(const NimBLEAdvertisedDevice *dev) { (void) dev; }
+    virtual void onScanEnd(const NimBLEScan *scan, int reason) { (void) scan; (void) reason; }
+};
+
+class NimBLEScan {
+public:
+    void setScanCallbacks(NimBLEScanCallbacks *cb, bool wantDuplicates = false) { callbacks = cb; (void) wantDuplicates; }
+    void setActiveScan(bool active) { (void) active; }
+    void setMaxResults(uint8_t max) { (void) max; }
+    void setInterval(uint16_t ms) { (void) ms; }
+    void setWindow(uint16_t ms) { (void) ms; }
+    bool isScanning() const { return scanning; }
+    bool start(uint32_t duration, bool isContinue = false, bool restart = true) {
+        (void) duration; (void) isContinue; (void) restart;
+        scanning = true;
+        return true;
+    }
+    bool stop() { scanning = false; return true; }
+    // host side
+    void hostAdvertise(const NimBLEAdvertisedDevice &dev) {
+        if (scanning && callbacks)
+            callbacks->onResult(&dev);
+    }
+private:
+    NimBLEScanCallbacks *callbacks {nullptr};
+    bool scanning {false};
+};
+
+class NimBLECharacteristic {
+public:
+    void setValue(const uint8_t *data, size_t len) { (void) data; (void) len; }
+    void notify() {}
+};
+
+class NimBLEDevice {
+public:
+    static bool init(const std::string &name) { (void) name; return true; }
+    static bool setPower(int dbm) { (void) dbm; return true; }
+    static NimBLEScan *getScan() {
+        static NimBLEScan scan;
+        return &scan;
+    }
+};
+
+using BLEDevice = NimBLEDevice;
@@ -0,0 +1,26 @@
+#pragma once
+
+// Host shim of OneWire: an empty bus, only the CRC is real
+
+#include <Arduino.h>
+
+class OneWire {
+public:
+    OneWire(uint8_t pin) { (void) pin; }
+    void reset_search() {}
+    bool search(uint8_t *newAddr, bool searchMode = true) { (void) newAddr; (void) searchMode; return false; }
+    static uint8_t crc8(const uint8_t *addr, uint8_t len) {
+        uint8_t crc = 0;
+        while (len--) {
+            uint8_t inbyte = *addr++;
+            for (uint8_t i = 8; i; i--) {
+                const uint8_t mix = (crc ^ inbyte) & 0x01;
+                crc >>= 1;
+                if (mix)
+                    crc ^= 0x8C;
+                inbyte >>= 1;
+            }
+        }
+        return crc;
+    }
+};
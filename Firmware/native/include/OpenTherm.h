@@ -0,0 +1,219 @@
+#pragma once
+
+// Host shim of the OpenTherm library: same API and state machine, but frames are exchanged
+// as a whole with a peer (virtual boiler, room unit or test) instead of bit by bit on a pin.
+// Enums are unscoped like in the library.
+
+#include <Arduino.h>
+#include <deque>
+
+enum OpenThermResponseStatus: uint8_t {
+    NONE,
+    SUCCESS,
+    INVALID,
+    TIMEOUT
+};
+
+enum OpenThermMessageType: uint8_t {
+    READ_DATA = 0,
+    WRITE_DATA = 1,
+    INVALID_DATA = 2,
+    RESERVED = 3,
+    READ_ACK = 4,
+    WRITE_ACK = 5,
+    DATA_INVALID = 6,
+    UNKNOWN_DATA_ID = 7
+};
+
+enum OpenThermMessageID: uint8_t {
+    Status = 0,
+    TSet = 1,
+    MConfigMMemberIDcode = 2,
+    SConfigSMemberIDcode = 3,
+    RemoteRequest = 4,
+    ASFflags = 5,
+    RBPflags = 6,
+    CoolingControl = 7,
+    TsetCH2 = 8,
+    TrOverride = 9,
+    TSP = 10,
+    TSPindexTSPvalue = 11,
+    FHBsize = 12,
+    FHBindexFHBvalue = 13,
+    MaxRelModLevelSetting = 14,
+    MaxCapacityMinModLevel = 15,
+    TrSet = 16,
+    RelModLevel = 17,
+    CHPressure = 18,
+    DHWFlowRate = 19,
+    DayTime = 20,
+    Date = 21,
+    Year = 22,
+    TrSetCH2 = 23,
+    Tr = 24,
+    Tboiler = 25,
+    Tdhw = 26,
+    Toutside = 27,
+    Tret = 28,
+    Tstorage = 29,
+    Tcollector = 30,
+    TflowCH2 = 31,
+    Tdhw2 = 32,
+    Texhaust = 33,
+    TboilerHeatExchanger = 34,
+    BoilerFanSpeedSetpointAndActual = 35,
+    FlameCurrent = 36,
+    TrCH2 = 37,
+    RelativeHumidity = 38,
+    TrOverride2 = 39,
+    TdhwSetUBTdhwSetLB = 48,
+    MaxTSetUBMaxTSetLB = 49,
+    HcratioUBHcratioLB = 50,
+    TdhwSet = 56,
+    MaxTSet = 57,
+    Hcratio = 58,
+    StatusVentilationHeatRecovery = 70,
+    Vset = 71,
+    ASFflagsOEMfaultCodeVentilationHeatRecovery = 72,
+    OEMDiagnosticCodeVentilationHeatRecovery = 73,
+    SConfigSMemberIDcodeVentilationHeatRecovery = 74,
+    OpenThermVersionVentilationHeatRecovery = 75,
+    VentilationHeatRecoveryVersion = 76,
+    RelVentLevel = 77,
+    RHexhaust = 78,
+    CO2exhaust = 79,
+    Tsi = 80,
+    Tso = 81,
+    Tei = 82,
+    Teo = 83,
+    RPMexhaust = 84,
+    RPMsupply = 85,
+    RBPflagsVentilationHeatRecovery = 86,
+    NominalVentilationValue = 87,
+    TSPventilationHeatRecovery = 88,
+    TSPindexTSPvalueVentilationHeatRecovery = 89,
+    FHBsizeVentilationHeatRecovery = 90,
+    FHBindexFHBvalueVentilationHeatRecovery = 91,
+    Brand = 93,
+    BrandVersion = 94,
+    BrandSerialNumber = 95,
+    CoolingOperationHours = 96,
+    PowerCycles = 97,
+    RFsensorStatusInformation = 98,
+    RemoteOverrideOperatingModeHeatingDHW = 99,
+    RemoteOverrideFunction = 100,
+    StatusSolarStorage = 101,
+    ASFflagsOEMfaultCodeSolarStorage = 102,
+    SConfigSMemberIDcodeSolarStorage = 103,
+    SolarStorageVersion = 104,
+    TSPSolarStorage = 105,
+    TSPindexTSPvalueSolarStorage = 106,
+    FHBsizeSolarStorage = 107,
+    FHBindexFHBvalueSolarStorage = 108,
+    ElectricityProducerStarts = 109,
+    ElectricityProducerHours = 110,
+    ElectricityProduction = 111,
+    CumulativElectricityProduction = 112,
+    UnsuccessfulBurnerStarts = 113,
+    FlameSignalTooLowNumber = 114,
+    OEMDiagnosticCode = 115,
+    SuccessfulBurnerStarts = 116,
+    CHPumpStarts = 117,
+    DHWPumpValveStarts = 118,
+    DHWBurnerStarts = 119,
+    BurnerOperationHours = 120,
+    CHPumpOperationHours = 121,
+    DHWPumpValveOperationHours = 122,
+    DHWBurnerOperationHours = 123,
+    OpenThermVersionMaster = 124,
+    OpenThermVersionSlave = 125,
+    MasterVersion = 126,
+    SlaveVersion = 127
+};
+
+enum OpenThermStatus: uint8_t {
+    NOT_INITIALIZED,
+    READY,
+    DELAY,
+    REQUEST_SENDING,
+    RESPONSE_WAITING,
+    RESPONSE_START_BIT,
+    RESPONSE_RECEIVING,
+    RESPONSE_READY,
+    RESPONSE_INVALID
+};
+
+enum OpenThermSmartPower: uint8_t {
+    SMART_POWER_LOW,
+    SMART_POWER_MEDIUM,
+    SMART_POWER_HIGH
+};
+
+class OpenTherm;
+
+/**
+ * Far end of a link: virtual boiler, room unit or test
+ */
+class OpenThermPeer {
+public:
+    virtual ~OpenThermPeer() {}
+    /** the HAL has sent a frame, it ended at micros() */
+    virtual void onFrame(OpenTherm &hal, const unsigned long frame) = 0;
+    /** called by process(), a room unit starts its requests from here */
+    virtual void poll(OpenTherm &hal) { (void) hal; }
+};
+
+class OpenTherm {
+public:
+    static const uint32_t FRAME_TIME = 34000; // us, start bit, 32 bits, stop bit at 1 kbit/s
+    OpenTherm(int inPin = 4, int outPin = 5, bool isSlave = false);
+    volatile OpenThermStatus status;
+    void begin(void (*handleInterruptCallback)(void), void (*processResponseCallback)(unsigned long, OpenThermResponseStatus));
+    bool isReady();
+    bool sendRequestAsync(unsigned long request);
+    bool sendResponse(unsigned long request);
+    unsigned long getLastResponse();
+    OpenThermResponseStatus getLastResponseStatus();
+    OpenThermSmartPower getSmartPowerState() const { return OpenThermSmartPower::SMART_POWER_LOW; }
+    void setAlwaysReceive(const bool on) { alwaysReceive = on; }
+    void handleInterrupt() {}
+    void process();
+    void end();
+
+    static bool parity(unsigned long frame);
+    static OpenThermMessageType getMessageType(unsigned long message);
+    static OpenThermMessageID getDataID(unsigned long frame);
+    static bool isValidRequest(unsigned long request);
+    static bool isValidResponse(unsigned long response);
+    static unsigned long buildRequest(OpenThermMessageType type, OpenThermMessageID id, unsigned int data);
+    static unsigned long buildResponse(OpenThermMessageType type, OpenThermMessageID id, unsigned int data);
+    static unsigned long buildSetBoilerStatusRequest(bool enableCentralHeating, bool enableHotWater = false,
+        bool enableCooling = false, bool enableOutsideTemperatureCompensation = false,
+        bool enableCentralHeating2 = false, bool summerMode = false, bool dhwBlocking = false);
+    static uint16_t getUInt(const unsigned long response);
+    static float getFloat(const unsigned long response);
+    static unsigned int temperatureToData(float temperature);
+
+    // host side of the link
+    void setPeer(OpenThermPeer *p) { peer = p; }
+    /** a frame from the peer, starting at micros() start, is received once it ended */
+    void hostReceive(const unsigned long frame, const unsigned long start);
+    bool isSlave() const { return slave; }
+    /** last constructed interface of the role, e.g. the gateway's boiler side */
+    static OpenTherm *hostFind(const bool slave);
+private:
+    static OpenTherm *instances[2];
+    struct RxFrame {
+        unsigned long frame;
+        unsigned long end; // us
+    };
+    const bool slave;
+    bool alwaysReceive {false};
+    unsigned long response {0};
+    OpenThermResponseStatus responseStatus {OpenThermResponseStatus::NONE};
+    unsigned long responseTimestamp {0}; // us
+    void (*processResponseCallback)(unsigned long, OpenThermResponseStatus) {nullptr};
+    OpenThermPeer *peer {nullptr};
+    std::deque<RxFrame> rx; // frames on the line, ordered by end
+    void receive();
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host shim of the NVS key value store, kept in memory for the lifetime of the process
+class Preferences {
+public:
+    bool begin(const char *name, const bool readOnly = false);
+    void end();
+    bool clear();
+    bool remove(const char *key);
+    bool isKey(const char *key);
+    size_t putBytes(const char *key, const void *value, const size_t len);
+    size_t getBytesLength(const char *key);
+    size_t getBytes(const char *key, void *buf, const size_t maxLen);
+    size_t putUInt(const char *key, const uint32_t value);
+    uint32_t getUInt(const char *key, const uint32_t defaultValue = 0);
+    static void hostErase(); // erases all namespaces like a flash erase
+private:
+    String ns;
+    bool open {false};
+    bool readOnly {true};
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(const uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t len);
+    size_t write(const char *str) { return write((const uint8_t*) str, strlen(str)); }
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write((const uint8_t*) str.c_str(), str.length()); }
+    size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char*>(str)); }
+    size_t print(const char c) { return write((uint8_t) c); }
+    size_t print(const long n);
+    size_t print(const unsigned long n);
+    size_t print(const int n) { return print((long) n); }
+    size_t print(const unsigned int n) { return print((unsigned long) n); }
+    size_t print(const double d, const int digits = 2);
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(const T &val) { return print(val) + println(); }
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Print.h"
+
+class Stream: public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    size_t readBytes(char *buf, const size_t len) {
+        size_t n = 0;
+        for (int c; (n < len) && ((c = read()) >= 0); n++)
+            buf[n] = c;
+        return n;
+    }
+    size_t readBytes(uint8_t *buf, const size_t len) { return readBytes((char*) buf, len); }
+};
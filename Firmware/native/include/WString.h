@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <string>
+
+class __FlashStringHelper;
+
+// Arduino String on top of std::string, the commonly used subset
+class String {
+private:
+    std::string str;
+public:
+    String(const char *s = "") : str((s != nullptr) ? s : "") {}
+    String(const __FlashStringHelper *s) : String(reinterpret_cast<const char*>(s)) {}
+    String(const std::string &s) : str(s) {}
+    explicit String(const char c) : str(1, c) {}
+    String(const char *s, const unsigned int len) : str(s, len) {}
+    String(const int n, const unsigned char base = 10) : String((long) n, base) {}
+    String(const unsigned int n, const unsigned char base = 10) : String((unsigned long) n, base) {}
+    String(const long n, const unsigned char base = 10);
+    String(const unsigned long n, const unsigned char base = 10);
+    String(const double d, const unsigned int decimals = 2);
+
+    const char* c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.length(); }
+    bool isEmpty() const { return str.empty(); }
+    void clear() { str.clear(); }
+    bool reserve(const unsigned int size) { str.reserve(size); return true; }
+
+    bool concat(const char *s, const unsigned int len) { str.append(s, len); return true; }
+    bool concat(const char *s) { str.append(s); return true; }
+    bool concat(const String &s) { str.append(s.str); return true; }
+    bool concat(const char c) { str.push_back(c); return true; }
+    bool concat(const __FlashStringHelper *s) { return concat(reinterpret_cast<const char*>(s)); }
+    bool concat(const int n) { str.append(std::to_string(n)); return true; }
+    bool concat(const unsigned int n) { str.append(std::to_string(n)); return true; }
+    bool concat(const long n) { str.append(std::to_string(n)); return true; }
+    bool concat(const unsigned long n) { str.append(std::to_string(n)); return true; }
+    bool concat(const double d) { concat(String(d)); return true; }
+    template<typename T> String& operator+=(const T &val) { concat(val); return *this; }
+    template<typename T> friend String operator+(String lhs, const T &rhs) { lhs.concat(rhs); return lhs; }
+    friend String operator+(const char *lhs, const String &rhs) { String s(lhs); s += rhs; return s; }
+
+    bool equals(const String &s) const { return str == s.str; }
+    bool equalsIgnoreCase(const String &s) const { return strcasecmp(c_str(), s.c_str()) == 0; }
+    bool operator==(const String &s) const { return str == s.str; }
+    bool operator==(const char *s) const { return str == s; }
+    bool operator!=(const String &s) const { return str != s.str; }
+    bool operator!=(const char *s) const { return str != s; }
+    bool operator<(const String &s) const { return str < s.str; }
+
+    char charAt(const unsigned int idx) const { return (idx < str.length()) ? str[idx] : 0; }
+    char operator[](const unsigned int idx) const { return charAt(idx); }
+    int indexOf(const char c, const unsigned int from = 0) const;
+    int indexOf(const char *s, const unsigned int from = 0) const;
+    int lastIndexOf(const char c) const;
+    String substring(const unsigned int from) const;
+    String substring(const unsigned int from, const unsigned int to) const;
+    void remove(const unsigned int idx) { if (idx < str.length()) str.erase(idx); }
+    void remove(const unsigned int idx, const unsigned int count) { if (idx < str.length()) str.erase(idx, count); }
+    void replace(const String &find, const String &repl);
+    bool startsWith(const String &s) const { return str.compare(0, s.str.length(), s.str) == 0; }
+    bool endsWith(const String &s) const;
+    void trim();
+    void toLowerCase();
+    void toUpperCase();
+    long toInt() const { return atol(c_str()); }
+    float toFloat() const { return atof(c_str()); }
+    double toDouble() const { return atof(c_str()); }
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Host shim of the WiFi station, the link state is set by tests
+class WiFiClass {
+public:
+    String macAddress() const { return "24:0A:C4:A1:B2:C3"; }
+    bool isConnected() const { return linkUp; }
+    bool setHostname(const char *name) { hostname = name; return true; }
+    const char* getHostname() const { return hostname.c_str(); }
+    bool linkUp {true};
+private:
+    String hostname;
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,8 @@
+#pragma once
+
+// all memory of a host process is lost on exit, like a power cycle of the ESP32
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+// host stand-in, TLS connections aren't made on the host
+
+#include <mqtt_client.h>
+
+esp_err_t esp_crt_bundle_attach(void *conf);
@@ -0,0 +1,137 @@
+#pragma once
+
+// Host stand-in of the esp-mqtt client: records what the firmware publishes and subscribes,
+// tests play the broker and raise the client task's events with the hostMqtt functions.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef int esp_err_t;
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base, int32_t id, void *data);
+
+typedef enum {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED
+} esp_mqtt_event_id_t;
+
+typedef enum {
+    MQTT_ERROR_TYPE_NONE = 0,
+    MQTT_ERROR_TYPE_TCP_TRANSPORT,
+    MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+    MQTT_ERROR_TYPE_SUBSCRIBE_FAILED
+} esp_mqtt_error_type_t;
+
+typedef enum {
+    MQTT_TRANSPORT_UNKNOWN = 0,
+    MQTT_TRANSPORT_OVER_TCP,
+    MQTT_TRANSPORT_OVER_SSL
+} esp_mqtt_transport_t;
+
+typedef struct {
+    esp_err_t esp_tls_last_esp_err;
+    esp_mqtt_error_type_t error_type;
+    int connect_return_code;
+} esp_mqtt_error_codes_t;
+
+struct HostMqttClient;
+typedef HostMqttClient *esp_mqtt_client_handle_t;
+
+typedef struct {
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char *topic;
+    int topic_len;
+    int msg_id;
+    esp_mqtt_error_codes_t *error_handle;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct {
+    struct {
+        struct {
+            const char *uri;
+            const char *hostname;
+            esp_mqtt_transport_t transport;
+            uint32_t port;
+        } address;
+        struct {
+            const char *certificate;
+            esp_err_t (*crt_bundle_attach)(void *conf);
+        } verification;
+    } broker;
+    struct {
+        const char *username;
+        struct {
+            const char *password;
+        } authentication;
+    } credentials;
+    struct {
+        struct {
+            const char *topic;
+            const char *msg;
+            int msg_len;
+            int qos;
+            int retain;
+        } last_will;
+        int keepalive;
+    } session;
+    struct {
+        int reconnect_timeout_ms;
+        int timeout_ms;
+    } network;
+    struct {
+        uint64_t limit;
+    } outbox;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+    esp_event_handler_t handler, void *arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+    int qos, int retain, bool store);
+int esp_mqtt_client_subscribe_single(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic);
+
+// host side
+struct HostMqttMsg {
+    std::string topic;
+    std::string payload;
+    bool retain;
+};
+
+struct HostMqttClient {
+    std::string host;
+    uint32_t port;
+    std::string willTopic;
+    std::string willMsg;
+    uint64_t outboxLimit;
+    esp_event_handler_t handler {nullptr};
+    void *handlerArg {nullptr};
+    bool started {false};
+    bool outboxFull {false}; // enqueue fails while set
+    std::vector<HostMqttMsg> published;
+    std::vector<std::string> subscriptions;
+};
+
+/** client created last, nullptr after it was destroyed */
+esp_mqtt_client_handle_t hostMqttClient();
+void hostMqttConnect(esp_mqtt_client_handle_t client);
+void hostMqttDisconnect(esp_mqtt_client_handle_t client);
+/** delivers a message to the client, split in chunks of chunkSize bytes like a small client buffer does */
+void hostMqttDeliver(esp_mqtt_client_handle_t client, const char *topic, const char *payload, const int chunkSize = 1024);
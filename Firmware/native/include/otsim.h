@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Simulation of OpenTherm links with a virtual boiler and a virtual room unit. The gateway
+ * modes run the firmware's OTControl on the OpenTherm HAL shim with the host clock in manual
+ * mode, a simulated hour runs in about a minute.
+ */
+namespace otsim {
+
+const uint32_t FRAME_TIME = 34000; // us, start bit, 32 bits, stop bit at 1 kbit/s
+const uint32_t SLAVE_TURNAROUND_MIN = 20000; // us, response starts 20..800 ms after request
+const uint32_t RESPONSE_TIMEOUT = 800000; // us
+const uint32_t MASTER_GAP = 100000; // us, min. idle time before next request
+const uint32_t ROOMUNIT_PERIOD = 1000000; // us, room units send one request per second
+
+enum MsgType: uint8_t {
+    READ_DATA = 0,
+    WRITE_DATA = 1,
+    INVALID_DATA = 2,
+    READ_ACK = 4,
+    WRITE_ACK = 5,
+    DATA_INVALID = 6,
+    UNKNOWN_DATA_ID = 7
+};
+
+enum MsgId: uint8_t {
+    ID_STATUS = 0,
+    ID_TSET = 1,
+    ID_MCONFIG = 2,
+    ID_SCONFIG = 3,
+    ID_ASF_FLAGS = 5,
+    ID_MAX_MOD = 14,
+    ID_TRSET = 16,
+    ID_REL_MOD = 17,
+    ID_CH_PRESSURE = 18,
+    ID_TR = 24,
+    ID_TBOILER = 25,
+    ID_TDHW = 26,
+    ID_TOUTSIDE = 27,
+    ID_TRET = 28,
+    ID_TDHWSET = 56,
+    ID_MAXTSET = 57,
+    ID_OT_VERSION_SLAVE = 125,
+    ID_SLAVE_VERSION = 127
+};
+
+uint32_t buildFrame(const MsgType type, const uint8_t id, const uint16_t data);
+bool parityOk(const uint32_t frame);
+inline MsgType frameType(const uint32_t frame) { return (MsgType) ((frame >> 28) & 7); }
+inline uint8_t frameId(const uint32_t frame) { return (frame >> 16) & 0xFF; }
+inline uint16_t frameData(const uint32_t frame) { return frame & 0xFFFF; }
+inline uint16_t f88(const double f) { return (int16_t) (f * 256); }
+inline double f88(const uint16_t d) { return (int16_t) d / 256.0; }
+
+/**
+ * Boiler with a first order flow temperature model. Behaviour can be changed at runtime
+ * by script commands (response delay, silence, parity errors, faults).
+ */
+class VirtualBoiler {
+public:
+    VirtualBoiler();
+    /** @return false if the boiler doesn't answer, else response frame and turnaround time */
+    bool respond(const uint32_t request, const uint64_t now, uint32_t &response, uint32_t &turnaround);
+    void update(const uint64_t now);
+    uint32_t turnaround; // us
+    uint64_t silentUntil;
+    double parityErrorRate;
+    uint8_t faultFlags;
+private:
+    uint64_t lastUpdate;
+    bool chEnable;
+    bool dhwEnable;
+    bool flame;
+    double tset;
+    double maxMod;
+    double flow;
+    double ret;
+    double dhw;
+    std::mt19937 rng;
+};
+
+/**
+ * Room unit polling a fixed cycle of IDs, one request per second
+ */
+class VirtualRoomUnit {
+public:
+    VirtualRoomUnit();
+    uint32_t nextRequest();
+    void onResponse(const uint32_t request, const bool ok, const uint32_t response);
+    bool chEnable;
+    double tset;
+    double roomTemp;
+    double roomSet;
+    uint32_t invalid; // responses with parity error, wrong ID or type
+    uint32_t notAcked; // DATA_INVALID or UNKNOWN_DATA_ID, e.g. before the gateway has read the ID
+private:
+    size_t idx;
+};
+
+/**
+ * Runs a link topology: bypass (room unit wired to boiler), repeater (gateway forwards every
+ * frame) or master (gateway polls the boiler and answers the room unit from its values).
+ * Bypass runs as discrete events, the gateway modes run OTControl::loop() with the boiler on
+ * its master interface and the room unit on its slave interface.
+ */
+class Simulator {
+public:
+    enum Mode {
+        MODE_BYPASS,
+        MODE_REPEATER,
+        MODE_MASTER
+    };
+    struct Result {
+        uint64_t simTime; // us
+        uint32_t boilerFrames; // requests on boiler link
+        uint32_t roomFrames; // requests on room unit link
+        uint32_t timeouts; // boiler link
+        uint32_t parityErrors; // boiler link
+        uint32_t roomTimeouts;
+        uint32_t roomInvalid;
+        uint32_t roomNotAcked;
+        double latencyAvg; // us, room unit request end to response start
+        uint32_t latencyMax; // us
+        std::map<uint8_t, uint32_t> idCount; // successful boiler transfers per ID
+    };
+    Simulator(const Mode mode);
+    bool loadScript(const char *filename);
+    Result run(const uint64_t duration);
+    static void printResult(const Mode mode, const Result &res);
+    static const char* modeName(const Mode mode);
+    VirtualBoiler boiler;
+    VirtualRoomUnit roomUnit;
+private:
+    struct BoilerLink;
+    struct RoomUnitLink;
+    struct ScriptCmd {
+        uint64_t time; // us
+        std::string cmd;
+        double arg;
+    };
+    std::vector<ScriptCmd> script;
+    size_t scriptIdx;
+    Mode mode;
+    uint64_t now; // us, simulated time of the gateway modes
+    uint32_t lastMicros;
+    double latencySum;
+    uint32_t latencyCount;
+    uint64_t clock();
+    void runScript(const uint64_t now);
+    void addLatency(Result &res, const uint64_t latency);
+    bool boilerTransfer(const uint32_t request, const uint64_t start, uint64_t &end, uint32_t &response, Result &res);
+    Result runBypass(const uint64_t duration);
+    Result runGateway(const uint64_t duration);
+};
+
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// same as the ROM function: reflected CRC-32, polynomial 0xEDB88320, caller passes and gets the inverted value
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
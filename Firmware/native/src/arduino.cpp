@@ -0,0 +1,225 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+
+static const auto timeStart = std::chrono::steady_clock::now();
+static uint8_t pinLevels[64];
+static std::atomic<bool> clockManual {false};
+static std::atomic<uint64_t> clockUs {0}; // simulated time
+
+uint64_t hostClockMicros() {
+    if (clockManual)
+        return clockUs;
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timeStart).count();
+}
+
+/**
+ * Switches between system and simulated time, simulated time continues from the current time
+ */
+void hostClockManual(const bool manual) {
+    clockUs = hostClockMicros();
+    clockManual = manual;
+}
+
+void hostClockAdvance(const uint64_t us) {
+    clockUs += us;
+}
+
+unsigned long millis() {
+    return hostClockMicros() / 1000;
+}
+
+unsigned long micros() {
+    return hostClockMicros();
+}
+
+void delay(const unsigned long ms) {
+    if (clockManual)
+        hostClockAdvance(ms * 1000);
+    else
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(const unsigned int us) {
+    if (clockManual)
+        hostClockAdvance(us);
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+bool getLocalTime(struct tm *info, const uint32_t ms) {
+    (void) info;
+    (void) ms;
+    return false;
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    const size_t len = strlen(src);
+    if (size > 0) {
+        const size_t n = std::min(len, size - 1);
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+#endif
+
+long random(const long max) {
+    return (max > 0) ? rand() % max : 0;
+}
+
+long random(const long min, const long max) {
+    return (max > min) ? min + random(max - min) : min;
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+void pinMode(const uint8_t pin, const uint8_t mode) {
+    (void) pin;
+    (void) mode;
+}
+
+void digitalWrite(const uint8_t pin, const uint8_t val) {
+    if (pin < sizeof(pinLevels))
+        pinLevels[pin] = val;
+}
+
+int digitalRead(const uint8_t pin) {
+    return (pin < sizeof(pinLevels)) ? pinLevels[pin] : LOW;
+}
+
+size_t HardwareSerial::write(const uint8_t c) {
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, const size_t len) {
+    return fwrite(buf, 1, len, stdout);
+}
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+    size_t n = 0;
+    while (len-- > 0)
+        n += write(*buf++);
+    return n;
+}
+
+size_t Print::print(const long n) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", n);
+    return write(buf);
+}
+
+size_t Print::print(const unsigned long n) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu", n);
+    return write(buf);
+}
+
+size_t Print::print(const double d, const int digits) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", digits, d);
+    return write(buf);
+}
+
+size_t Print::printf(const char *fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    const int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len <= 0)
+        return 0;
+    return write((const uint8_t*) buf, std::min((size_t) len, sizeof(buf) - 1));
+}
+
+String::String(const double d, const unsigned int decimals) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, d);
+    str = buf;
+}
+
+int String::indexOf(const char c, const unsigned int from) const {
+    const size_t pos = str.find(c, from);
+    return (pos == std::string::npos) ? -1 : pos;
+}
+
+int String::indexOf(const char *s, const unsigned int from) const {
+    const size_t pos = str.find(s, from);
+    return (pos == std::string::npos) ? -1 : pos;
+}
+
+int String::lastIndexOf(const char c) const {
+    const size_t pos = str.rfind(c);
+    return (pos == std::string::npos) ? -1 : pos;
+}
+
+String String::substring(const unsigned int from) const {
+    return substring(from, str.length());
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to)
+        std::swap(from, to);
+    if (from >= str.length())
+        return String();
+    return String(str.substr(from, std::min<size_t>(to, str.length()) - from));
+}
+
+bool String::endsWith(const String &s) const {
+    return (str.length() >= s.str.length()) &&
+        (str.compare(str.length() - s.str.length(), s.str.length(), s.str) == 0);
+}
+
+String::String(const long n, const unsigned char base) {
+    if ((base == 10) && (n < 0)) {
+        str = "-";
+        str += String((unsigned long) -n, base).str;
+    }
+    else
+        str = String((unsigned long) n, base).str;
+}
+
+String::String(unsigned long n, const unsigned char base) {
+    char buf[8 * sizeof(n) + 1];
+    char *p = buf + sizeof(buf) - 1;
+    *p = 0;
+    do {
+        const unsigned d = n % base;
+        *--p = (d < 10) ? '0' + d : 'A' + d - 10;
+        n /= base;
+    } while (n > 0);
+    str = p;
+}
+
+void String::trim() {
+    const size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        str.clear();
+        return;
+    }
+    str = str.substr(first, str.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+void String::replace(const String &find, const String &repl) {
+    if (find.str.empty())
+        return;
+    for (size_t pos = str.find(find.str); pos != std::string::npos; pos = str.find(find.str, pos + repl.str.length()))
+        str.replace(pos, find.str.length(), repl.str);
+}
+
+void String::toLowerCase() {
+    for (auto &c: str)
+        c = tolower(c);
+}
+
+void String::toUpperCase() {
+    for (auto &c: str)
+        c = toupper(c);
+}
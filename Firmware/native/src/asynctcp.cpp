@@ -0,0 +1,105 @@
+#include <AsyncTCP.h>
+#include <algorithm>
+
+std::function<bool(AsyncClient *client, const char *host, uint16_t port)> AsyncClient::hostConnectHandler;
+
+bool AsyncClient::connect(const char *host, uint16_t port) {
+    if (isConnected)
+        return false;
+    if (!hostConnectHandler || !hostConnectHandler(this, host, port)) {
+        if (errorCb)
+            errorCb(errorArg, this, -14); // ERR_CONN
+        return false;
+    }
+    isConnected = true;
+    inFlight = 0;
+    queued.clear();
+    if (connectCb)
+        connectCb(connectArg, this);
+    return true;
+}
+
+// like AsyncTCP, the disconnect handler may delete the client, nothing is touched after it
+void AsyncClient::close(bool now) {
+    (void) now;
+    if (!isConnected)
+        return;
+    isConnected = false;
+    queued.clear();
+    inFlight = 0;
+    if (disconnectCb)
+        disconnectCb(disconnectArg, this);
+}
+
+size_t AsyncClient::add(const char *data, size_t size, uint8_t apiflags) {
+    (void) apiflags;
+    const size_t n = std::min(size, space() - std::min(space(), queued.size()));
+    queued.append(data, n);
+    return n;
+}
+
+bool AsyncClient::send() {
+    if (!isConnected || queued.empty())
+        return false;
+    std::string data;
+    data.swap(queued);
+    inFlight += data.size();
+    sent += data;
+    if (hostSendHandler)
+        hostSendHandler(this, data.data(), data.size());
+    return true;
+}
+
+size_t AsyncClient::write(const char *data, size_t size) {
+    const size_t n = add(data, size);
+    if (n > 0)
+        send();
+    return n;
+}
+
+void AsyncClient::hostReceive(const char *data, size_t len) {
+    if (isConnected && dataCb)
+        dataCb(dataArg, this, (void*) data, len);
+}
+
+void AsyncClient::hostAck(size_t len) {
+    if ((len == 0) || (len > inFlight))
+        len = inFlight;
+    inFlight -= len;
+    if (ackCb)
+        ackCb(ackArg, this, len, 0);
+}
+
+void AsyncClient::hostDisconnect() {
+    close(true);
+}
+
+std::vector<AsyncServer*>& AsyncServer::servers() {
+    static std::vector<AsyncServer*> list;
+    return list;
+}
+
+AsyncServer::AsyncServer(uint16_t port):
+        port(port) {
+    servers().push_back(this);
+}
+
+AsyncServer::~AsyncServer() {
+    auto &list = servers();
+    list.erase(std::find(list.begin(), list.end(), this));
+}
+
+AsyncServer *AsyncServer::hostFind(const uint16_t port) {
+    for (auto *s: servers())
+        if (s->port == port)
+            return s;
+    return nullptr;
+}
+
+void AsyncServer::hostAccept(AsyncClient *client) {
+    client->hostAccepted();
+    if (listening && clientCb)
+        clientCb(clientArg, client);
+    else
+        delete client;
+}
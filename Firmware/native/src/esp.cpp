@@ -0,0 +1,96 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <ESPmDNS.h>
+#include <Preferences.h>
+#include <rom/crc.h>
+#include <esp_random.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// ESP-IDF and ESP32 Arduino functions used by the firmware modules
+
+WiFiClass WiFi;
+MDNSResponder MDNS;
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len-- > 0) {
+        crc ^= *buf++;
+        for (int i=0; i<8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+uint32_t esp_random() {
+    static std::mt19937 rng(std::random_device{}());
+    return rng();
+}
+
+typedef std::map<std::string, std::vector<uint8_t>> NvsNamespace;
+static std::map<std::string, NvsNamespace> nvs;
+
+bool Preferences::begin(const char *name, const bool ro) {
+    ns = name;
+    readOnly = ro;
+    open = true;
+    return true;
+}
+
+void Preferences::end() {
+    open = false;
+}
+
+bool Preferences::clear() {
+    if (!open || readOnly)
+        return false;
+    nvs.erase(ns.c_str());
+    return true;
+}
+
+bool Preferences::remove(const char *key) {
+    if (!open || readOnly)
+        return false;
+    return nvs[ns.c_str()].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) {
+    return open && (nvs[ns.c_str()].count(key) > 0);
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, const size_t len) {
+    if (!open || readOnly)
+        return 0;
+    const uint8_t *p = (const uint8_t*) value;
+    nvs[ns.c_str()][key].assign(p, p + len);
+    return len;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!isKey(key))
+        return 0;
+    return nvs[ns.c_str()][key].size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, const size_t maxLen) {
+    const size_t len = getBytesLength(key);
+    if ((len == 0) || (len > maxLen))
+        return 0;
+    memcpy(buf, nvs[ns.c_str()][key].data(), len);
+    return len;
+}
+
+size_t Preferences::putUInt(const char *key, const uint32_t value) {
+    return putBytes(key, &value, sizeof(value));
+}
+
+uint32_t Preferences::getUInt(const char *key, const uint32_t defaultValue) {
+    uint32_t value;
+    return (getBytes(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+}
+
+void Preferences::hostErase() {
+    nvs.clear();
+}
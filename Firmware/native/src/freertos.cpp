@@ -0,0 +1,189 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include <Arduino.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+struct HostSemaphore {
+    std::mutex m;
+    std::condition_variable cv;
+    bool recursive {false};
+    bool taken {false};
+    std::thread::id owner;
+    uint32_t depth {0};
+};
+
+static SemaphoreHandle_t create(const bool recursive, const bool taken) {
+    SemaphoreHandle_t sem = new HostSemaphore();
+    sem->recursive = recursive;
+    sem->taken = taken;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return create(false, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return create(true, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return create(false, true); // created empty like in FreeRTOS
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    delete sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, const TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(sem->m);
+    if (sem->recursive && sem->taken && (sem->owner == std::this_thread::get_id())) {
+        sem->depth++;
+        return pdTRUE;
+    }
+
+    auto isFree = [sem] { return !sem->taken; };
+    if (ticks == portMAX_DELAY)
+        sem->cv.wait(lock, isFree);
+    else if (!sem->cv.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), isFree))
+        return pdFALSE;
+
+    sem->taken = true;
+    sem->owner = std::this_thread::get_id();
+    sem->depth = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    std::lock_guard<std::mutex> lock(sem->m);
+    if (!sem->taken)
+        return pdFALSE;
+
+    if (sem->recursive && (--sem->depth > 0))
+        return pdTRUE;
+
+    sem->taken = false;
+    sem->cv.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, const TickType_t ticks) {
+    return xSemaphoreTake(sem, ticks);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem) {
+    return xSemaphoreGive(sem);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, const uint32_t stackDepth, void *param,
+        const UBaseType_t prio, TaskHandle_t *handle) {
+    (void) name;
+    (void) stackDepth;
+    (void) prio;
+    std::thread(fn, param).detach();
+    if (handle != nullptr)
+        *handle = nullptr;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, const uint32_t stackDepth, void *param,
+        const UBaseType_t prio, TaskHandle_t *handle, const BaseType_t core) {
+    (void) core;
+    return xTaskCreate(fn, name, stackDepth, param, prio, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    (void) task; // host threads end when their function returns
+}
+
+// ticks follow the Arduino clock, so tasks waiting for the bus see simulated time as well
+void vTaskDelay(const TickType_t ticks) {
+    delay(ticks * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount() {
+    return millis() / portTICK_PERIOD_MS;
+}
+
+void portENTER_CRITICAL(portMUX_TYPE *mux) {
+    while (mux->locked.exchange(true, std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE *mux) {
+    mux->locked.store(false, std::memory_order_release);
+}
+
+// items are allocated separately, only the size accounting follows the FreeRTOS ring buffer
+struct HostRingbuf {
+    std::mutex m;
+    std::condition_variable cv;
+    size_t size;
+    size_t used {0};
+    std::deque<uint8_t*> items; // completed, oldest first
+};
+
+struct RingbufItem {
+    size_t len;
+    uint8_t data[];
+};
+
+static size_t itemSpace(const size_t len) {
+    return ((len + 3) & ~3) + 8; // aligned data and header
+}
+
+static RingbufItem *toItem(void *data) {
+    return (RingbufItem*) ((uint8_t*) data - offsetof(RingbufItem, data));
+}
+
+RingbufHandle_t xRingbufferCreate(size_t xBufferSize, RingbufferType_t xBufferType) {
+    (void) xBufferType;
+    RingbufHandle_t rb = new HostRingbuf();
+    rb->size = xBufferSize;
+    return rb;
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t xRingbuffer, void **ppvItem, size_t xItemSize, TickType_t xTicksToWait) {
+    (void) xTicksToWait; // callers only poll
+    std::lock_guard<std::mutex> lock(xRingbuffer->m);
+    if (xRingbuffer->used + itemSpace(xItemSize) > xRingbuffer->size)
+        return pdFALSE;
+    xRingbuffer->used += itemSpace(xItemSize);
+    RingbufItem *item = (RingbufItem*) malloc(sizeof(RingbufItem) + xItemSize);
+    item->len = xItemSize;
+    *ppvItem = item->data;
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t xRingbuffer, void *pvItem) {
+    std::lock_guard<std::mutex> lock(xRingbuffer->m);
+    xRingbuffer->items.push_back((uint8_t*) pvItem);
+    xRingbuffer->cv.notify_one();
+    return pdTRUE;
+}
+
+void *xRingbufferReceive(RingbufHandle_t xRingbuffer, size_t *pxItemSize, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xRingbuffer->m);
+    auto hasItem = [xRingbuffer] { return !xRingbuffer->items.empty(); };
+    if (xTicksToWait == portMAX_DELAY)
+        xRingbuffer->cv.wait(lock, hasItem);
+    else if (!xRingbuffer->cv.wait_for(lock, std::chrono::milliseconds(xTicksToWait * portTICK_PERIOD_MS), hasItem))
+        return nullptr;
+    uint8_t *data = xRingbuffer->items.front();
+    xRingbuffer->items.pop_front();
+    *pxItemSize = toItem(data)->len;
+    return data;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t xRingbuffer, void *pvItem) {
+    RingbufItem *item = toItem(pvItem);
+    {
+        std::lock_guard<std::mutex> lock(xRingbuffer->m);
+        xRingbuffer->used -= itemSpace(item->len);
+    }
+    free(item);
+}
@@ -0,0 +1,113 @@
+#include <LittleFS.h>
+#include <filesystem>
+#include <sys/stat.h>
+
+// files of the simulated flash file system live in a host directory
+
+LittleFSFS LittleFS;
+
+namespace fs {
+
+File::File(FILE *file, const String &path):
+        f(file, fclose),
+        filePath(path) {
+}
+
+size_t File::write(const uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buf, const size_t len) {
+    return f ? fwrite(buf, 1, len, f.get()) : 0;
+}
+
+int File::available() {
+    return f ? size() - position() : 0;
+}
+
+int File::read() {
+    return f ? fgetc(f.get()) : -1;
+}
+
+int File::peek() {
+    if (!f)
+        return -1;
+    const int c = fgetc(f.get());
+    if (c >= 0)
+        ungetc(c, f.get());
+    return c;
+}
+
+size_t File::read(uint8_t *buf, const size_t len) {
+    return f ? fread(buf, 1, len, f.get()) : 0;
+}
+
+size_t File::size() const {
+    struct stat st;
+    if (!f || (fstat(fileno(f.get()), &st) != 0))
+        return 0;
+    return st.st_size;
+}
+
+bool File::seek(const uint32_t pos) {
+    return f && (fseek(f.get(), pos, SEEK_SET) == 0);
+}
+
+size_t File::position() const {
+    return f ? ftell(f.get()) : 0;
+}
+
+void File::close() {
+    f.reset();
+}
+
+String FS::hostPath(const String &path) const {
+    return root + path;
+}
+
+File FS::open(const String &path, const char *mode) {
+    FILE *file = fopen(hostPath(path).c_str(), mode);
+    if (file == nullptr)
+        return File();
+    return File(file, path);
+}
+
+bool FS::exists(const String &path) {
+    return std::filesystem::exists(hostPath(path).c_str());
+}
+
+bool FS::remove(const String &path) {
+    return ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const String &from, const String &to) {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+}
+
+LittleFSFS::LittleFSFS():
+        FS((std::filesystem::temp_directory_path() / "otthing-littlefs").string()) {
+}
+
+bool LittleFSFS::begin(const bool formatOnFail) {
+    (void) formatOnFail;
+    std::error_code ec;
+    std::filesystem::create_directories(root.c_str(), ec);
+    return !ec;
+}
+
+bool LittleFSFS::format() {
+    std::error_code ec;
+    std::filesystem::remove_all(root.c_str(), ec);
+    return begin();
+}
+
+size_t LittleFSFS::usedBytes() {
+    size_t used = 0;
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::directory_iterator(root.c_str(), ec))
+        if (entry.is_regular_file())
+            used += entry.file_size();
+    return used;
+}
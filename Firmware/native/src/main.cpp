@@ -0,0 +1,254 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <chrono>
+#include "bthome.h"
+#include "sensorfilter.h"
+#include "util.h"
+#include "otsim.h"
+#include "HADiscovery.h"
+#include "sensors.h"
+#include "otcontrol.h"
+#include "mqtt.h"
+
+// unit tests bring their own main()
+#ifndef PIO_UNIT_TESTING
+
+// Host benchmarks of code running in hot paths on the device and OpenTherm bus simulation.
+// Usage: no arguments runs benchmarks and all simulation modes for one simulated hour,
+// "sim <bypass|repeater|master> [seconds] [script]" runs one mode
+
+static volatile double sink; // keeps results from being optimized away
+
+template<typename Fn>
+static void bench(const char *name, const uint32_t iterations, Fn fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i=0; i<iterations; i++)
+        fn(i);
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    Serial.printf("%-24s %10.1f ns/op\n", name, elapsed.count() / iterations);
+}
+
+static void benchBTHome() {
+    // flags, BTHome v2: packet id, battery 97 %, temperature 25.06 °C, humidity 50.55 %
+    static const uint8_t adv[] = {
+        0x02, 0x01, 0x06,
+        0x0E, 0x16, 0xD2, 0xFC, 0x40, 0x00, 0x01, 0x01, 0x61, 0x02, 0xCA, 0x09, 0x03, 0xBF, 0x13
+    };
+
+    bench("BTHome decode", 1000000, [](const uint32_t) {
+        const uint8_t *data;
+        size_t len;
+        BTHome::Reading reading;
+        if (BTHome::findServiceData(adv, sizeof(adv), data, len) && BTHome::decode(data, len, reading))
+            sink = reading.values[BTHome::FIELD_TEMP];
+    });
+}
+
+static void benchFilter(const char *name, const char *type) {
+    JsonDocument cfg;
+    cfg["type"] = type;
+    cfg["n"] = 7;
+
+    SensorFilter filter;
+    filter.setConfig(cfg.as<JsonObjectConst>());
+    bench(name, 1000000, [&filter](const uint32_t i) {
+        sink = filter.apply(20.0 + (i % 13) * 0.1, i * 1000);
+    });
+}
+
+// heap use of the benchmarks: counts every allocation while heapCounting is set,
+// operator new allocates through malloc so C++ objects are included
+static std::atomic<bool> heapCounting {false};
+static std::atomic<size_t> heapBytes {0};
+static std::atomic<size_t> heapAllocs {0};
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+static void countAlloc(const size_t size) {
+    if (heapCounting) {
+        heapBytes += size;
+        heapAllocs++;
+    }
+}
+
+void *malloc(size_t size) noexcept {
+    countAlloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+    countAlloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    countAlloc(size);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+// full discovery run of all producers (OpenTherm values, OneWire and BLE sensors) through
+// Mqtt's queue into the esp-mqtt stand-in, triggered by a HA birth message like on the device.
+// The stand-in copies each message like esp-mqtt's outbox does, so its allocations are included,
+// as are those of the status messages published during the run's simulated seconds.
+static void benchDiscovery() {
+    // the sensors registered by benchRegistry() publish discovery if they're on the allow list
+    JsonDocument allow;
+    for (uint8_t i=0; i<BLE_MAX_SENSORS; i++) {
+        char adr[13];
+        snprintf(adr, sizeof(adr), "a4c138%02x5e%02x", (uint8_t) (i * 37), i);
+        allow.add(adr);
+    }
+    BLESensor::setAllowList(allow.as<JsonArrayConst>());
+
+    hostClockManual(true);
+    mqtt.begin();
+    MqttConfig cfg {};
+    cfg.host = "broker.local";
+    cfg.port = 1883;
+    cfg.keepAlive = 30;
+    mqtt.setConfig(cfg);
+    delay(11000);
+    mqtt.loop();
+    esp_mqtt_client_handle_t cli = hostMqttClient();
+    if (cli == nullptr) {
+        Serial.println("MQTT client not started");
+        return;
+    }
+    hostMqttConnect(cli);
+
+    // a run is done when no discovery message was published for 5 s
+    auto run = [cli]() {
+        size_t msgs = 0;
+        size_t bytes = 0;
+        size_t checked = 0;
+        uint32_t lastMsg = millis();
+        cli->published.clear();
+        hostMqttDeliver(cli, "homeassistant/status", "online");
+        while ((millis() - lastMsg) < 5000) {
+            mqtt.loop();
+            for (; checked < cli->published.size(); checked++) {
+                if (cli->published[checked].retain) {
+                    msgs++;
+                    bytes += cli->published[checked].payload.size();
+                    lastMsg = millis();
+                }
+            }
+            delay(10);
+        }
+        return std::make_pair(msgs, bytes);
+    };
+    run(); // first run after connect, fills the hash list
+
+    const uint32_t iterations = 20;
+    std::pair<size_t, size_t> result;
+    heapBytes = 0;
+    heapAllocs = 0;
+    heapCounting = true;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i=0; i<iterations; i++)
+        result = run();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    heapCounting = false;
+
+    Serial.printf("%-24s %10.2f ms/run, %zu messages, %zu payload bytes\n", "HA discovery run",
+        elapsed.count() / iterations, result.first, result.second);
+    Serial.printf("%-24s %10zu bytes/run in %zu allocations\n", "", heapBytes / iterations, heapAllocs / iterations);
+
+    hostMqttDisconnect(cli);
+    mqtt.loop();
+}
+
+static void benchRegistry() {
+    // full registry of BLE sensors, each advertising temperature 25.06 °C
+    std::vector<NimBLEAdvertisedDevice> devs;
+    for (uint8_t i=0; i<BLE_MAX_SENSORS; i++) {
+        const uint8_t adr[6] = {0xA4, 0xC1, 0x38, (uint8_t) (i * 37), 0x5E, i};
+        devs.emplace_back(adr, std::vector<uint8_t> {0x09, 0x16, 0xD2, 0xFC, 0x40, 0x00, i, 0x02, 0xCA, 0x09});
+        BLESensor::onDiscovery(&devs.back());
+        if (BLESensor::find(adr) == nullptr) {
+            Serial.println("BLE sensor not registered");
+            return;
+        }
+    }
+
+    bench("BLE registry find", 1000000, [&devs](const uint32_t i) {
+        sink = BLESensor::find(devs[i % BLE_MAX_SENSORS].getAddress().getVal()) != nullptr;
+    });
+    bench("BLE advertisement", 1000000, [&devs](const uint32_t i) {
+        BLESensor::onDiscovery(&devs[i % BLE_MAX_SENSORS]);
+    });
+    bench("parse address", 1000000, [](const uint32_t i) {
+        uint8_t adr[6];
+        sink = AddressableSensor::parseAdr((i & 1) ? "A4C1385E0107" : "a4c1385e0107", adr, sizeof(adr));
+    });
+
+    // sensor reading the last of them
+    JsonDocument cfg;
+    cfg["source"] = (int) Sensor::SOURCE_BLE;
+    char adrStr[13];
+    const uint8_t *last = devs.back().getAddress().getVal();
+    snprintf(adrStr, sizeof(adrStr), "%02X%02X%02X%02X%02X%02X", last[0], last[1], last[2], last[3], last[4], last[5]);
+    cfg["adr"] = adrStr;
+    Sensor sensor;
+    JsonObject obj = cfg.as<JsonObject>();
+    sensor.setConfig(obj);
+    bench("sensor get (BLE)", 1000000, [&sensor](const uint32_t) {
+        double d;
+        if (sensor.get(d))
+            sink = d;
+    });
+}
+
+static void benchLock() {
+    SemaphoreHandle_t mtx = xSemaphoreCreateMutex();
+    bench("SemHelper lock/unlock", 1000000, [&mtx](const uint32_t i) {
+        SemHelper lock(mtx, 100);
+        if (lock)
+            sink = i;
+    });
+    vSemaphoreDelete(mtx);
+}
+
+static int simulate(const otsim::Simulator::Mode mode, const double seconds, const char *script) {
+    otsim::Simulator sim(mode);
+    if ((script != nullptr) && !sim.loadScript(script)) {
+        fprintf(stderr, "can't read script %s\n", script);
+        return 1;
+    }
+    otsim::Simulator::printResult(mode, sim.run(seconds * 1e6));
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    AddressableSensor::begin();
+    otcontrol.begin();
+
+    if ((argc >= 3) && (strcmp(argv[1], "sim") == 0)) {
+        for (auto mode: {otsim::Simulator::MODE_BYPASS, otsim::Simulator::MODE_REPEATER, otsim::Simulator::MODE_MASTER}) {
+            if (strcmp(argv[2], otsim::Simulator::modeName(mode)) == 0)
+                return simulate(mode, (argc >= 4) ? atof(argv[3]) : 3600, (argc >= 5) ? argv[4] : nullptr);
+        }
+        fprintf(stderr, "unknown mode %s\n", argv[2]);
+        return 1;
+    }
+
+    benchBTHome();
+    benchFilter("filter median(7)", "median");
+    benchFilter("filter ema", "ema");
+    benchFilter("filter rate", "rate");
+    benchLock();
+    benchRegistry();
+    benchDiscovery();
+
+    for (auto mode: {otsim::Simulator::MODE_BYPASS, otsim::Simulator::MODE_REPEATER, otsim::Simulator::MODE_MASTER})
+        simulate(mode, 3600, nullptr);
+    return 0;
+}
+#endif
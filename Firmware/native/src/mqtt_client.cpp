@@ -0,0 +1,100 @@
+#include <mqtt_client.h>
+#include <algorithm>
+#include <string.h>
+
+static const char MQTT_EVENTS[] = "MQTT_EVENTS";
+static esp_mqtt_client_handle_t lastClient = nullptr;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    esp_mqtt_client_handle_t cli = new HostMqttClient();
+    cli->host = config->broker.address.hostname ? config->broker.address.hostname : "";
+    cli->port = config->broker.address.port;
+    cli->willTopic = config->session.last_will.topic ? config->session.last_will.topic : "";
+    cli->willMsg = config->session.last_will.msg ? config->session.last_will.msg : "";
+    cli->outboxLimit = config->outbox.limit;
+    lastClient = cli;
+    return cli;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+        esp_event_handler_t handler, void *arg) {
+    (void) event;
+    client->handler = handler;
+    client->handlerArg = arg;
+    return 0;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    client->started = true;
+    return 0;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+    if (client == lastClient)
+        lastClient = nullptr;
+    delete client;
+    return 0;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+        int qos, int retain, bool store) {
+    (void) qos;
+    (void) store;
+    if (client->outboxFull)
+        return -1;
+    if (len == 0)
+        len = strlen(data);
+    client->published.push_back({topic, std::string(data, len), retain != 0});
+    return client->published.size();
+}
+
+int esp_mqtt_client_subscribe_single(esp_mqtt_client_handle_t client, const char *topic, int qos) {
+    (void) qos;
+    client->subscriptions.push_back(topic);
+    return client->subscriptions.size();
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic) {
+    auto &subs = client->subscriptions;
+    subs.erase(std::remove(subs.begin(), subs.end(), topic), subs.end());
+    return 1;
+}
+
+esp_mqtt_client_handle_t hostMqttClient() {
+    return lastClient;
+}
+
+static void raise(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, esp_mqtt_event_t &event) {
+    event.event_id = id;
+    event.client = client;
+    if (client->handler)
+        client->handler(client->handlerArg, MQTT_EVENTS, id, &event);
+}
+
+void hostMqttConnect(esp_mqtt_client_handle_t client) {
+    esp_mqtt_event_t event = {};
+    raise(client, MQTT_EVENT_CONNECTED, event);
+}
+
+void hostMqttDisconnect(esp_mqtt_client_handle_t client) {
+    esp_mqtt_event_t event = {};
+    raise(client, MQTT_EVENT_DISCONNECTED, event);
+}
+
+void hostMqttDeliver(esp_mqtt_client_handle_t client, const char *topic, const char *payload, const int chunkSize) {
+    const int total = strlen(payload);
+    int offset = 0;
+    do {
+        esp_mqtt_event_t event = {};
+        event.total_data_len = total;
+        event.current_data_offset = offset;
+        event.data = const_cast<char*>(payload) + offset;
+        event.data_len = std::min(chunkSize, total - offset);
+        if (offset == 0) {
+            event.topic = const_cast<char*>(topic);
+            event.topic_len = strlen(topic);
+        }
+        raise(client, MQTT_EVENT_DATA, event);
+        offset += event.data_len;
+    } while (offset < total);
+}
@@ -0,0 +1,192 @@
+#include <OpenTherm.h>
+
+OpenTherm *OpenTherm::instances[2] = {nullptr, nullptr};
+
+OpenTherm::OpenTherm(int inPin, int outPin, bool isSlave):
+        status(OpenThermStatus::NOT_INITIALIZED),
+        slave(isSlave) {
+    (void) inPin;
+    (void) outPin;
+    instances[isSlave] = this;
+}
+
+OpenTherm *OpenTherm::hostFind(const bool slave) {
+    return instances[slave];
+}
+
+void OpenTherm::begin(void (*handleInterruptCallback)(void), void (*processResponseCallback)(unsigned long, OpenThermResponseStatus)) {
+    (void) handleInterruptCallback;
+    this->processResponseCallback = processResponseCallback;
+    rx.clear();
+    status = OpenThermStatus::READY;
+}
+
+void OpenTherm::end() {
+    status = OpenThermStatus::NOT_INITIALIZED;
+}
+
+bool OpenTherm::isReady() {
+    return status == OpenThermStatus::READY;
+}
+
+bool OpenTherm::sendRequestAsync(unsigned long request) {
+    if (!isReady())
+        return false;
+
+    status = OpenThermStatus::REQUEST_SENDING;
+    response = 0;
+    responseStatus = OpenThermResponseStatus::NONE;
+    delayMicroseconds(FRAME_TIME);
+    responseTimestamp = micros();
+    status = OpenThermStatus::RESPONSE_WAITING;
+    if (peer)
+        peer->onFrame(*this, request);
+    return true;
+}
+
+bool OpenTherm::sendResponse(unsigned long request) {
+    status = OpenThermStatus::REQUEST_SENDING;
+    response = 0;
+    responseStatus = OpenThermResponseStatus::NONE;
+    delayMicroseconds(FRAME_TIME);
+    status = OpenThermStatus::READY;
+    if (peer)
+        peer->onFrame(*this, request);
+    return true;
+}
+
+unsigned long OpenTherm::getLastResponse() {
+    return response;
+}
+
+OpenThermResponseStatus OpenTherm::getLastResponseStatus() {
+    return responseStatus;
+}
+
+void OpenTherm::hostReceive(const unsigned long frame, const unsigned long start) {
+    RxFrame f {frame, start + FRAME_TIME};
+    auto it = rx.end();
+    while (it != rx.begin() && (long) ((it - 1)->end - f.end) > 0)
+        --it;
+    rx.insert(it, f);
+}
+
+// takes frames that have ended, like the pin interrupt would
+void OpenTherm::receive() {
+    while (!rx.empty() && (long) (micros() - rx.front().end) >= 0) {
+        const RxFrame f = rx.front();
+        rx.pop_front();
+        const OpenThermStatus st = status;
+        bool accept;
+        if (slave)
+            accept = st == OpenThermStatus::READY;
+        else
+            accept = st == OpenThermStatus::RESPONSE_WAITING ||
+                (alwaysReceive && st != OpenThermStatus::REQUEST_SENDING && st != OpenThermStatus::NOT_INITIALIZED);
+        if (accept) {
+            response = f.frame;
+            responseTimestamp = f.end;
+            status = OpenThermStatus::RESPONSE_READY;
+        }
+    }
+}
+
+void OpenTherm::process() {
+    if (peer)
+        peer->poll(*this);
+    receive();
+
+    const OpenThermStatus st = status;
+    const unsigned long ts = responseTimestamp;
+
+    if (st == OpenThermStatus::READY || st == OpenThermStatus::NOT_INITIALIZED)
+        return;
+    const unsigned long newTs = micros();
+    if (st != OpenThermStatus::DELAY && (newTs - ts) > 1000000) {
+        status = OpenThermStatus::READY;
+        responseStatus = OpenThermResponseStatus::TIMEOUT;
+        if (processResponseCallback)
+            processResponseCallback(response, responseStatus);
+    }
+    else if (st == OpenThermStatus::RESPONSE_READY) {
+        status = OpenThermStatus::DELAY;
+        responseStatus = (slave ? isValidRequest(response) : isValidResponse(response)) ?
+            OpenThermResponseStatus::SUCCESS : OpenThermResponseStatus::INVALID;
+        if (processResponseCallback)
+            processResponseCallback(response, responseStatus);
+    }
+    else if (st == OpenThermStatus::DELAY) {
+        if ((newTs - ts) > (slave ? 20000ul : 100000ul))
+            status = OpenThermStatus::READY;
+    }
+}
+
+bool OpenTherm::parity(unsigned long frame) {
+    uint8_t p = 0;
+    while (frame > 0) {
+        if (frame & 1)
+            p++;
+        frame = frame >> 1;
+    }
+    return (p & 1);
+}
+
+OpenThermMessageType OpenTherm::getMessageType(unsigned long message) {
+    return static_cast<OpenThermMessageType>((message >> 28) & 7);
+}
+
+OpenThermMessageID OpenTherm::getDataID(unsigned long frame) {
+    return static_cast<OpenThermMessageID>((frame >> 16) & 0xFF);
+}
+
+bool OpenTherm::isValidRequest(unsigned long request) {
+    if (parity(request))
+        return false;
+    const OpenThermMessageType mt = getMessageType(request);
+    return mt == OpenThermMessageType::READ_DATA || mt == OpenThermMessageType::WRITE_DATA;
+}
+
+bool OpenTherm::isValidResponse(unsigned long response) {
+    if (parity(response))
+        return false;
+    const OpenThermMessageType mt = getMessageType(response);
+    return mt == OpenThermMessageType::READ_ACK || mt == OpenThermMessageType::WRITE_ACK;
+}
+
+unsigned long OpenTherm::buildRequest(OpenThermMessageType type, OpenThermMessageID id, unsigned int data) {
+    unsigned long request = data & 0xFFFF;
+    request |= ((unsigned long) type & 7) << 28;
+    request |= ((unsigned long) id) << 16;
+    if (parity(request))
+        request |= (1ul << 31);
+    return request;
+}
+
+unsigned long OpenTherm::buildResponse(OpenThermMessageType type, OpenThermMessageID id, unsigned int data) {
+    return buildRequest(type, id, data);
+}
+
+unsigned long OpenTherm::buildSetBoilerStatusRequest(bool enableCentralHeating, bool enableHotWater,
+        bool enableCooling, bool enableOutsideTemperatureCompensation, bool enableCentralHeating2,
+        bool summerMode, bool dhwBlocking) {
+    unsigned int data = enableCentralHeating | (enableHotWater << 1) | (enableCooling << 2) |
+        (enableOutsideTemperatureCompensation << 3) | (enableCentralHeating2 << 4) |
+        (summerMode << 5) | (dhwBlocking << 6);
+    return buildRequest(OpenThermMessageType::READ_DATA, OpenThermMessageID::Status, data << 8);
+}
+
+uint16_t OpenTherm::getUInt(const unsigned long response) {
+    return response & 0xFFFF;
+}
+
+float OpenTherm::getFloat(const unsigned long response) {
+    return (int16_t) getUInt(response) / 256.0f;
+}
+
+unsigned int OpenTherm::temperatureToData(float temperature) {
+    if (temperature < 0)
+        temperature = 0;
+    if (temperature > 100)
+        temperature = 100;
+    return (unsigned int) (temperature * 256);
+}
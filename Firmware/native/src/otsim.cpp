@@ -0,0 +1,461 @@
+#include "otsim.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <OpenTherm.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "otcontrol.h"
+
+namespace otsim {
+
+const double FLOW_TAU = 120; // s, time constant of flow temperature
+const double ROOM_LEVEL = 20; // °C, flow temperature without heating
+const uint32_t TURNAROUND_JITTER = 10000; // us
+
+// gateway config, in master mode it controls the boiler like the room unit would
+const char MASTER_CONFIG[] = R"({"otMode":1,"enableSlave":true,"heating":[{"chOn":true,"flow":55,"flowMax":60}],"boiler":{"dhwOn":true,"dhwTemperature":50}})";
+const char REPEATER_CONFIG[] = R"({"otMode":2})";
+
+uint32_t buildFrame(const MsgType type, const uint8_t id, const uint16_t data) {
+    uint32_t frame = ((uint32_t) type << 28) | ((uint32_t) id << 16) | data;
+    if (__builtin_popcount(frame) & 1)
+        frame |= 1UL << 31; // even parity
+    return frame;
+}
+
+bool parityOk(const uint32_t frame) {
+    return (__builtin_popcount(frame) & 1) == 0;
+}
+
+VirtualBoiler::VirtualBoiler():
+        turnaround(100000),
+        silentUntil(0),
+        parityErrorRate(0),
+        faultFlags(0),
+        lastUpdate(0),
+        chEnable(false),
+        dhwEnable(false),
+        flame(false),
+        tset(0),
+        maxMod(100),
+        flow(ROOM_LEVEL),
+        ret(ROOM_LEVEL),
+        dhw(50),
+        rng(1) {
+}
+
+void VirtualBoiler::update(const uint64_t now) {
+    const double dt = (now - lastUpdate) / 1e6;
+    lastUpdate = now;
+
+    // burner with 5 K hysteresis around the flow set point
+    if (!chEnable || (faultFlags != 0) || (flow > tset + 5))
+        flame = false;
+    else if (flow < tset - 5)
+        flame = true;
+
+    const double target = flame ? tset + 5 : ROOM_LEVEL;
+    flow += (target - flow) * (1 - exp(-dt / FLOW_TAU));
+    ret = ROOM_LEVEL + (flow - ROOM_LEVEL) * 0.8;
+}
+
+bool VirtualBoiler::respond(const uint32_t request, const uint64_t now, uint32_t &response, uint32_t &turnaroundTime) {
+    if ((now < silentUntil) || !parityOk(request))
+        return false;
+
+    const uint8_t id = frameId(request);
+    const uint16_t data = frameData(request);
+    MsgType type;
+    switch (frameType(request)) {
+    case READ_DATA:
+        type = READ_ACK;
+        break;
+    case WRITE_DATA:
+        type = WRITE_ACK;
+        break;
+    default:
+        return false;
+    }
+
+    uint16_t resp = data;
+    switch (id) {
+    case ID_STATUS:
+        chEnable = data & (1<<8);
+        dhwEnable = data & (1<<9);
+        resp = (data & 0xFF00) | ((faultFlags != 0) ? 1 : 0) | ((chEnable && flame) ? 2 : 0) | (flame ? 8 : 0);
+        break;
+    case ID_TSET:
+        if (type == WRITE_ACK)
+            tset = std::clamp(f88(data), 0.0, 90.0);
+        else
+            resp = f88(tset);
+        break;
+    case ID_MAX_MOD:
+        if (type == WRITE_ACK)
+            maxMod = std::clamp(f88(data), 0.0, 100.0);
+        else
+            resp = f88(maxMod);
+        break;
+    case ID_SCONFIG:
+        resp = 0x0109; // DHW present, member id 9
+        break;
+    case ID_ASF_FLAGS:
+        resp = faultFlags << 8;
+        break;
+    case ID_REL_MOD:
+        resp = f88(flame ? std::clamp((tset - flow) * 10, 10.0, maxMod) : 0.0);
+        break;
+    case ID_CH_PRESSURE:
+        resp = f88(1.5);
+        break;
+    case ID_TBOILER:
+        resp = f88(flow);
+        break;
+    case ID_TRET:
+        resp = f88(ret);
+        break;
+    case ID_TDHW:
+        resp = f88(dhw);
+        break;
+    case ID_TDHWSET:
+        resp = f88(50.0);
+        break;
+    case ID_MAXTSET:
+        resp = f88(80.0);
+        break;
+    case ID_OT_VERSION_SLAVE:
+        resp = f88(2.2);
+        break;
+    case ID_SLAVE_VERSION:
+        resp = 0x0101;
+        break;
+    case ID_MCONFIG:
+    case ID_TR:
+    case ID_TRSET:
+    case ID_TOUTSIDE:
+        break;
+    default:
+        type = UNKNOWN_DATA_ID;
+    }
+
+    response = buildFrame(type, id, resp);
+    if (std::uniform_real_distribution<double>(0, 1)(rng) < parityErrorRate)
+        response ^= 1; // single bit error
+    turnaroundTime = turnaround + std::uniform_int_distribution<uint32_t>(0, TURNAROUND_JITTER)(rng);
+    return true;
+}
+
+static const struct {
+    MsgType type;
+    MsgId id;
+} ROOMUNIT_CYCLE[] = {
+    {READ_DATA,  ID_STATUS},
+    {WRITE_DATA, ID_TSET},
+    {READ_DATA,  ID_TBOILER},
+    {READ_DATA,  ID_REL_MOD},
+    {READ_DATA,  ID_STATUS},
+    {WRITE_DATA, ID_TR},
+    {WRITE_DATA, ID_TRSET},
+    {READ_DATA,  ID_ASF_FLAGS},
+    {READ_DATA,  ID_STATUS},
+    {READ_DATA,  ID_TDHW},
+    {READ_DATA,  ID_TRET},
+    {READ_DATA,  ID_SCONFIG}
+};
+
+VirtualRoomUnit::VirtualRoomUnit():
+        chEnable(true),
+        tset(55),
+        roomTemp(20.5),
+        roomSet(21),
+        invalid(0),
+        notAcked(0),
+        idx(0) {
+}
+
+uint32_t VirtualRoomUnit::nextRequest() {
+    const auto &item = ROOMUNIT_CYCLE[idx];
+    idx = (idx + 1) % (sizeof(ROOMUNIT_CYCLE) / sizeof(ROOMUNIT_CYCLE[0]));
+
+    uint16_t data = 0;
+    switch (item.id) {
+    case ID_STATUS:
+        data = (chEnable ? (1<<8) : 0) | (1<<9);
+        break;
+    case ID_TSET:
+        data = f88(chEnable ? tset : 0.0);
+        break;
+    case ID_TR:
+        data = f88(roomTemp);
+        break;
+    case ID_TRSET:
+        data = f88(roomSet);
+        break;
+    default:
+        break;
+    }
+    return buildFrame(item.type, item.id, data);
+}
+
+void VirtualRoomUnit::onResponse(const uint32_t request, const bool ok, const uint32_t response) {
+    if (!ok)
+        return;
+    const MsgType type = frameType(response);
+    if ((type == DATA_INVALID) || (type == UNKNOWN_DATA_ID))
+        notAcked += parityOk(response) && (frameId(response) == frameId(request));
+    else if (!parityOk(response) || (frameId(response) != frameId(request)) || ((type != READ_ACK) && (type != WRITE_ACK)))
+        invalid++;
+}
+
+/**
+ * Virtual boiler on the gateway's master interface
+ */
+struct Simulator::BoilerLink: public OpenThermPeer {
+    Simulator &sim;
+    Result &res;
+    BoilerLink(Simulator &sim, Result &res): sim(sim), res(res) {}
+    void onFrame(OpenTherm &hal, const unsigned long frame) override {
+        const uint64_t reqEnd = sim.clock();
+        uint64_t end;
+        uint32_t response;
+        if (sim.boilerTransfer(frame, reqEnd - FRAME_TIME, end, response, res))
+            hal.hostReceive(response, micros() + (end - FRAME_TIME - reqEnd));
+    }
+};
+
+/**
+ * Virtual room unit on the gateway's slave interface, sends its requests from poll()
+ */
+struct Simulator::RoomUnitLink: public OpenThermPeer {
+    Simulator &sim;
+    Result &res;
+    bool waiting {false};
+    uint32_t request {0};
+    uint64_t start {0}; // us, of pending request
+    uint64_t next {0}; // us, earliest start of next request
+    RoomUnitLink(Simulator &sim, Result &res): sim(sim), res(res) {}
+
+    void poll(OpenTherm &hal) override {
+        const uint64_t now = sim.clock();
+        sim.runScript(now);
+        if (waiting && (now > start + FRAME_TIME + RESPONSE_TIMEOUT))
+            timeout(now);
+        if (waiting || (now < next))
+            return;
+
+        request = sim.roomUnit.nextRequest();
+        start = now;
+        waiting = true;
+        res.roomFrames++;
+        hal.hostReceive(request, micros());
+    }
+
+    void onFrame(OpenTherm &hal, const unsigned long frame) override {
+        (void) hal;
+        if (!waiting)
+            return; // room unit gave up already
+        const uint64_t now = sim.clock();
+        const uint64_t latency = now - FRAME_TIME - (start + FRAME_TIME);
+        if (latency > RESPONSE_TIMEOUT) {
+            timeout(now);
+            return;
+        }
+        sim.addLatency(res, latency);
+        sim.roomUnit.onResponse(request, true, frame);
+        done(now);
+    }
+
+    void timeout(const uint64_t now) {
+        sim.roomUnit.onResponse(request, false, 0);
+        res.roomTimeouts++;
+        done(now);
+    }
+
+    void done(const uint64_t now) {
+        waiting = false;
+        next = std::max(start + ROOMUNIT_PERIOD, now + MASTER_GAP);
+    }
+};
+
+Simulator::Simulator(const Mode mode):
+        scriptIdx(0),
+        mode(mode),
+        now(0),
+        lastMicros(0),
+        latencySum(0),
+        latencyCount(0) {
+}
+
+/**
+ * Loads a script, one command per line: <time s> <command> <value>
+ * Commands: delay <ms>, silent <s>, parity <error rate>, fault <flags>, tset <°C>, ch <0|1>
+ */
+bool Simulator::loadScript(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (f == nullptr)
+        return false;
+
+    char line[128];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        double t, arg;
+        char cmd[16];
+        if ((line[0] == '#') || (sscanf(line, "%lf %15s %lf", &t, cmd, &arg) != 3))
+            continue;
+        script.push_back({(uint64_t) (t * 1e6), cmd, arg});
+    }
+    fclose(f);
+
+    std::stable_sort(script.begin(), script.end(),
+        [](const ScriptCmd &a, const ScriptCmd &b) { return a.time < b.time; });
+    return true;
+}
+
+void Simulator::runScript(const uint64_t now) {
+    for (; (scriptIdx < script.size()) && (script[scriptIdx].time <= now); scriptIdx++) {
+        const ScriptCmd &sc = script[scriptIdx];
+        if (sc.cmd == "delay")
+            boiler.turnaround = sc.arg * 1000;
+        else if (sc.cmd == "silent")
+            boiler.silentUntil = now + (uint64_t) (sc.arg * 1e6);
+        else if (sc.cmd == "parity")
+            boiler.parityErrorRate = sc.arg;
+        else if (sc.cmd == "fault")
+            boiler.faultFlags = sc.arg;
+        else if (sc.cmd == "tset")
+            roomUnit.tset = sc.arg;
+        else if (sc.cmd == "ch")
+            roomUnit.chEnable = sc.arg != 0;
+        else
+            fprintf(stderr, "unknown script command %s\n", sc.cmd.c_str());
+    }
+}
+
+/**
+ * One request / response on the boiler link
+ * @param end set to end of response frame or of response timeout
+ * @return false on timeout, response has to be checked for parity
+ */
+bool Simulator::boilerTransfer(const uint32_t request, const uint64_t start, uint64_t &end, uint32_t &response, Result &res) {
+    res.boilerFrames++;
+    const uint64_t reqEnd = start + FRAME_TIME;
+    boiler.update(reqEnd);
+
+    uint32_t turnaround;
+    if (!boiler.respond(request, reqEnd, response, turnaround) || (turnaround > RESPONSE_TIMEOUT)) {
+        res.timeouts++;
+        end = reqEnd + RESPONSE_TIMEOUT;
+        return false;
+    }
+    end = reqEnd + std::max(turnaround, SLAVE_TURNAROUND_MIN) + FRAME_TIME;
+
+    if (!parityOk(response))
+        res.parityErrors++;
+    else if ((frameType(response) == READ_ACK) || (frameType(response) == WRITE_ACK))
+        res.idCount[frameId(response)]++;
+    return true;
+}
+
+/**
+ * Simulated time of the gateway modes, follows the host clock
+ */
+uint64_t Simulator::clock() {
+    const uint32_t us = micros();
+    now += (uint32_t) (us - lastMicros);
+    lastMicros = us;
+    return now;
+}
+
+void Simulator::addLatency(Result &res, const uint64_t latency) {
+    latencySum += latency;
+    latencyCount++;
+    res.latencyMax = std::max<uint32_t>(res.latencyMax, latency);
+}
+
+Simulator::Result Simulator::run(const uint64_t duration) {
+    latencySum = 0;
+    latencyCount = 0;
+    Result res = (mode == MODE_BYPASS) ? runBypass(duration) : runGateway(duration);
+    res.simTime = duration;
+    res.roomInvalid = roomUnit.invalid;
+    res.roomNotAcked = roomUnit.notAcked;
+    res.latencyAvg = (latencyCount > 0) ? latencySum / latencyCount : 0;
+    return res;
+}
+
+/**
+ * Room unit wired to the boiler through the bypass relay
+ */
+Simulator::Result Simulator::runBypass(const uint64_t duration) {
+    Result res {};
+    for (uint64_t t = 0; t < duration; ) {
+        runScript(t);
+        const uint32_t req = roomUnit.nextRequest();
+        res.roomFrames++;
+        const uint64_t reqEnd = t + FRAME_TIME;
+        uint64_t end;
+        uint32_t resp = 0;
+        const bool ok = boilerTransfer(req, t, end, resp, res);
+        if (ok)
+            addLatency(res, end - FRAME_TIME - reqEnd);
+        else
+            res.roomTimeouts++;
+        roomUnit.onResponse(req, ok, resp);
+        t = std::max(t + ROOMUNIT_PERIOD, end + MASTER_GAP);
+    }
+    return res;
+}
+
+/**
+ * Runs the gateway until the simulated time has passed, needs otcontrol.begin() before
+ */
+Simulator::Result Simulator::runGateway(const uint64_t duration) {
+    Result res {};
+    BoilerLink boilerLink(*this, res);
+    RoomUnitLink roomLink(*this, res);
+    OpenTherm *boilerSide = OpenTherm::hostFind(false);
+    OpenTherm *roomSide = OpenTherm::hostFind(true);
+    boilerSide->setPeer(&boilerLink);
+    roomSide->setPeer(&roomLink);
+
+    JsonDocument config;
+    deserializeJson(config, (mode == MODE_MASTER) ? MASTER_CONFIG : REPEATER_CONFIG);
+    otcontrol.setConfig(config.as<JsonObjectConst>(), JsonObjectConst());
+
+    hostClockManual(true); // delays of the firmware advance the clock
+    now = 0;
+    lastMicros = micros();
+    while (clock() < duration)
+        otcontrol.loop();
+
+    boilerSide->setPeer(nullptr);
+    roomSide->setPeer(nullptr);
+    return res;
+}
+
+const char* Simulator::modeName(const Mode mode) {
+    switch (mode) {
+    case MODE_BYPASS:
+        return "bypass";
+    case MODE_REPEATER:
+        return "repeater";
+    default:
+        return "master";
+    }
+}
+
+void Simulator::printResult(const Mode mode, const Result &res) {
+    const double secs = res.simTime / 1e6;
+    printf("%s, %.0f s simulated\n", modeName(mode), secs);
+    printf("  boiler link   %8.2f frames/s, %u timeouts, %u parity errors\n",
+        res.boilerFrames / secs, res.timeouts, res.parityErrors);
+    printf("  room unit     %8.2f frames/s, %u timeouts, %u invalid, %u not acknowledged, latency avg %.1f ms, max %.1f ms\n",
+        res.roomFrames / secs, res.roomTimeouts, res.roomInvalid, res.roomNotAcked, res.latencyAvg / 1000, res.latencyMax / 1000.0);
+    printf("  refresh interval per ID:");
+    for (const auto &ic: res.idCount)
+        printf(" %u:%.2fs", ic.first, secs / ic.second);
+    printf("\n");
+}
+
+}
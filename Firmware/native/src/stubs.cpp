@@ -0,0 +1,65 @@
+// Modules of the firmware which aren't built on the host: web portal, device status, TLS CA bundle.
+// The stand-ins keep the interfaces the built modules call.
+
+#include <Arduino.h>
+#include "portal.h"
+#include "devstatus.h"
+#include <esp_crt_bundle.h>
+
+bool configMode = false;
+
+Portal portal;
+
+Portal::Portal():
+        reboot(false),
+        updateEnable(false) {
+    wsMutex = xSemaphoreCreateMutex();
+}
+
+void Portal::begin(bool configMode) {
+    (void) configMode;
+}
+
+void Portal::loop() {
+}
+
+bool Portal::wsLog(const char *text, const size_t len) {
+    (void) text;
+    (void) len;
+    return true;
+}
+
+bool Portal::hasWsClients() {
+    return false;
+}
+
+DevStatus devstatus;
+
+DevStatus::DevStatus():
+        numWifiDiscon(0) {
+    mutex = xSemaphoreCreateMutex();
+}
+
+bool DevStatus::lock() {
+    return xSemaphoreTake(mutex, (TickType_t) 500 / portTICK_PERIOD_MS) == pdTRUE;
+}
+
+void DevStatus::unlock() {
+    xSemaphoreGive(mutex);
+}
+
+void DevStatus::loopTime(const uint32_t us) {
+    loopMax = std::max(loopMax, us);
+}
+
+void DevStatus::buildDoc(JsonDocument &doc) {
+    doc.clear();
+    doc[F("runtime")] = millis() / 1000UL;
+    doc[F("fw_version")] = F(BUILD_VERSION);
+    doc[F("numWifiDisc")] = numWifiDiscon;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf) {
+    (void) conf;
+    return 0;
+}
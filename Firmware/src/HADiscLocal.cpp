@@ -1,6 +1,8 @@
 #include "HADiscLocal.h"
 #include <WiFi.h>
+#include <rom/crc.h>
 #include "mqtt.h"
+#include "eventlog.h"
 
 OTThingHADiscovery haDisc;
 
@@ -8,11 +10,12 @@ const char *DEVNAME PROGMEM = "OTthing";
 const char *MANUFACTURER PROGMEM = "Seegel Systeme";
 
 OTThingHADiscovery::OTThingHADiscovery() {
-    devName = FPSTR(DEVNAME);
     manufacturer = MANUFACTURER;
 }
 
 void OTThingHADiscovery::begin() {
+    // not in the constructor, devName is a static of another translation unit
+    devName = FPSTR(DEVNAME);
     String shortMac = WiFi.macAddress();
     shortMac.remove(0, 9);
     int idx;
@@ -20,16 +23,36 @@ void OTThingHADiscovery::begin() {
         shortMac.remove(idx, 1);
     devPrefix = F("otthing_");
     devPrefix += shortMac;
+    buildDevice();
 }
 
-void OTThingHADiscovery::createSwitch(String name, Mqtt::MqttTopic topic) {
+void OTThingHADiscovery::createSwitch(HAStr name, Mqtt::MqttTopic topic) {
     HADiscovery::createSwitch(name, Mqtt::getTopicString(topic), mqtt.getCmdTopic(topic));
     haDisc.setOptimistic(true);
     haDisc.setRetain(true);
 }
 
+/**
+ * An entity that doesn't fit into the arena is logged and skipped, retrying can't make it fit
+ * @return false if the message can't be queued now, the producer has to retry later
+ */
 bool OTThingHADiscovery::publish(const bool avail) {
     if (!avail)
         haDisc.clearDoc();
-    return mqtt.publish(topic, doc, true);
+    const size_t len = serialize();
+    if (!isValid()) {
+        // an empty payload would remove the entity, so an incomplete one isn't published at all
+        const uint32_t hash = crc32_le(0, (const uint8_t*) topic, strlen(topic));
+        if (hash != lastOverflow) {
+            lastOverflow = hash;
+            const char *id = strrchr(topic, '/');
+            while ((id > topic) && (*(id - 1) != '/'))
+                id--; // object id in front of "/config"
+            int32_t a0, a1;
+            EventLog::packStr(id, a0, a1);
+            eventlog.add(LOGMOD_MQTT, LOGLVL_ERROR, LOGMSG_DISC_OVERFLOW, a0, a1);
+        }
+        return true;
+    }
+    return mqtt.queueDiscovery(topic, payload, len);
 }
\ No newline at end of file
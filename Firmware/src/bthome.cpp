@@ -0,0 +1,230 @@
+#include "bthome.h"
+#include <string.h>
+
+static const uint8_t AD_SERVICE_DATA_16 = 0x16;
+static const uint16_t BTHOME_UUID = 0xFCD2;
+static const uint8_t INFO_ENCRYPTED = 0x01;
+static const uint8_t INFO_VERSION_MASK = 0xE0;
+static const uint8_t INFO_VERSION_2 = 0x40;
+
+static constexpr struct ObjectDef {
+    uint8_t id;
+    uint8_t len;        // bytes, 0: length prefixed (text, raw)
+    bool sign;
+    float scale;
+    BTHome::Field field;
+} objectDefs[] = {
+    {0x00, 1, false, 1,     BTHome::FIELD_PACKET_ID},
+    {0x01, 1, false, 1,     BTHome::FIELD_BATTERY},
+    {0x02, 2, true,  0.01,  BTHome::FIELD_TEMP},
+    {0x03, 2, false, 0.01,  BTHome::FIELD_HUMIDITY},
+    {0x04, 3, false, 0.01,  BTHome::FIELD_PRESSURE},
+    {0x05, 3, false, 0.01,  BTHome::FIELD_ILLUMINANCE},
+    {0x06, 2, false, 0.01,  BTHome::FIELD_NONE},        // mass kg
+    {0x07, 2, false, 0.01,  BTHome::FIELD_NONE},        // mass lb
+    {0x08, 2, true,  0.01,  BTHome::FIELD_DEWPOINT},
+    {0x09, 1, false, 1,     BTHome::FIELD_NONE},        // count
+    {0x0A, 3, false, 0.001, BTHome::FIELD_NONE},        // energy
+    {0x0B, 3, false, 0.01,  BTHome::FIELD_NONE},        // power
+    {0x0C, 2, false, 0.001, BTHome::FIELD_VOLTAGE},
+    {0x0D, 2, false, 1,     BTHome::FIELD_NONE},        // pm2.5
+    {0x0E, 2, false, 1,     BTHome::FIELD_NONE},        // pm10
+    {0x0F, 1, false, 1,     BTHome::FIELD_NONE},        // generic boolean
+    {0x10, 1, false, 1,     BTHome::FIELD_NONE},        // power binary
+    {0x11, 1, false, 1,     BTHome::FIELD_NONE},        // opening
+    {0x12, 2, false, 1,     BTHome::FIELD_CO2},
+    {0x13, 2, false, 1,     BTHome::FIELD_TVOC},
+    {0x14, 2, false, 0.01,  BTHome::FIELD_MOISTURE},
+    {0x15, 1, false, 1,     BTHome::FIELD_NONE},        // battery low
+    {0x16, 1, false, 1,     BTHome::FIELD_NONE},        // battery charging
+    {0x17, 1, false, 1,     BTHome::FIELD_NONE},        // carbon monoxide
+    {0x18, 1, false, 1,     BTHome::FIELD_NONE},        // cold
+    {0x19, 1, false, 1,     BTHome::FIELD_NONE},        // connectivity
+    {0x1A, 1, false, 1,     BTHome::FIELD_NONE},        // door
+    {0x1B, 1, false, 1,     BTHome::FIELD_NONE},        // garage door
+    {0x1C, 1, false, 1,     BTHome::FIELD_NONE},        // gas
+    {0x1D, 1, false, 1,     BTHome::FIELD_NONE},        // heat
+    {0x1E, 1, false, 1,     BTHome::FIELD_NONE},        // light
+    {0x1F, 1, false, 1,     BTHome::FIELD_NONE},        // lock
+    {0x20, 1, false, 1,     BTHome::FIELD_NONE},        // moisture binary
+    {0x21, 1, false, 1,     BTHome::FIELD_NONE},        // motion
+    {0x22, 1, false, 1,     BTHome::FIELD_NONE},        // moving
+    {0x23, 1, false, 1,     BTHome::FIELD_NONE},        // occupancy
+    {0x24, 1, false, 1,     BTHome::FIELD_NONE},        // plug
+    {0x25, 1, false, 1,     BTHome::FIELD_NONE},        // presence
+    {0x26, 1, false, 1,     BTHome::FIELD_NONE},        // problem
+    {0x27, 1, false, 1,     BTHome::FIELD_NONE},        // running
+    {0x28, 1, false, 1,     BTHome::FIELD_NONE},        // safety
+    {0x29, 1, false, 1,     BTHome::FIELD_NONE},        // smoke
+    {0x2A, 1, false, 1,     BTHome::FIELD_NONE},        // sound
+    {0x2B, 1, false, 1,     BTHome::FIELD_NONE},        // tamper
+    {0x2C, 1, false, 1,     BTHome::FIELD_NONE},        // vibration
+    {0x2D, 1, false, 1,     BTHome::FIELD_WINDOW},
+    {0x2E, 1, false, 1,     BTHome::FIELD_HUMIDITY},
+    {0x2F, 1, false, 1,     BTHome::FIELD_MOISTURE},
+    {0x3A, 1, false, 1,     BTHome::FIELD_BUTTON},
+    {0x3C, 2, false, 1,     BTHome::FIELD_NONE},        // dimmer event
+    {0x3D, 2, false, 1,     BTHome::FIELD_NONE},        // count
+    {0x3E, 4, false, 1,     BTHome::FIELD_NONE},        // count
+    {0x3F, 2, true,  0.1,   BTHome::FIELD_NONE},        // rotation
+    {0x40, 2, false, 1,     BTHome::FIELD_NONE},        // distance mm
+    {0x41, 2, false, 0.1,   BTHome::FIELD_NONE},        // distance m
+    {0x42, 3, false, 0.001, BTHome::FIELD_NONE},        // duration
+    {0x43, 2, false, 0.001, BTHome::FIELD_NONE},        // current
+    {0x44, 2, false, 0.01,  BTHome::FIELD_NONE},        // speed
+    {0x45, 2, true,  0.1,   BTHome::FIELD_TEMP},
+    {0x46, 1, false, 0.1,   BTHome::FIELD_NONE},        // UV index
+    {0x47, 2, false, 0.1,   BTHome::FIELD_NONE},        // volume l
+    {0x48, 2, false, 1,     BTHome::FIELD_NONE},        // volume ml
+    {0x49, 2, false, 0.001, BTHome::FIELD_NONE},        // volume flow rate
+    {0x4A, 2, false, 0.1,   BTHome::FIELD_VOLTAGE},
+    {0x4B, 3, false, 0.001, BTHome::FIELD_NONE},        // gas
+    {0x4C, 4, false, 0.001, BTHome::FIELD_NONE},        // gas
+    {0x4D, 4, false, 0.001, BTHome::FIELD_NONE},        // energy
+    {0x4E, 4, false, 0.001, BTHome::FIELD_NONE},        // volume
+    {0x4F, 4, false, 0.001, BTHome::FIELD_NONE},        // water
+    {0x50, 4, false, 1,     BTHome::FIELD_NONE},        // timestamp
+    {0x51, 2, false, 0.001, BTHome::FIELD_NONE},        // acceleration
+    {0x52, 2, false, 0.001, BTHome::FIELD_NONE},        // gyroscope
+    {0x53, 0, false, 1,     BTHome::FIELD_NONE},        // text
+    {0x54, 0, false, 1,     BTHome::FIELD_NONE},        // raw
+    {0x55, 4, false, 0.001, BTHome::FIELD_NONE},        // volume storage
+    {0x56, 2, false, 1,     BTHome::FIELD_NONE},        // conductivity
+    {0x57, 1, true,  1,     BTHome::FIELD_TEMP},
+    {0x58, 1, true,  0.35,  BTHome::FIELD_TEMP},
+    {0x59, 1, true,  1,     BTHome::FIELD_NONE},        // count
+    {0x5A, 2, true,  1,     BTHome::FIELD_NONE},        // count
+    {0x5B, 4, true,  1,     BTHome::FIELD_NONE},        // count
+    {0x5C, 4, true,  0.01,  BTHome::FIELD_NONE},        // power
+    {0x5D, 2, true,  0.001, BTHome::FIELD_NONE},        // current
+    {0x5E, 2, false, 0.01,  BTHome::FIELD_NONE},        // direction
+    {0x5F, 2, false, 0.1,   BTHome::FIELD_NONE},        // precipitation
+    {0x60, 1, false, 1,     BTHome::FIELD_NONE},        // channel
+    {0xF0, 2, false, 1,     BTHome::FIELD_NONE},        // device type id
+    {0xF1, 4, false, 1,     BTHome::FIELD_NONE},        // firmware version
+    {0xF2, 3, false, 1,     BTHome::FIELD_NONE}         // firmware version
+};
+
+static const char *FIELD_NAMES[] = {
+    "",
+    "packetId",
+    "bat",
+    "temp",
+    "rh",
+    "dewpoint",
+    "pressure",
+    "illuminance",
+    "voltage",
+    "co2",
+    "tvoc",
+    "moisture",
+    "window",
+    "button"
+};
+
+static_assert(sizeof(FIELD_NAMES) / sizeof(FIELD_NAMES[0]) == BTHome::NUM_FIELDS, "FIELD_NAMES incomplete");
+static_assert(BTHome::NUM_FIELDS <= 32, "Reading::valid too small");
+
+static constexpr bool objectDefsSorted() {
+    for (size_t i=1; i<sizeof(objectDefs) / sizeof(objectDefs[0]); i++)
+        if (objectDefs[i - 1].id >= objectDefs[i].id)
+            return false;
+    return true;
+}
+
+static_assert(objectDefsSorted(), "objectDefs must be sorted by id");
+
+static const ObjectDef* findObject(const uint8_t id) {
+    size_t lo = 0;
+    size_t hi = sizeof(objectDefs) / sizeof(objectDefs[0]);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (objectDefs[mid].id == id)
+            return &objectDefs[mid];
+        if (objectDefs[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return nullptr;
+}
+
+/**
+ * Finds BTHome service data in a raw advertisement payload
+ * @param data set to first byte after the UUID (device info byte)
+ */
+bool BTHome::findServiceData(const uint8_t *adv, const size_t advLen, const uint8_t *&data, size_t &len) {
+    size_t i = 0;
+    while (i < advLen) {
+        const uint8_t adLen = adv[i];
+        if ((adLen == 0) || (i + 1 + adLen > advLen))
+            return false;
+
+        const uint8_t *ad = adv + i + 1;
+        if ((ad[0] == AD_SERVICE_DATA_16) && (adLen >= 3) &&
+                ((ad[1] | (ad[2] << 8)) == BTHOME_UUID)) {
+            data = ad + 3;
+            len = adLen - 3;
+            return true;
+        }
+        i += adLen + 1;
+    }
+    return false;
+}
+
+/**
+ * Decodes service data starting with the device info byte
+ * @return false if packet is encrypted, not version 2 or malformed. Objects
+ * decoded before an error are kept in reading.
+ */
+bool BTHome::decode(const uint8_t *data, const size_t len, Reading &reading) {
+    reading.valid = 0;
+    if (len < 1)
+        return false;
+
+    const uint8_t info = data[0];
+    if (((info & INFO_VERSION_MASK) != INFO_VERSION_2) || (info & INFO_ENCRYPTED))
+        return false;
+
+    size_t i = 1;
+    while (i < len) {
+        const ObjectDef *def = findObject(data[i++]);
+        if (def == nullptr)
+            return false; // length of unknown objects is unknown, can't continue
+
+        size_t objLen = def->len;
+        if (objLen == 0) {
+            if (i >= len)
+                return false;
+            objLen = data[i++];
+        }
+        if (i + objLen > len)
+            return false;
+
+        if ((def->field != FIELD_NONE) && (objLen <= 4)) {
+            uint32_t raw = 0;
+            for (size_t b=0; b<objLen; b++)
+                raw |= (uint32_t) data[i + b] << (8 * b);
+
+            float val;
+            if (def->sign && (objLen < 4)) {
+                // sign extend
+                const uint32_t signBit = 1UL << (objLen * 8 - 1);
+                val = (int32_t) ((raw ^ signBit) - signBit);
+            }
+            else if (def->sign)
+                val = (int32_t) raw;
+            else
+                val = raw;
+
+            reading.values[def->field] = val * def->scale;
+            reading.valid |= 1UL << def->field;
+        }
+        i += objLen;
+    }
+    return true;
+}
+
+const char* BTHome::fieldName(const Field f) {
+    return (f < NUM_FIELDS) ? FIELD_NAMES[f] : "";
+}
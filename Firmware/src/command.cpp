@@ -1,10 +1,189 @@
 #include "command.h"
+#include <algorithm>
 #include "portal.h"
 #include "otvalues.h"
 #include "main.h"
+#include "otcontrol.h"
+#include "sensors.h"
+#include "util.h"
+#include "logsink.h"
+#include "eventlog.h"
 
 OtGwCommand command;
 
+class CmdLock: public SemHelper {
+public:
+    CmdLock(SemaphoreHandle_t &mtx): SemHelper(mtx, 100) {
+    }
+};
+
+// OTGW error responses
+static const char ERR_NG[] PROGMEM = "NG"; // no good, unknown command
+static const char ERR_SE[] PROGMEM = "SE"; // syntax error
+static const char ERR_BV[] PROGMEM = "BV"; // bad value
+static const char ERR_OR[] PROGMEM = "OR"; // out of range
+
+/**
+ * Handler of an OTGW command, val is null terminated.
+ * @return nullptr on success with resp containing the reported value, otherwise error response
+ */
+typedef const char* (*CmdHandler)(const char *val, char *resp, const size_t respSize);
+
+static const char* parseNum(const char *val, const double min, const double max, double &d) {
+    char *end;
+    d = strtod(val, &end);
+    if ((end == val) || (*end != 0))
+        return ERR_BV;
+    if ((d < min) || (d > max))
+        return ERR_OR;
+    return nullptr;
+}
+
+static const char* parseMode(const char *val, OTControl::CtrlMode &mode) {
+    if (strcmp(val, "0") == 0)
+        mode = OTControl::CTRLMODE_OFF;
+    else if (strcmp(val, "1") == 0)
+        mode = OTControl::CTRLMODE_ON;
+    else if ((strcmp(val, "A") == 0) || (strcmp(val, "a") == 0))
+        mode = OTControl::CTRLMODE_AUTO;
+    else
+        return ERR_BV;
+    return nullptr;
+}
+
+static const char* cmdRoomSetpoint(const AutoSensor::OverrideMode mode, const char *val, char *resp, const size_t respSize) {
+    double d;
+    const char *err = parseNum(val, 0, 30, d);
+    if (err)
+        return err;
+    roomSetPoint[0].setOverride(d, mode); // 0 returns to the configured source
+    otcontrol.forceFlowCalc(0);
+    snprintf(resp, respSize, "%.2f", d);
+    return nullptr;
+}
+
+static const char* cmdTempSetpoint(const char *val, char *resp, const size_t respSize) {
+    return cmdRoomSetpoint(AutoSensor::OVERRIDE_TEMP, val, resp, respSize);
+}
+
+static const char* cmdConstSetpoint(const char *val, char *resp, const size_t respSize) {
+    return cmdRoomSetpoint(AutoSensor::OVERRIDE_CONST, val, resp, respSize);
+}
+
+static const char* cmdOutsideTemp(const char *val, char *resp, const size_t respSize) {
+    double d;
+    const char *err = parseNum(val, -40, 64, d);
+    if (err)
+        return err;
+    outsideTemp.set(d, Sensor::SOURCE_MQTT);
+    snprintf(resp, respSize, "%.2f", d);
+    return nullptr;
+}
+
+static const char* cmdDhwSetpoint(const char *val, char *resp, const size_t respSize) {
+    double d;
+    const char *err = parseNum(val, 0, 100, d);
+    if (err)
+        return err;
+    otcontrol.setDhwTemp(d);
+    snprintf(resp, respSize, "%.2f", d);
+    return nullptr;
+}
+
+static const char* cmdCtrlSetpoint(const uint8_t ch, const char *val, char *resp, const size_t respSize) {
+    double d;
+    const char *err = parseNum(val, 0, 100, d);
+    if (err)
+        return err;
+    otcontrol.setChTemp(d, ch); // 0 returns to automatic flow temperature
+    snprintf(resp, respSize, "%.2f", d);
+    return nullptr;
+}
+
+static const char* cmdCtrlSetpoint1(const char *val, char *resp, const size_t respSize) {
+    return cmdCtrlSetpoint(0, val, resp, respSize);
+}
+
+static const char* cmdCtrlSetpoint2(const char *val, char *resp, const size_t respSize) {
+    return cmdCtrlSetpoint(1, val, resp, respSize);
+}
+
+static const char* cmdChEnable(const uint8_t ch, const char *val, char *resp, const size_t respSize) {
+    OTControl::CtrlMode mode;
+    const char *err = parseMode(val, mode);
+    if (err)
+        return err;
+    otcontrol.setChCtrlMode(mode, ch);
+    strlcpy(resp, val, respSize);
+    return nullptr;
+}
+
+static const char* cmdChEnable1(const char *val, char *resp, const size_t respSize) {
+    return cmdChEnable(0, val, resp, respSize);
+}
+
+static const char* cmdChEnable2(const char *val, char *resp, const size_t respSize) {
+    return cmdChEnable(1, val, resp, respSize);
+}
+
+static const char* cmdDhwEnable(const char *val, char *resp, const size_t respSize) {
+    OTControl::CtrlMode mode;
+    const char *err = parseMode(val, mode);
+    if (err)
+        return err;
+    otcontrol.setDhwCtrlMode(mode);
+    strlcpy(resp, val, respSize);
+    return nullptr;
+}
+
+static const char* cmdMaxModulation(const char *val, char *resp, const size_t respSize) {
+    double d;
+    const char *err = parseNum(val, 0, 100, d);
+    if (err)
+        return err;
+    otcontrol.setMaxMod((int) d);
+    snprintf(resp, respSize, "%d", (int) d);
+    return nullptr;
+}
+
+static const char* cmdVentSetpoint(const char *val, char *resp, const size_t respSize) {
+    double d;
+    const char *err = parseNum(val, 0, 100, d);
+    if (err)
+        return err;
+    otcontrol.setVentSetpoint((uint8_t) d);
+    snprintf(resp, respSize, "%d", (int) d);
+    return nullptr;
+}
+
+static const char* cmdPrintSummary(const char *val, char *resp, const size_t respSize);
+
+static const char* cmdPrintReport(const char *val, char *resp, const size_t respSize) {
+    if ((strcmp(val, "A") != 0) && (strcmp(val, "a") != 0))
+        return ERR_BV;
+    snprintf(resp, respSize, "A=OT-Thing %s", BUILD_VERSION);
+    return nullptr;
+}
+
+static const struct {
+    char code[3];
+    CmdHandler handler;
+} cmdTable[] PROGMEM = {
+    {"TT", cmdTempSetpoint},    // temporary room setpoint, until thermostat changes it, 0 = cancel
+    {"TC", cmdConstSetpoint},   // constant room setpoint, 0 = cancel
+    {"OT", cmdOutsideTemp},     // outside temperature
+    {"SW", cmdDhwSetpoint},     // DHW setpoint
+    {"CS", cmdCtrlSetpoint1},   // control setpoint CH1, 0 = auto
+    {"C2", cmdCtrlSetpoint2},   // control setpoint CH2, 0 = auto
+    {"CH", cmdChEnable1},       // CH1 enable 0/1/A
+    {"H2", cmdChEnable2},       // CH2 enable 0/1/A
+    {"HW", cmdDhwEnable},       // DHW enable 0/1/A
+    {"MM", cmdMaxModulation},   // max. relative modulation
+    {"VS", cmdVentSetpoint},    // ventilation setpoint
+    {"PS", cmdPrintSummary},    // 1 suppresses OT message reporting
+    {"PR", cmdPrintReport}      // print report, A: about
+};
+
 void handleNewClient(void* arg, AsyncClient* client) {
     command.onNewClient(arg, client);
 }
@@ -13,6 +192,10 @@ void handleClientData(void* arg, AsyncClient* client, void *data, size_t len) {
     command.onClientData(arg, client, data, len);
 }
 
+void handleClientAck(void* arg, AsyncClient* client, size_t, uint32_t) {
+    command.onClientAck(arg, client);
+}
+
 void handleClientDisconnect(void* arg, AsyncClient* client) {
     command.onClientDisconnect(arg, client);
 }
@@ -21,106 +204,297 @@ OtGwCommand::OtGwCommand():
         enableOtEvents(true),
         server(25238) {
     server.onClient(&handleNewClient, &server);
+    mutex = xSemaphoreCreateMutex();
 }
 
-void OtGwCommand::onNewClient(void* arg, AsyncClient* client) {
-    clients.push_back(client);
-    client->onData(&handleClientData, NULL);
-    client->onDisconnect(&handleClientDisconnect, NULL);
+static const char* cmdPrintSummary(const char *val, char *resp, const size_t respSize) {
+    if ((strcmp(val, "0") != 0) && (strcmp(val, "1") != 0))
+        return ERR_BV;
+    command.setOtEvents(val[0] == '0');
+    strlcpy(resp, val, respSize);
+    return nullptr;
 }
 
-void OtGwCommand::onClientData(void* arg, AsyncClient* client, void *data, size_t len) {
-    char *s = (char*) data;
-    s[len - 1] = 0;
-    Serial.println(s);
+/**
+ * Closes a connection which isn't accepted, the client is deleted by its disconnect callback
+ */
+static void rejectClient(AsyncClient* client) {
+    client->onDisconnect([](void*, AsyncClient *c) {
+        delete c;
+    }, nullptr);
+    client->close(true);
 }
 
-void OtGwCommand::onClientDisconnect(void* arg, AsyncClient* client) {
+void OtGwCommand::onNewClient(void*, AsyncClient* client) {
+    ClientCtx *ctx;
+    {
+        CmdLock lock(mutex);
+        if (!lock) {
+            rejectClient(client);
+            return;
+        }
+        reapClients();
+        if (clients.size() >= CMD_MAX_CLIENTS) {
+            // each client takes an output buffer of CMD_CLIENT_BUF_SIZE
+            rejectedClients++;
+            rejectClient(client);
+            return;
+        }
+        ctx = new ClientCtx;
+        ctx->client = client;
+        clients.push_back(ctx);
+    }
+    client->onData(&handleClientData, ctx);
+    client->onAck(&handleClientAck, ctx);
+    client->onDisconnect(&handleClientDisconnect, ctx);
 }
 
-void OtGwCommand::begin() {
-    server.begin();
+/**
+ * Splits TCP segments into lines. Complete lines are parsed in place, only a partial line at
+ * the end of a segment is kept until the next segment arrives.
+ */
+void OtGwCommand::onClientData(void* arg, AsyncClient*, void *data, size_t len) {
+    ClientCtx *ctx = (ClientCtx*) arg;
+    const char *p = (const char*) data;
+    const char *end = p + len;
+
+    while (p < end) {
+        const char *eol = p;
+        while ((eol < end) && (*eol != '\r') && (*eol != '\n'))
+            eol++;
+        const size_t n = eol - p;
+
+        if (eol == end) {
+            // partial line, keep for next segment
+            if (ctx->lineLen + n > sizeof(ctx->line))
+                ctx->overflow = true;
+            else {
+                memcpy(ctx->line + ctx->lineLen, p, n);
+                ctx->lineLen += n;
+            }
+            break;
+        }
+
+        if (ctx->overflow)
+            reply(ctx, ERR_SE);
+        else if (ctx->lineLen > 0) {
+            if (ctx->lineLen + n > sizeof(ctx->line))
+                reply(ctx, ERR_SE);
+            else {
+                memcpy(ctx->line + ctx->lineLen, p, n);
+                onLine(ctx, ctx->line, ctx->lineLen + n);
+            }
+        }
+        else if (n > 0)
+            onLine(ctx, p, n);
+
+        ctx->lineLen = 0;
+        ctx->overflow = false;
+        p = eol + 1;
+    }
 }
 
-void OtGwCommand::sendAll(String s) {
-    s += F("\r\n");
-    for (auto client: clients)
-        client->write(s.c_str());
-    Serial.print(s);
+/**
+ * Executes an OTGW command line "XX=value", which isn't null terminated
+ */
+void OtGwCommand::onLine(ClientCtx *ctx, const char *line, const size_t len) {
+    char resp[48];
+    char val[CMD_LINE_MAX];
+    const char *err = ERR_SE;
+
+    if ((len >= 3) && (line[2] == '=') && (len - 3 < sizeof(val))) {
+        const char code[3] = {(char) toupper(line[0]), (char) toupper(line[1]), 0};
+        memcpy(val, line + 3, len - 3);
+        val[len - 3] = 0;
+
+        err = ERR_NG;
+        for (const auto &cmd: cmdTable) {
+            if (strcmp(cmd.code, code) == 0) {
+                const int n = snprintf(resp, sizeof(resp), "%s: ", code);
+                err = cmd.handler(val, resp + n, sizeof(resp) - n);
+                break;
+            }
+        }
+    }
+
+    reply(ctx, (err != nullptr) ? err : resp);
+}
 
-#ifdef DEBUG
-if (bleClientConnected && bleSerialTx) {
-    bleSerialTx->setValue(s.c_str());
-    bleSerialTx->notify();
+void OtGwCommand::reply(ClientCtx *ctx, const char *str) {
+    CmdLock lock(mutex);
+    if (!lock || ctx->dead)
+        return;
+    enqueue(ctx, str, strlen(str));
+    flush(ctx);
 }
-#endif
+
+/**
+ * Appends a line terminated by CRLF to the client's output buffer, drops it if the client fell behind.
+ * Has to be called with mutex taken.
+ */
+void OtGwCommand::enqueue(ClientCtx *ctx, const char *data, const size_t len) {
+    if (len + 2 > CMD_CLIENT_BUF_SIZE - ctx->outLen) {
+        ctx->dropped++;
+        droppedLines++;
+        return;
+    }
+    size_t tail = (ctx->outHead + ctx->outLen) % CMD_CLIENT_BUF_SIZE;
+    const size_t first = std::min(len, CMD_CLIENT_BUF_SIZE - tail);
+    memcpy(ctx->out + tail, data, first);
+    memcpy(ctx->out, data + first, len - first);
+    tail = (tail + len) % CMD_CLIENT_BUF_SIZE;
+    ctx->out[tail] = '\r';
+    ctx->out[(tail + 1) % CMD_CLIENT_BUF_SIZE] = '\n';
+    ctx->outLen += len + 2;
 }
 
-void OtGwCommand::sendOtEvent(const char source, const uint32_t data) {
-    String line(source);
-    int pos = 28;
-    while (pos > 0) {
-        pos -= 4;
-        if (((data>>pos) & 0xF0) != 0)
+/**
+ * Hands buffered output to TCP as far as the send window allows.
+ * Has to be called with mutex taken.
+ */
+void OtGwCommand::flush(ClientCtx *ctx) {
+    bool added = false;
+    while (ctx->outLen > 0) {
+        const size_t space = ctx->client->space();
+        const size_t chunk = std::min({ctx->outLen, CMD_CLIENT_BUF_SIZE - ctx->outHead, space});
+        if (chunk == 0)
+            break;
+        const size_t n = ctx->client->add(ctx->out + ctx->outHead, chunk);
+        if (n == 0)
             break;
+        ctx->outHead = (ctx->outHead + n) % CMD_CLIENT_BUF_SIZE;
+        ctx->outLen -= n;
+        added = true;
+    }
+    if (added)
+        ctx->client->send();
+}
+
+void OtGwCommand::onClientAck(void* arg, AsyncClient*) {
+    ClientCtx *ctx = (ClientCtx*) arg;
+    CmdLock lock(mutex);
+    if (lock && !ctx->dead)
+        flush(ctx);
+}
+
+/**
+ * Only marks the client, it's removed by reapClients() with mutex taken. Waiting for the mutex
+ * here could time out and leave a context pointing to a deleted client.
+ */
+void OtGwCommand::onClientDisconnect(void* arg, AsyncClient*) {
+    ((ClientCtx*) arg)->dead = true;
+}
 
-        line += '0';
+/**
+ * Deletes disconnected clients and their contexts. Has to be called with mutex taken.
+ */
+void OtGwCommand::reapClients() {
+    for (auto it = clients.begin(); it != clients.end(); ) {
+        ClientCtx *ctx = *it;
+        if (ctx->dead) {
+            it = clients.erase(it);
+            delete ctx->client;
+            delete ctx;
+        }
+        else
+            it++;
     }
-    line += String(data, HEX);
+}
+
+void OtGwCommand::setOtEvents(const bool en) {
+    enableOtEvents = en;
+}
 
-    if (enableOtEvents)
-        sendAll(line);
+void OtGwCommand::getJson(JsonObject &obj) {
+    CmdLock lock(mutex);
+    if (!lock)
+        return;
+    obj[F("clients")] = std::count_if(clients.begin(), clients.end(), [](const ClientCtx *ctx) {
+        return !ctx->dead;
+    });
+    obj[F("dropped")] = droppedLines;
+    obj[F("rejected")] = rejectedClients;
+}
 
-    auto mt = OpenTherm::getMessageType(data);
-    auto id = OpenTherm::getDataID(data);
+void OtGwCommand::begin() {
+    server.begin();
+}
+
+/**
+ * Sends a line to all command port clients, called by the log sink task
+ */
+void OtGwCommand::writeClients(const char *text, const size_t len) {
+    CmdLock lock(mutex);
+    if (!lock)
+        return;
+    for (auto *ctx: clients) {
+        if (ctx->dead)
+            continue;
+        enqueue(ctx, text, len);
+        flush(ctx);
+    }
+}
 
-    line += ' ';
-    switch (mt) {
+void OtGwCommand::sendOtEvent(const char source, const uint32_t data) {
+    uint8_t targets = LogSink::TARGET_SERIAL | LogSink::TARGET_TCP | LogSink::TARGET_BLE;
+    if (eventlog.enabled(LOGMOD_OT, LOGLVL_DEBUG)) {
+        // decoded frame goes to Serial and the web console, so Serial doesn't get the raw line as well
+        eventlog.add(LOGMOD_OT, LOGLVL_DEBUG, LOGMSG_OT_FRAME, source, data);
+        targets &= ~LogSink::TARGET_SERIAL;
+    }
+
+    if (enableOtEvents) {
+        char line[12];
+        const int n = snprintf(line, sizeof(line), "%c%08lx", source, (unsigned long) data);
+        logsink.write(targets, line, n);
+    }
+}
+
+/**
+ * Formats an OT frame as raw OTGW line followed by message type, data id name and value
+ * @return length of text
+ */
+size_t OtGwCommand::formatOtEvent(char *buf, const size_t size, const char source, const uint32_t data) {
+    const char *type;
+    switch (OpenTherm::getMessageType(data)) {
     case OpenThermMessageType::READ_DATA:
-        line += F("READ");
+        type = PSTR("READ");
         break;
     case OpenThermMessageType::WRITE_DATA:
-        line += F("WRITE");
+        type = PSTR("WRITE");
         break;
     case OpenThermMessageType::INVALID_DATA:
-        line += F("INVALID_DATA");
+        type = PSTR("INVALID_DATA");
         break;
     case OpenThermMessageType::READ_ACK:
-        line += F("READ_ACK");
+        type = PSTR("READ_ACK");
         break;
     case OpenThermMessageType::WRITE_ACK:
-        line += F("WRITE_ACK");
+        type = PSTR("WRITE_ACK");
         break;
     case OpenThermMessageType::DATA_INVALID:
-        line += F("DATA_INVALID");
+        type = PSTR("DATA_INVALID");
         break;
     case OpenThermMessageType::UNKNOWN_DATA_ID:
-        line += F("UKNOWN_ID");
+        type = PSTR("UKNOWN_ID");
         break;
     default:
+        type = "";
         break;
     }
 
+    const auto id = OpenTherm::getDataID(data);
     const char *name = getOTname(id);
-    line += ' ';
+    int n;
     if (name != nullptr)
-        line += FPSTR(name);
-    else {
-        line += F("ID ");
-        line += String((int) id);
-    }
-    line += F(" 0x");
-    uint16_t mask = 0xF000;
-    while (mask > 0x000F) {
-        if ((data & mask) == 0)
-            line += '0';
-        else
-            break;
-        mask >>= 4;
-    }
-    line += String(data & 0xFFFF, HEX);
-    portal.textAll(line);
+        n = snprintf(buf, size, "%c%08lx %s %s 0x%04lx", source, (unsigned long) data, type, name, (unsigned long) (data & 0xFFFF));
+    else
+        n = snprintf(buf, size, "%c%08lx %s ID %d 0x%04lx", source, (unsigned long) data, type, (int) id, (unsigned long) (data & 0xFFFF));
+    return std::min((size_t) std::max(n, 0), size - 1);
 }
 
 void OtGwCommand::loop() {
+    CmdLock lock(mutex);
+    if (lock)
+        reapClients();
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <ESPmDNS.h>
+#include <rom/crc.h>
 #include "devconfig.h"
 #include "mqtt.h"
 #include "otcontrol.h"
@@ -8,6 +9,80 @@
 #include <HADiscovery.h>
 
 const char CFG_FILENAME[] PROGMEM = "/config.json";
+static const char CFG_TMPNAME[] PROGMEM = "/config.tmp";
+const uint32_t CFG_UPLOAD_TIMEOUT = 10000; // ms, an unfinished upload older than this is replaced by a new one
+
+enum CfgType: uint8_t {
+    CFG_STRING,
+    CFG_INT,
+    CFG_NUMBER,
+    CFG_BOOL,
+    CFG_OBJECT,
+    CFG_ARRAY
+};
+
+struct CfgKey {
+    const char *key;
+    CfgType type;
+};
+
+// expected types of top level keys, unknown keys are accepted as they are
+static const CfgKey cfgSchema[] = {
+    {"ble",             CFG_OBJECT},
+    {"boiler",          CFG_OBJECT},
+    {"enableSlave",     CFG_BOOL},
+    {"haPrefix",        CFG_STRING},
+    {"heating",         CFG_ARRAY},
+    {"hostname",        CFG_STRING},
+    {"masterMemberId",  CFG_INT},
+    {"mqtt",            CFG_OBJECT},
+    {"otMode",          CFG_INT},
+    {"outsideTemp",     CFG_OBJECT},
+    {"slaveApp",        CFG_INT},
+    {"timezone",        CFG_INT},
+    {"vent",            CFG_OBJECT}
+};
+
+static const CfgKey bleSchema[] = {
+    {"allow",           CFG_ARRAY}
+};
+
+static const CfgKey mqttSchema[] = {
+    {"caCert",          CFG_STRING},
+    {"host",            CFG_STRING},
+    {"keepAlive",       CFG_INT},
+    {"pass",            CFG_STRING},
+    {"port",            CFG_INT},
+    {"tls",             CFG_BOOL},
+    {"user",            CFG_STRING}
+};
+
+// a sensor input, see Sensor::setConfig(), the fallbacks have the same keys
+static const CfgKey sensorSchema[] = {
+    {"adr",             CFG_STRING},
+    {"fallback",        CFG_ARRAY},
+    {"filter",          CFG_OBJECT},
+    {"maxAge",          CFG_INT},
+    {"res",             CFG_INT},
+    {"source",          CFG_INT}
+};
+
+static const CfgKey filterSchema[] = {
+    {"alpha",           CFG_NUMBER},
+    {"n",               CFG_INT},
+    {"rate",            CFG_NUMBER},
+    {"type",            CFG_STRING}
+};
+
+// OpenWeather settings of the outside temperature sensor
+static const CfgKey outsideTempSchema[] = {
+    {"apikey",          CFG_STRING},
+    {"host",            CFG_STRING},
+    {"interval",        CFG_INT},
+    {"lat",             CFG_NUMBER},
+    {"lon",             CFG_NUMBER},
+    {"port",            CFG_INT}
+};
 
 DevConfig devconfig;
 extern bool configMode;
@@ -37,9 +112,33 @@ void DevConfig::begin() {
         Serial.printf("LittleFS mounted: total=%u used=%u\n", (unsigned) LittleFS.totalBytes(), (unsigned) LittleFS.usedBytes());
     else
         Serial.println("LittleFS mount failed; running without persisted config.");
+    updateETag();
     update();
 }
 
+void DevConfig::updateETag() {
+    etag.clear();
+    File f = getFile();
+    if (!f)
+        return;
+
+    uint32_t crc = 0;
+    uint8_t buf[128];
+    size_t len;
+    while ((len = f.read(buf, sizeof(buf))) > 0)
+        crc = crc32_le(crc, buf, len);
+    f.close();
+
+    char str[11];
+    snprintf(str, sizeof(str), "\"%08lx\"", (unsigned long) crc);
+    etag = str;
+}
+
+/**
+ * Applies the config file. Only sections which differ from the previously
+ * applied config are passed on, so saving an unrelated setting doesn't
+ * reconnect MQTT or reset the OpenTherm interface.
+ */
 void DevConfig::update() {
     if (!fsOk)
         return;
@@ -47,6 +146,12 @@ void DevConfig::update() {
     if (f) {
         JsonDocument doc;
         deserializeJson(doc, f);
+        f.close();
+
+        const bool all = applied.isNull();
+        auto changed = [&](JsonVariantConst cur, JsonVariantConst prev) {
+            return all || (cur != prev);
+        };
 
         if (doc[F("hostname")].is<String>())
             hostname = doc[F("hostname")].as<String>();
@@ -59,41 +164,108 @@ void DevConfig::update() {
         if (hostname.isEmpty())
             hostname = F(HOSTNAME);
 
-        if (WiFi.isConnected()) {
+        if (WiFi.isConnected() && changed(doc[F("hostname")], applied[F("hostname")])) {
             WiFi.setHostname(hostname.c_str());
             MDNS.begin(hostname);
         }
 
-        if (doc[F("mqtt")].is<JsonObject>()) {
+        if (doc[F("mqtt")].is<JsonObject>() && changed(doc[F("mqtt")], applied[F("mqtt")])) {
             MqttConfig mc;
             const JsonObject &jobj = doc[F("mqtt")].as<JsonObject>();
             mc.host = jobj[F("host")].as<String>();
             mc.port = jobj[F("port")].as<uint16_t>();
             mc.tls = jobj[F("tls")].as<bool>();
+            mc.caCert = jobj[F("caCert")] | "";
             mc.user = jobj[F("user")].as<String>();
             mc.pass = jobj[F("pass")].as<String>();
             mc.keepAlive = jobj[F("keepAlive")] | 15;
             mqtt.setConfig(mc);
         }
 
-        if (doc[F("outsideTemp")].is<JsonObject>()) {
+        if (changed(doc[F("ble")][F("allow")], applied[F("ble")][F("allow")]))
+            BLESensor::setAllowList(doc[F("ble")][F("allow")].as<JsonArrayConst>());
+
+        if (doc[F("outsideTemp")].is<JsonObject>() && changed(doc[F("outsideTemp")], applied[F("outsideTemp")])) {
             JsonObject obj = doc[F("outsideTemp")];
             outsideTemp.setConfig(obj);
         }
 
         for (int i=0; i<2; i++) {
             JsonObject obj = doc[F("heating")][i][F("roomtemp")];
-            roomTemp[i].setConfig(obj);
+            if (changed(obj, applied[F("heating")][i][F("roomtemp")]))
+                roomTemp[i].setConfig(obj);
 
             JsonObject obj2 = doc[F("heating")][i][F("roomsetpoint")];
-            roomSetPoint[i].setConfig(obj2);
+            if (changed(obj2, applied[F("heating")][i][F("roomsetpoint")]))
+                roomSetPoint[i].setConfig(obj2);
         }
 
-        JsonObject cfg = doc.as<JsonObject>();
-        otcontrol.setConfig(cfg);
+        otcontrol.setConfig(doc.as<JsonObjectConst>(), applied.as<JsonObjectConst>());
+
+        // the MQTT client isn't restarted by these, so discovery has to be refreshed explicitly
+        if ( changed(doc[F("haPrefix")], applied[F("haPrefix")]) ||
+             changed(doc[F("slaveApp")], applied[F("slaveApp")]) ||
+             changed(doc[F("outsideTemp")], applied[F("outsideTemp")]) ||
+             changed(doc[F("heating")], applied[F("heating")]) ||
+             changed(doc[F("ble")][F("allow")], applied[F("ble")][F("allow")]) )
+            mqtt.refreshDiscovery();
+
+        applied = std::move(doc);
+    }
+}
+
+/**
+ * Merges a partial config into the config file (RFC 7396 style): objects
+ * are merged, null removes a key, everything else replaces.
+ * @return HTTP status, err is set on failure
+ */
+int DevConfig::patch(JsonDocument &patchDoc, String &err) {
+    if (!patchDoc.is<JsonObject>()) {
+        err = F("not a JSON object");
+        return 400;
+    }
 
+    JsonDocument doc;
+    File f = getFile();
+    if (f) {
+        deserializeJson(doc, f);
         f.close();
     }
+    if (!doc.is<JsonObject>())
+        doc.to<JsonObject>();
+
+    merge(doc.as<JsonObject>(), patchDoc.as<JsonObjectConst>());
+    if (!validate(doc, err))
+        return 400;
+
+    File tmp = LittleFS.open(FPSTR(CFG_TMPNAME), "w");
+    if (!tmp) {
+        err = F("can't create file");
+        return 507;
+    }
+    const size_t len = measureJson(doc);
+    const bool ok = serializeJson(doc, tmp) == len;
+    tmp.close();
+    if (!ok) {
+        LittleFS.remove(FPSTR(CFG_TMPNAME));
+        err = F("write failed");
+        return 507;
+    }
+    return activate(err);
+}
+
+void DevConfig::merge(JsonObject dst, JsonObjectConst src) {
+    for (JsonPairConst kv: src) {
+        if (kv.value().isNull())
+            dst.remove(kv.key());
+        else if (kv.value().is<JsonObjectConst>()) {
+            if (!dst[kv.key()].is<JsonObject>())
+                dst[kv.key()].to<JsonObject>();
+            merge(dst[kv.key()].as<JsonObject>(), kv.value().as<JsonObjectConst>());
+        }
+        else
+            dst[kv.key()] = kv.value();
+    }
 }
 
 File DevConfig::getFile() {
@@ -102,16 +274,287 @@ File DevConfig::getFile() {
     return LittleFS.open(FPSTR(CFG_FILENAME), "r");
 }
 
-void DevConfig::write(String &str) {
-    File f = LittleFS.open(FPSTR(CFG_FILENAME), "w");
-    f.write((uint8_t *) str.c_str(), str.length());
+/**
+ * Receives an uploaded config or patch in chunks. The data is streamed into a
+ * temporary file, the config is replaced only after it was completely
+ * received and validated, the old config stays in place otherwise.
+ * Only one upload is accepted at a time.
+ * @param id identifies the upload, set with the first chunk, the caller has to pass it with the following chunks
+ * @return 0 while more data is expected, else HTTP status to reply with
+ */
+int DevConfig::receive(uint32_t &id, const UploadMode mode, const uint8_t *data, const size_t len, const size_t index, const size_t total, String &err) {
+    if (index == 0) {
+        // an upload whose client went away is taken over after a timeout
+        if ( (uploadState == UPLOAD_ACTIVE) && ((millis() - uploadStart) < CFG_UPLOAD_TIMEOUT) ) {
+            id = 0;
+            err = F("upload in progress");
+            return 409;
+        }
+        if (upload)
+            upload.close();
+        uploadState = UPLOAD_FAILED;
+        // unlike the request's address, an id isn't reused by a later request
+        if (++lastUploadId == 0)
+            lastUploadId = 1;
+        uploadId = lastUploadId;
+        id = uploadId;
+
+        if (!fsOk) {
+            err = F("no filesystem");
+            return 503;
+        }
+        if (total > CFG_MAX_SIZE) {
+            err = F("config too large");
+            return 413;
+        }
+        upload = LittleFS.open(FPSTR(CFG_TMPNAME), "w");
+        if (!upload) {
+            err = F("can't create file");
+            return 507;
+        }
+        uploadState = UPLOAD_ACTIVE;
+        uploadStart = millis();
+    }
+
+    if ((uploadState != UPLOAD_ACTIVE) || (id != uploadId))
+        return 0; // already answered, discard the rest
+
+    if (upload.write(data, len) != len) {
+        upload.close();
+        LittleFS.remove(FPSTR(CFG_TMPNAME));
+        uploadState = UPLOAD_FAILED;
+        err = F("write failed");
+        return 507;
+    }
+
+    if (index + len < total)
+        return 0;
+
+    upload.close();
+    uploadState = UPLOAD_IDLE;
+
+    File f = LittleFS.open(FPSTR(CFG_TMPNAME), "r");
+    JsonDocument doc;
+    DeserializationError de = deserializeJson(doc, f, DeserializationOption::NestingLimit(8));
     f.close();
+    if (de)
+        err = de.c_str();
+
+    if (mode == UPLOAD_PATCH) {
+        LittleFS.remove(FPSTR(CFG_TMPNAME));
+        return de ? 400 : patch(doc, err);
+    }
+
+    if (de || !validate(doc, err)) {
+        LittleFS.remove(FPSTR(CFG_TMPNAME));
+        return 400;
+    }
+    return activate(err);
+}
+
+/**
+ * Replaces the config file with the validated temporary file
+ */
+int DevConfig::activate(String &err) {
+    // LittleFS replaces an existing target atomically
+    if (!LittleFS.rename(FPSTR(CFG_TMPNAME), FPSTR(CFG_FILENAME))) {
+        LittleFS.remove(FPSTR(CFG_TMPNAME));
+        err = F("rename failed");
+        return 500;
+    }
+    updateETag();
     writeBufFlag = true;
+    return 200;
+}
+
+/**
+ * Checks the types of the keys of obj listed in schema, path prefixes the key in err
+ */
+template<size_t N>
+static bool checkTypes(JsonObjectConst obj, const CfgKey (&schema)[N], const String &path, String &err) {
+    for (auto &entry: schema) {
+        JsonVariantConst v = obj[entry.key];
+        if (v.isNull())
+            continue;
+
+        bool ok;
+        switch (entry.type) {
+        case CFG_STRING:
+            ok = v.is<const char*>();
+            break;
+        case CFG_INT:
+            ok = v.is<JsonInteger>();
+            break;
+        case CFG_NUMBER:
+            ok = v.is<double>();
+            break;
+        case CFG_BOOL:
+            ok = v.is<bool>();
+            break;
+        case CFG_OBJECT:
+            ok = v.is<JsonObjectConst>();
+            break;
+        case CFG_ARRAY:
+            ok = v.is<JsonArrayConst>();
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok) {
+            err = path + entry.key;
+            err += F(": wrong type");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks the range of a number whose type has already been checked, a missing key is accepted
+ */
+static bool checkRange(JsonObjectConst obj, const char *key, const double min, const double max, const String &path, String &err) {
+    JsonVariantConst v = obj[key];
+    if (v.isNull() || ((v.as<double>() >= min) && (v.as<double>() <= max)))
+        return true;
+    err = path + key;
+    err += F(": out of range");
+    return false;
+}
+
+/**
+ * Checks an object that has to have the type of its key checked before, a missing one is accepted
+ */
+static bool checkObject(JsonVariantConst v, const String &path, String &err) {
+    if (v.isNull() || v.is<JsonObjectConst>())
+        return true;
+    err = path;
+    err += F(": wrong type");
+    return false;
+}
+
+static bool checkSensorInput(JsonObjectConst in, const String &path, String &err) {
+    if (!checkTypes(in, sensorSchema, path, err) ||
+        !checkTypes(in[F("filter")], filterSchema, path + F("filter."), err) )
+        return false;
+
+    if (!checkRange(in, "source", Sensor::SOURCE_NA, Sensor::SOURCE_AUTO, path, err) ||
+        !checkRange(in, "maxAge", 0, UINT32_MAX / 1000, path, err) ||
+        !checkRange(in, "res", 9, 12, path, err) ||
+        !checkRange(in[F("filter")], "n", 1, SensorFilter::MEDIAN_MAX, path + F("filter."), err) ||
+        !checkRange(in[F("filter")], "alpha", 0.01, 1.0, path + F("filter."), err) ||
+        !checkRange(in[F("filter")], "rate", 0, INFINITY, path + F("filter."), err) )
+        return false;
+
+    // an empty address is left for the user to select one later
+    const char *adr = in[F("adr")] | "";
+    const int src = in[F("source")] | (int) Sensor::SOURCE_NA;
+    uint8_t buf[8];
+    if ( (adr[0] != 0) &&
+         ( ((src == Sensor::SOURCE_BLE) && !AddressableSensor::parseAdr(adr, buf, 6)) ||
+           ((src == Sensor::SOURCE_1WIRE) && !AddressableSensor::parseAdr(adr, buf, 8)) ) ) {
+        err = path;
+        err += F("adr: invalid address");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Checks a sensor config with its fallback inputs
+ */
+static bool checkSensor(JsonVariantConst v, const String &path, String &err) {
+    if (!checkObject(v, path, err))
+        return false;
+    if (v.isNull())
+        return true;
+
+    const String prefix = path + '.';
+    if (!checkSensorInput(v, prefix, err))
+        return false;
+
+    JsonArrayConst fallback = v[F("fallback")];
+    if (fallback.size() >= Sensor::MAX_INPUTS) {
+        err = prefix;
+        err += F("fallback: too many inputs");
+        return false;
+    }
+    int i = 0;
+    for (JsonVariantConst fb: fallback) {
+        const String fbPath = prefix + F("fallback.") + i++;
+        if (!fb.is<JsonObjectConst>()) {
+            err = fbPath;
+            err += F(": wrong type");
+            return false;
+        }
+        if (!checkSensorInput(fb, fbPath + '.', err))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Checks types and ranges of known config keys, so that a config is rejected before
+ * it replaces the current one instead of being partly applied
+ */
+bool DevConfig::validate(JsonVariantConst doc, String &err) {
+    if (!doc.is<JsonObjectConst>()) {
+        err = F("not a JSON object");
+        return false;
+    }
+    if (!checkTypes(doc, cfgSchema, String(), err))
+        return false;
+
+    JsonArrayConst heating = doc[F("heating")];
+    if (heating.size() > NUM_HEATCIRCUITS) {
+        err = F("heating: too many circuits");
+        return false;
+    }
+    int i = 0;
+    for (JsonVariantConst hc: heating) {
+        const String path = String(F("heating.")) + i++;
+        if (!checkObject(hc, path, err) ||
+            !checkSensor(hc[F("roomtemp")], path + F(".roomtemp"), err) ||
+            !checkSensor(hc[F("roomsetpoint")], path + F(".roomsetpoint"), err) )
+            return false;
+    }
+
+    JsonVariantConst outside = doc[F("outsideTemp")];
+    if (!checkSensor(outside, F("outsideTemp"), err) ||
+        !checkTypes(outside, outsideTempSchema, F("outsideTemp."), err) ||
+        !checkRange(outside, "interval", 0, UINT16_MAX, F("outsideTemp."), err) ||
+        !checkRange(outside, "lat", -90, 90, F("outsideTemp."), err) ||
+        !checkRange(outside, "lon", -180, 180, F("outsideTemp."), err) ||
+        !checkRange(outside, "port", 1, UINT16_MAX, F("outsideTemp."), err) )
+        return false;
+
+    JsonObjectConst ble = doc[F("ble")];
+    if (!checkTypes(ble, bleSchema, F("ble."), err))
+        return false;
+    JsonArrayConst allow = ble[F("allow")];
+    if (allow.size() > BLE_MAX_SENSORS) {
+        err = F("ble.allow: too many addresses");
+        return false;
+    }
+    for (JsonVariantConst adr: allow) {
+        uint8_t buf[6];
+        if (!adr.is<const char*>() || !AddressableSensor::parseAdr(adr, buf, sizeof(buf))) {
+            err = F("ble.allow: invalid address");
+            return false;
+        }
+    }
+
+    JsonObjectConst mc = doc[F("mqtt")];
+    if (!checkTypes(mc, mqttSchema, F("mqtt."), err) ||
+        !checkRange(mc, "port", 1, UINT16_MAX, F("mqtt."), err) ||
+        !checkRange(mc, "keepAlive", 0, UINT16_MAX, F("mqtt."), err) )
+        return false;
+    return true;
 }
 
 void DevConfig::remove() {
     if (fsOk)
         LittleFS.remove(FPSTR(CFG_FILENAME));
+    etag.clear();
 }
 
 void DevConfig::loop() {
@@ -127,4 +570,8 @@ String DevConfig::getHostname() const {
 
 int DevConfig::getTimezone() const {
     return timezone;
+}
+
+String DevConfig::getETag() const {
+    return etag;
 }
\ No newline at end of file
@@ -5,12 +5,16 @@
 #include "otcontrol.h"
 #include "sensors.h"
 #include "httpUpdate.h"
+#include "command.h"
+#include "logsink.h"
 #include <NimBLEDevice.h>
 #ifdef NODO
 #include <EthernetESP32.h>
 #endif
 DevStatus devstatus;
 
+const uint32_t LOOP_WINDOW = 60000; // ms, window for recent max. loop time
+
 class DevStatusLock: public SemHelper {
 public:
     DevStatusLock(): SemHelper(devstatus.mutex, 100) {
@@ -31,6 +35,19 @@ void DevStatus::unlock() {
     xSemaphoreGive(mutex);
 }
 
+/**
+ * Records duration of one main loop iteration
+ */
+void DevStatus::loopTime(const uint32_t us) {
+    loopMax = std::max(loopMax, us);
+    loopMaxWindow = std::max(loopMaxWindow, us);
+    if ((millis() - loopWindowStart) >= LOOP_WINDOW) {
+        loopMaxLast = loopMaxWindow;
+        loopMaxWindow = 0;
+        loopWindowStart = millis();
+    }
+}
+
  void DevStatus::buildDoc(JsonDocument &doc) {
     doc.clear();
     doc[F("runtime")] = millis() / 1000UL;
@@ -42,6 +59,10 @@ void DevStatus::unlock() {
     doc[F("reset_reason0")] = rtc_get_reset_reason(0);
     doc[F("numWifiDisc")] = numWifiDiscon;
 
+    JsonObject jloop = doc[F("loop")].to<JsonObject>();
+    jloop[F("maxTime")] = loopMax;
+    jloop[F("maxTimeRecent")] = std::max(loopMaxLast, loopMaxWindow);
+
     String newFw;
     if (httpupdate.getNewFw(newFw))
         doc[F("new_fw")] = newFw;
@@ -71,6 +92,14 @@ void DevStatus::unlock() {
     jmqtt[F("connected")] = mqtt.connected();
     jmqtt[F("basetopic")] = mqtt.getBaseTopic();
     jmqtt[F("numDisc")] = mqtt.getNumDisc();
+    mqtt.getDiscStatus(jmqtt);
+    mqtt.getTelemStatus(jmqtt);
+
+    JsonObject jcmd = doc[F("otgwCmd")].to<JsonObject>();
+    command.getJson(jcmd);
+
+    JsonObject jlog = doc[F("log")].to<JsonObject>();
+    logsink.getJson(jlog);
 
     JsonObject jot = doc.as<JsonObject>();
     otcontrol.getJson(jot);
@@ -87,8 +116,14 @@ void DevStatus::unlock() {
     JsonObject jo = doc[F("1wire")].to<JsonObject>();
     OneWireNode::writeJsonAll(jo);
 
+    JsonObject jos = doc[F("1wireStats")].to<JsonObject>();
+    OneWireNode::getStats(jos);
+
     JsonObject ble = doc[F("BLE")].to<JsonObject>();
     BLESensor::writeJsonAll(ble);
+
+    JsonObject bles = doc[F("BLEStats")].to<JsonObject>();
+    BLESensor::getStats(bles);
 #ifdef NODO
     }
 #endif
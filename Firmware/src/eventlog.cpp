@@ -0,0 +1,195 @@
+#include "eventlog.h"
+#include "logsink.h"
+#include "command.h"
+#include "mqtt.h"
+
+EventLog eventlog;
+
+static const char *MODULE_NAMES[NUM_LOGMOD] PROGMEM = {
+    "sys",
+    "ot",
+    "mqtt",
+    "sensor"
+};
+
+static const char *LEVEL_NAMES[] PROGMEM = {
+    "error",
+    "warn",
+    "info",
+    "debug"
+};
+
+/**
+ * Format strings of the messages. Conversions consume the record's args:
+ * %d int, %x hex, %f float packed by packFloat(), %t MQTT topic id,
+ * %s up to 8 chars packed by packStr() (2 args), %o OT frame source and data (2 args)
+ */
+static const char *MSG_FORMATS[NUM_LOGMSG] PROGMEM = {
+    "%o",                       // LOGMSG_OT_FRAME
+    "RX master timeout",        // LOGMSG_RX_MASTER_TIMEOUT
+    "RX master invalid: 0x%x",  // LOGMSG_RX_MASTER_INVALID
+    "RX slave invalid: 0x%x",   // LOGMSG_RX_SLAVE_INVALID
+    "no slave val! ID %d",      // LOGMSG_NO_SLAVE_VAL
+    "T no otval! ID %d",        // LOGMSG_NO_THERMOSTAT_VAL
+    "MQTT connected",           // LOGMSG_MQTT_CONNECTED
+    "MQTT connected (TLS)",     // LOGMSG_MQTT_CONNECTED_TLS
+    "MQTT disconnected %d",     // LOGMSG_MQTT_DISCONNECTED
+    "MQTT: %t %s",              // LOGMSG_MQTT_CMD
+    "log level %s",             // LOGMSG_LOG_LEVEL
+    "bus busy for %d ms, config still pending", // LOGMSG_CONFIG_DELAYED
+    "HA discovery too large: %s" // LOGMSG_DISC_OVERFLOW
+};
+
+EventLog::EventLog() {
+    for (auto &level: levels)
+        level = LOGLVL_INFO;
+}
+
+bool EventLog::enabled(const LogModule module, const LogLevel level) const {
+    return level <= levels[module];
+}
+
+/**
+ * Stores a record and passes it to the live outputs, callable from any task
+ */
+void EventLog::add(const LogModule module, const LogLevel level, const LogMsg msg, const int32_t a0, const int32_t a1, const int32_t a2) {
+    if (!enabled(module, level))
+        return;
+
+    Record rec = {(uint32_t) millis(), module, level, msg, {a0, a1, a2}};
+    portENTER_CRITICAL(&mux);
+    ring[head] = rec;
+    head = (head + 1) % NUM_RECORDS;
+    if (count < NUM_RECORDS)
+        count++;
+    portEXIT_CRITICAL(&mux);
+
+    logsink.write(LogSink::TARGET_SERIAL | LogSink::TARGET_WS, rec);
+}
+
+int32_t EventLog::packFloat(const float f) {
+    int32_t i;
+    memcpy(&i, &f, sizeof(i));
+    return i;
+}
+
+void EventLog::packStr(const char *str, int32_t &a0, int32_t &a1) {
+    char buf[9] = {0}; // 8 chars packed, the terminator isn't stored
+    strlcpy(buf, str, sizeof(buf));
+    memcpy(&a0, buf, 4);
+    memcpy(&a1, buf + 4, 4);
+}
+
+/**
+ * Formats a record to a text line
+ * @return length of line
+ */
+size_t EventLog::format(const Record &rec, char *buf, const size_t size) {
+    static const char LEVEL_CHARS[] = "EWID";
+    if ((size == 0) || (rec.msg >= NUM_LOGMSG) || (rec.module >= NUM_LOGMOD))
+        return 0;
+
+    size_t len = snprintf(buf, size, "%lu.%03lu %c %s: ", (unsigned long) (rec.time / 1000), (unsigned long) (rec.time % 1000),
+        LEVEL_CHARS[rec.level & 3], MODULE_NAMES[rec.module]);
+    uint8_t arg = 0;
+    const char *fmt = MSG_FORMATS[rec.msg];
+
+    while ((*fmt != 0) && (len < size - 1)) {
+        if ((*fmt != '%') || (fmt[1] == 0)) {
+            buf[len++] = *fmt++;
+            continue;
+        }
+        fmt++;
+        const int32_t a0 = (arg < 3) ? rec.args[arg] : 0;
+        const int32_t a1 = (arg < 2) ? rec.args[arg + 1] : 0;
+        int n = 0;
+        switch (*fmt++) {
+        case 'd':
+            n = snprintf(buf + len, size - len, "%ld", (long) a0);
+            arg++;
+            break;
+        case 'x':
+            n = snprintf(buf + len, size - len, "%lx", (unsigned long) a0);
+            arg++;
+            break;
+        case 'f': {
+            float f;
+            memcpy(&f, &a0, sizeof(f));
+            n = snprintf(buf + len, size - len, "%.2f", f);
+            arg++;
+            break;
+        }
+        case 't':
+            n = snprintf(buf + len, size - len, "%s", Mqtt::getTopicString((Mqtt::MqttTopic) a0).c_str());
+            arg++;
+            break;
+        case 's': {
+            char str[9];
+            memcpy(str, &a0, 4);
+            memcpy(str + 4, &a1, 4);
+            str[8] = 0;
+            n = snprintf(buf + len, size - len, "%s", str);
+            arg += 2;
+            break;
+        }
+        case 'o':
+            n = (int) OtGwCommand::formatOtEvent(buf + len, size - len, (char) a0, (uint32_t) a1);
+            arg += 2;
+            break;
+        default:
+            buf[len++] = '%';
+            break;
+        }
+        len = std::min(len + std::max(n, 0), size - 1);
+    }
+    buf[len] = 0;
+    return len;
+}
+
+/**
+ * Sets level of a module by names, module "*" sets all modules
+ * @return false if module or level is unknown
+ */
+bool EventLog::setLevel(const char *module, const char *level) {
+    int lvl = -1;
+    for (uint8_t i=0; i<sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]); i++)
+        if (strcasecmp(level, LEVEL_NAMES[i]) == 0)
+            lvl = i;
+    if (lvl < 0)
+        return false;
+
+    bool found = false;
+    for (uint8_t i=0; i<NUM_LOGMOD; i++) {
+        if ((strcmp(module, "*") == 0) || (strcasecmp(module, MODULE_NAMES[i]) == 0)) {
+            levels[i] = (LogLevel) lvl;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void EventLog::getJson(JsonObject &obj) {
+    for (uint8_t i=0; i<NUM_LOGMOD; i++)
+        obj[FPSTR(MODULE_NAMES[i])] = FPSTR(LEVEL_NAMES[levels[i]]);
+}
+
+/**
+ * Writes all stored records as text lines, oldest first
+ */
+void EventLog::writeAll(Print &out) {
+    Record *copy = new Record[NUM_RECORDS];
+    portENTER_CRITICAL(&mux);
+    const uint8_t n = count;
+    const uint8_t first = (head + NUM_RECORDS - count) % NUM_RECORDS;
+    for (uint8_t i=0; i<n; i++)
+        copy[i] = ring[(first + i) % NUM_RECORDS];
+    portEXIT_CRITICAL(&mux);
+
+    char line[160];
+    for (uint8_t i=0; i<n; i++) {
+        format(copy[i], line, sizeof(line));
+        out.print(line);
+        out.print(F("\r\n"));
+    }
+    delete[] copy;
+}
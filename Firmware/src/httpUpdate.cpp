@@ -106,6 +106,7 @@ void HttpUpdate::update() {
 
     https.end();
     Update.end(true);
+    otcontrol.saveState(true);
     ESP.restart();    
 }
 
@@ -0,0 +1,122 @@
+#include "logsink.h"
+#include "portal.h"
+#include "command.h"
+#include "main.h"
+
+const size_t LOG_RINGBUF_SIZE = 4096; // bytes
+const size_t LOG_LINE_MAX = 256; // longer lines are truncated
+const UBaseType_t LOG_TASK_PRIO = 1;
+const uint32_t LOG_TASK_STACK = 4096;
+
+LogSink logsink;
+
+LogSink::LogSink() {
+    rb = xRingbufferCreate(LOG_RINGBUF_SIZE, RINGBUF_TYPE_NOSPLIT);
+}
+
+void LogSink::begin() {
+    xTaskCreate(task, "logsink", LOG_TASK_STACK, this, LOG_TASK_PRIO, NULL);
+}
+
+/**
+ * Queues a line for the given outputs, callable from any task. Never blocks, the line is
+ * dropped if the ring buffer is full.
+ */
+void LogSink::write(const uint8_t targets, const char *text, const size_t len) {
+    send(targets, text, std::min(len, LOG_LINE_MAX));
+}
+
+void LogSink::write(const uint8_t targets, const String &text) {
+    write(targets, text.c_str(), text.length());
+}
+
+/**
+ * Queues a log record, it gets formatted by the task only if one of the targets has a consumer
+ */
+void LogSink::write(const uint8_t targets, const EventLog::Record &rec) {
+    send(targets | ITEM_RECORD, &rec, sizeof(rec));
+}
+
+void LogSink::send(const uint8_t flags, const void *data, const size_t len) {
+    if (rb == nullptr)
+        return;
+
+    void *item;
+    if (xRingbufferSendAcquire(rb, &item, len + 1, 0) != pdTRUE) {
+        queueDropped++;
+        return;
+    }
+    uint8_t *p = (uint8_t*) item;
+    p[0] = flags;
+    memcpy(p + 1, data, len);
+    xRingbufferSendComplete(rb, item);
+}
+
+void LogSink::task(void *arg) {
+    LogSink *sink = (LogSink*) arg;
+    while (true) {
+        size_t size;
+        uint8_t *item = (uint8_t*) xRingbufferReceive(sink->rb, &size, portMAX_DELAY);
+        if (item == nullptr)
+            continue;
+        if ((size == sizeof(EventLog::Record) + 1) && (item[0] & ITEM_RECORD)) {
+            EventLog::Record rec;
+            memcpy(&rec, item + 1, sizeof(rec));
+            sink->outputRecord(item[0] & ~ITEM_RECORD, rec);
+        }
+        else if (size > 0)
+            sink->output(item[0], (const char*) item + 1, size - 1);
+        vRingbufferReturnItem(sink->rb, item);
+    }
+}
+
+void LogSink::output(const uint8_t targets, const char *text, const size_t len) {
+    if (targets & TARGET_SERIAL) {
+        // a USB host which doesn't read would block the task for the TX timeout
+        if (Serial.availableForWrite() >= (int) (len + 2)) {
+            Serial.write((const uint8_t*) text, len);
+            Serial.print(F("\r\n"));
+        }
+        else
+            serialDropped++;
+    }
+
+    if (targets & TARGET_WS) {
+        if (!portal.wsLog(text, len))
+            wsDropped++;
+    }
+
+    if (targets & TARGET_TCP) {
+        // drops are counted per client by command
+        command.writeClients(text, len);
+    }
+
+#ifdef DEBUG
+    if (targets & TARGET_BLE) {
+        if (bleClientConnected && bleSerialTx) {
+            bleSerialTx->setValue((const uint8_t*) text, len);
+            bleSerialTx->notify();
+        }
+    }
+#endif
+}
+
+void LogSink::outputRecord(uint8_t targets, const EventLog::Record &rec) {
+    // skip formatting for outputs nobody is watching
+    if (!Serial.isConnected())
+        targets &= ~TARGET_SERIAL;
+    if (!portal.hasWsClients())
+        targets &= ~TARGET_WS;
+    if (targets == 0)
+        return;
+
+    char line[160];
+    const size_t len = eventlog.format(rec, line, sizeof(line));
+    output(targets, line, len);
+}
+
+void LogSink::getJson(JsonObject &obj) {
+    obj[F("dropped")] = queueDropped;
+    obj[F("serialDropped")] = serialDropped;
+    obj[F("wsDropped")] = wsDropped;
+}
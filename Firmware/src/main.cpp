@@ -10,6 +10,7 @@
 #include "devstatus.h"
 #include "devconfig.h"
 #include "command.h"
+#include "logsink.h"
 #include "sensors.h"
 #include "HADiscLocal.h"
 #include <esp_wifi.h>
@@ -272,6 +273,7 @@ void manageNetwork() {
 void setup() {
     Serial.begin();
     Serial.setTxTimeoutMs(100);
+    logsink.begin();
     pinMode(GPIO_STATUS_LED, OUTPUT);
     pinMode(GPIO_CONFIG_BUTTON, INPUT);
     
@@ -360,6 +362,7 @@ void setup() {
 #else
     Serial.begin();
     Serial.setTxTimeoutMs(100);
+    logsink.begin();
 #endif
 #ifdef NODO
     if (!configMode) {
@@ -415,6 +418,7 @@ void setup() {
 }
 
 void loop() {
+    const uint32_t loopStart = micros();
     unsigned long now = millis();
 #ifdef NODO
     yield(); // keep WDT happy
@@ -467,7 +471,10 @@ void loop() {
     portal.loop();
     mqtt.loop();
     otcontrol.loop();
+    command.loop();
     Sensor::loopAll();
     devconfig.loop();
     OneWireNode::loop();
+    BLESensor::loop();
+    devstatus.loopTime(micros() - loopStart);
 }
\ No newline at end of file
@@ -1,56 +1,195 @@
 #include "mqtt.h"
 #include <WiFi.h>
+#include <Preferences.h>
+#include <rom/crc.h>
+#include <esp_crt_bundle.h>
 #include <devstatus.h>
 #include "HADiscLocal.h"
 #include "portal.h"
 #include "sensors.h"
 #include "HADiscLocal.h"
 #include "hwdef.h"
-
-static struct {
+#include "util.h"
+#include "eventlog.h"
+
+const uint32_t DISC_SLOT = 50; // ms between two discovery messages
+const uint32_t DISC_RUN_INTERVAL = 2000; // ms between runs of discovery producers
+const size_t DISC_QUEUE_MAX_ITEMS = 64;
+const size_t DISC_QUEUE_MAX_BYTES = 12288;
+const uint8_t DISC_MAX_TRIES = 10;
+const size_t DISC_HASHES_MAX = 256;
+const uint32_t TELEM_CAPTURE_INTERVAL = 60000; // ms between status records captured while offline
+const uint32_t TELEM_REPLAY_SLOT = 200; // ms between two replayed records
+const size_t TELEM_QUEUE_MAX_BYTES = 24576;
+const int MQTT_RECONNECT_TIMEOUT = 10000; // ms
+const size_t MQTT_OUTBOX_LIMIT = 16384; // bytes of outgoing messages buffered by the client
+const size_t TOPIC_MAX = 128;
+static const char NVS_NAMESPACE[] PROGMEM = "mqtt";
+static const char NVS_DISC_HASHES[] PROGMEM = "discHash";
+static const char NVS_DISC_SCOPE[] PROGMEM = "discScope";
+
+const size_t CMD_PAYLOAD_MAX = 64; // max. length of command payloads, longer ones are dropped
+static const char SET_SUFFIX[] PROGMEM = "/set";
+
+static constexpr struct TopicEntry {
     Mqtt::MqttTopic topic;
     const char *str;
-} topicList[] PROGMEM = {
-    {Mqtt::TOPIC_OUTSIDETEMP, "outsideTemp"},
-    {Mqtt::TOPIC_DHWSETTEMP, "dwhSetTemp"},
+} topicList[] = { // sorted by str for binary search
+    {Mqtt::TOPIC_AUTOBYPASS, "autoBypass"},
+    {Mqtt::TOPIC_CHMODE1, "chMode1"},
+    {Mqtt::TOPIC_CHMODE2, "chMode2"},
     {Mqtt::TOPIC_CHSETTEMP1, "chSetTemp1"},
     {Mqtt::TOPIC_CHSETTEMP2, "chSetTemp2"},
     {Mqtt::TOPIC_DHWMODE, "dhwMode"},
-    {Mqtt::TOPIC_CHMODE1, "chMode1"},
-    {Mqtt::TOPIC_CHMODE2, "chMode2"},
-    {Mqtt::TOPIC_ROOMTEMP1, "roomTemp1"},
-    {Mqtt::TOPIC_ROOMTEMP2, "roomTemp2"},
+    {Mqtt::TOPIC_DHWSETTEMP, "dwhSetTemp"},
+    {Mqtt::TOPIC_FREEVENTENABLE, "freeVentEnable"},
+    {Mqtt::TOPIC_LOGLEVEL, "logLevel"},
+    {Mqtt::TOPIC_MAXMODULATION, "maxModulation"},
+    {Mqtt::TOPIC_OPENBYPASS, "openBypass"},
+    {Mqtt::TOPIC_OUTSIDETEMP, "outsideTemp"},
+    {Mqtt::TOPIC_OVERRIDECH1, "overrideCh1"},
+    {Mqtt::TOPIC_OVERRIDECH2, "overrideCh2"},
+    {Mqtt::TOPIC_OVERRIDEDHW, "overrideDhw"},
     {Mqtt::TOPIC_ROOMCOMP1, "roomComp1"},
     {Mqtt::TOPIC_ROOMCOMP2, "roomComp2"},
     {Mqtt::TOPIC_ROOMSETPOINT1, "roomSetpoint1"},
     {Mqtt::TOPIC_ROOMSETPOINT2, "roomSetpoint2"},
-    {Mqtt::TOPIC_OVERRIDECH1, "overrideCh1"},
-    {Mqtt::TOPIC_OVERRIDECH2, "overrideCh2"},
-    {Mqtt::TOPIC_OVERRIDEDHW, "overrideDhw"},
-    {Mqtt::TOPIC_VENTSETPOINT, "ventSetpoint"},
+    {Mqtt::TOPIC_ROOMTEMP1, "roomTemp1"},
+    {Mqtt::TOPIC_ROOMTEMP2, "roomTemp2"},
     {Mqtt::TOPIC_VENTENABLE, "ventEnable"},
-    {Mqtt::TOPIC_OPENBYPASS, "openBypass"},
-    {Mqtt::TOPIC_AUTOBYPASS, "autoBypass"},
-    {Mqtt::TOPIC_FREEVENTENABLE, "freeVentEnable"},
-    {Mqtt::TOPIC_MAXMODULATION, "maxModulation"}
+    {Mqtt::TOPIC_VENTSETPOINT, "ventSetpoint"}
 };
 
+static constexpr int constStrCmp(const char *a, const char *b) {
+    while ((*a != 0) && (*a == *b)) {
+        a++;
+        b++;
+    }
+    return (uint8_t) *a - (uint8_t) *b;
+}
+
+static constexpr bool topicListValid() {
+    const size_t n = sizeof(topicList) / sizeof(topicList[0]);
+    if (n != Mqtt::TOPIC_UNKNOWN)
+        return false;
+    for (size_t i=1; i<n; i++)
+        if (constStrCmp(topicList[i - 1].str, topicList[i].str) >= 0)
+            return false;
+    return true;
+}
+
+static_assert(topicListValid(), "topicList has to contain each topic once, sorted by name");
+
+/**
+ * Looks up a command topic name, which doesn't have to be null terminated.
+ * @return TOPIC_UNKNOWN if not found
+ */
+static Mqtt::MqttTopic findTopic(const char *name, const size_t len) {
+    size_t lo = 0;
+    size_t hi = sizeof(topicList) / sizeof(topicList[0]);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const char *str = topicList[mid].str;
+        int cmp = strncmp(str, name, len);
+        if ((cmp == 0) && (str[len] != 0))
+            cmp = 1;
+        if (cmp == 0)
+            return topicList[mid].topic;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return Mqtt::TOPIC_UNKNOWN;
+}
+
+static bool parseDouble(const char *str, double &val) {
+    char *end;
+    val = strtod(str, &end);
+    return (end != str) && (*end == 0);
+}
+
 Mqtt mqtt;
 static uint32_t numDisc = 0;
-static WiFiClient espClient;
 static char statBuf[4096];
-
-void mqttConnectCb(bool sessionPresent) {
-    mqtt.onConnect();
+static char cmdBuf[CMD_PAYLOAD_MAX + 1]; // reassembly of fragmented payloads, only used by the MQTT task
+static char cmdTopic[TOPIC_MAX + 1];
+// HA status topic, double buffered: loop() writes the inactive one and switches, onMessage() in the
+// client task compares the active one without taking discMutex, which loop() holds while waiting for the client
+static char haStatusTopic[2][TOPIC_MAX + 1];
+static std::atomic<uint8_t> haStatusIdx {0};
+
+static void setHAStatusTopic(const String &topic) {
+    const uint8_t idx = haStatusIdx ^ 1;
+    strlcpy(haStatusTopic[idx], topic.c_str(), sizeof(haStatusTopic[idx]));
+    haStatusIdx = idx;
 }
 
-void mqttDisconnectCb(AsyncMqttClientDisconnectReason reason) {
-    mqtt.onDisconnect(reason);
+/**
+ * Serializes a status document into statBuf
+ * @return false if it doesn't fit, a truncated document wouldn't be valid JSON
+ */
+static bool serializeStatus(JsonDocument &doc) {
+    if (measureJson(doc) >= sizeof(statBuf))
+        return false;
+    serializeJson(doc, statBuf);
+    return true;
 }
 
-static void mqttMessageReceived(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
-    String payloadStr(payload, len);
-    mqtt.onMessage(topic, payloadStr);
+class DiscLock: public SemHelper {
+public:
+    DiscLock(SemaphoreHandle_t &mtx): SemHelper(mtx, 100) {
+    }
+};
+
+/**
+ * Receives events of the MQTT client task. Connection changes are passed to loop(),
+ * which owns the connection and discovery state.
+ */
+void mqttEventHandler(void*, esp_event_base_t, int32_t id, void *data) {
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t) data;
+
+    switch ((esp_mqtt_event_id_t) id) {
+    case MQTT_EVENT_CONNECTED:
+        mqtt.linkUp = true;
+        mqtt.events |= Mqtt::EVENT_CONNECTED;
+        break;
+
+    case MQTT_EVENT_DISCONNECTED:
+        mqtt.linkUp = false;
+        mqtt.events |= Mqtt::EVENT_DISCONNECTED;
+        break;
+
+    case MQTT_EVENT_ERROR:
+        if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT)
+            mqtt.lastError = event->error_handle->esp_tls_last_esp_err;
+        else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED)
+            mqtt.lastError = event->error_handle->connect_return_code;
+        break;
+
+    case MQTT_EVENT_DATA:
+        // payloads larger than the client's buffer are delivered in several chunks, topic only with the first one
+        if (event->current_data_offset == 0) {
+            if ((event->topic_len < 0) || ((size_t) event->topic_len > TOPIC_MAX)) {
+                cmdTopic[0] = 0;
+                return;
+            }
+            memcpy(cmdTopic, event->topic, event->topic_len);
+            cmdTopic[event->topic_len] = 0;
+        }
+        if ( (cmdTopic[0] == 0) || (event->total_data_len > (int) CMD_PAYLOAD_MAX) ||
+             (event->current_data_offset + event->data_len > event->total_data_len) )
+            return;
+        memcpy(cmdBuf + event->current_data_offset, event->data, event->data_len);
+        if (event->current_data_offset + event->data_len < event->total_data_len)
+            return;
+        cmdBuf[event->total_data_len] = 0;
+        mqtt.onMessage(cmdTopic, cmdBuf, event->total_data_len);
+        break;
+
+    default:
+        break;
+    }
 }
 
 Mqtt::Mqtt():
@@ -58,9 +197,7 @@ Mqtt::Mqtt():
         lastStatus(0),
         configSet(false),
         conFlag(false) {
-    cli.onConnect(mqttConnectCb);
-    cli.onDisconnect(mqttDisconnectCb);
-    cli.onMessage(mqttMessageReceived);
+    discMutex = xSemaphoreCreateMutex();
 }
 
 void Mqtt::begin() {
@@ -72,45 +209,143 @@ void Mqtt::begin() {
     baseTopic = F("otthing/");
     baseTopic += shortMac;
     statusTopic = baseTopic + F("/status");
+    historyTopic = baseTopic + F("/history");
+    loadDiscHashes();
 }
 
 void Mqtt::onConnect() {
-    portal.textAll(F("MQTT connected"));
-
-    cli.setWill(statusTopic.c_str(), 0, true, "offline");
+    eventlog.add(LOGMOD_MQTT, LOGLVL_INFO, activeConfig.tls ? LOGMSG_MQTT_CONNECTED_TLS : LOGMSG_MQTT_CONNECTED);
 
     String topic = baseTopic + F("/+/set");
-    cli.subscribe(topic.c_str(), 0);
+    esp_mqtt_client_subscribe_single(cli, topic.c_str(), 0);
+
+    // HA birth message tells us HA has (re-)started and may have lost discoveries
+    setHAStatusTopic(HADiscovery::getHAPrefix() + F("/status"));
+    esp_mqtt_client_subscribe_single(cli, haStatusTopic[haStatusIdx], 0);
 
+    clearDiscQueue();
+    discSent = 0;
+    discFailed = 0;
+    discSkipped = 0;
+    lastDiscRun = millis() - DISC_RUN_INTERVAL;
     discFlag = false;
+    lastError = 0;
+    isConnected = true;
     conFlag = true;
 }
 
-void Mqtt::onDisconnect(AsyncMqttClientDisconnectReason reason) {
+void Mqtt::onDisconnect() {
+    isConnected = false;
     if (conFlag) {
-        String msg = F("MQTT disconnected ");
-        msg += String((int) reason);
-        portal.textAll(msg);
+        eventlog.add(LOGMOD_MQTT, LOGLVL_WARN, LOGMSG_MQTT_DISCONNECTED, lastError.load());
         conFlag = false;
         numDisc++;
     }
+    clearDiscQueue();
+}
+
+/**
+ * HA has (re-)started, restart the discovery run with all entities forced, so entities queued
+ * before the birth message are published again as well
+ */
+void Mqtt::onHAOnline() {
+    {
+        DiscLock lock(discMutex);
+        if (lock)
+            discRun.clear();
+    }
+    discForce = true;
+    discFlag = false;
+    lastDiscRun = millis() - DISC_RUN_INTERVAL;
+}
+
+/**
+ * Handles events posted by the client task. A disconnect is handled before a connect,
+ * a connect only if the link is still up.
+ */
+void Mqtt::loopEvents() {
+    const uint8_t ev = events.exchange(0);
+    if (ev & EVENT_DISCONNECTED) {
+        if (isConnected)
+            onDisconnect();
+    }
+    if ((ev & EVENT_CONNECTED) && linkUp)
+        onConnect();
+    if ((ev & EVENT_HA_ONLINE) && isConnected)
+        onHAOnline();
 }
 
 bool Mqtt::connected() {
-    return cli.connected();
+    return isConnected;
 }
 
+/**
+ * Stores a new configuration, the client is recreated by loop()
+ */
 void Mqtt::setConfig(const MqttConfig conf) {
     lastConTry = millis() - 8000;
-    cli.disconnect(false);
     config = conf;
-    cli.setServer(config.host.c_str(), conf.port);
-    cli.setKeepAlive(config.keepAlive);
-    cli.setCredentials(config.user.c_str(), config.pass.c_str());
     configSet = !conf.host.isEmpty();
+    configChanged = true;
     numDisc = 0;
 }
 
+/**
+ * Creates and starts the client according to config, the client reconnects by itself afterwards
+ */
+void Mqtt::startClient() {
+    esp_mqtt_client_config_t cfg = {};
+    activeConfig = config; // client keeps pointers to the certificate
+    cfg.broker.address.hostname = activeConfig.host.c_str();
+    cfg.broker.address.port = activeConfig.port;
+    if (activeConfig.tls) {
+        cfg.broker.address.transport = MQTT_TRANSPORT_OVER_SSL;
+        if (!activeConfig.caCert.isEmpty())
+            cfg.broker.verification.certificate = activeConfig.caCert.c_str(); // pinned CA, PEM
+        else
+            cfg.broker.verification.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+    else
+        cfg.broker.address.transport = MQTT_TRANSPORT_OVER_TCP;
+    if (!activeConfig.user.isEmpty()) {
+        cfg.credentials.username = activeConfig.user.c_str();
+        cfg.credentials.authentication.password = activeConfig.pass.c_str();
+    }
+    cfg.session.keepalive = activeConfig.keepAlive;
+    cfg.session.last_will.topic = statusTopic.c_str();
+    cfg.session.last_will.msg = "offline";
+    cfg.session.last_will.retain = true;
+    cfg.network.reconnect_timeout_ms = MQTT_RECONNECT_TIMEOUT;
+    cfg.outbox.limit = MQTT_OUTBOX_LIMIT;
+
+    cli = esp_mqtt_client_init(&cfg);
+    if (cli == nullptr)
+        return;
+    esp_mqtt_client_register_event(cli, MQTT_EVENT_ANY, mqttEventHandler, nullptr);
+    esp_mqtt_client_start(cli);
+}
+
+void Mqtt::stopClient() {
+    if (cli == nullptr)
+        return;
+    esp_mqtt_client_destroy(cli); // stops the client task
+    cli = nullptr;
+    events = 0;
+    linkUp = false;
+    if (isConnected)
+        onDisconnect();
+}
+
+/**
+ * Queues a message for the client task
+ * @return false if not connected or client's outbox is full, caller may retry later
+ */
+bool Mqtt::publishRaw(const char *topic, const char *payload, const size_t len, const bool retain) {
+    if (!isConnected)
+        return false;
+    return esp_mqtt_client_enqueue(cli, topic, payload, len, 0, retain, true) >= 0;
+}
+
 uint32_t Mqtt::getNumDisc() const {
     return numDisc;
 }
@@ -134,86 +369,418 @@ void Mqtt::loop() {
     else
         link_up = WiFi.isConnected();
 
-    if (!cli.connected() && ((millis() - lastConTry) > 10000) && link_up && configSet) {
+    if (configChanged) {
+        configChanged = false;
+        stopClient();
+    }
+
+    if ((cli == nullptr) && ((millis() - lastConTry) > 10000) && link_up && configSet) {
 #else
-    if (!cli.connected() && ((millis() - lastConTry) > 10000) && WiFi.isConnected() && configSet) {
+    if (configChanged) {
+        configChanged = false;
+        stopClient();
+    }
+
+    if ((cli == nullptr) && ((millis() - lastConTry) > 10000) && WiFi.isConnected() && configSet) {
 #endif
         lastConTry = millis();
-        cli.connect();
         haDisc.defaultStateTopic = baseTopic + F("/state");
+        startClient();
     }
 
-    if (cli.connected()) {
-        if (!discFlag) {
-            discFlag = true;
-            discFlag &= otcontrol.sendDiscovery();
-            discFlag &= OneWireNode::sendDiscoveryAll();
-            discFlag &= BLESensor::sendDiscoveryAll();
+    loopEvents();
+
+    if (!isConnected) {
+        if (configSet && ((millis() - lastTelemCapture) > TELEM_CAPTURE_INTERVAL)) {
+            lastTelemCapture = millis();
+            captureTelemetry();
         }
+    }
+    else {
+        if (!discFlag && ((millis() - lastDiscRun) > DISC_RUN_INTERVAL)) {
+            // producers are re-run until everything fits into the discovery queue,
+            // messages queued by an earlier pass of this run are skipped
+            lastDiscRun = millis();
+            checkDiscScope();
+            bool done = true;
+            done &= otcontrol.sendDiscovery();
+            done &= OneWireNode::sendDiscoveryAll();
+            done &= BLESensor::sendDiscoveryAll();
+            if (done) {
+                DiscLock lock(discMutex);
+                if (lock) {
+                    discRun.clear();
+                    discForce = false;
+                    discFlag = true;
+                }
+            }
+        }
+
+        loopDiscQueue();
+        loopTelemReplay();
 
         if ((millis() - lastStatus) > 5000) {
             lastStatus = millis();
             JsonDocument doc;
             devstatus.buildDoc(doc);
-            serializeJson(doc, statBuf);
-            cli.publish(haDisc.defaultStateTopic.c_str(), 0, false, statBuf);
-            cli.publish(statusTopic.c_str(), 0, false, PSTR("online"));
+            if (serializeStatus(doc))
+                publishRaw(haDisc.defaultStateTopic.c_str(), statBuf, 0, false);
+            publishRaw(statusTopic.c_str(), PSTR("online"), 0, false);
         }
     }
 }
 
-OTControl::CtrlMode Mqtt::strToCtrlMode(String &str) {
-    if (str.compareTo("heat") == 0)
+OTControl::CtrlMode Mqtt::strToCtrlMode(const char *str) {
+    if (strcmp(str, "heat") == 0)
         return OTControl::CTRLMODE_ON;
-    if (str.compareTo("auto") == 0)
+    if (strcmp(str, "auto") == 0)
         return OTControl::CTRLMODE_AUTO;
-    if (str.compareTo("off") == 0)
+    if (strcmp(str, "off") == 0)
         return OTControl::CTRLMODE_OFF;
     return OTControl::CTRLMODE_UNKNOWN;
 }
 
 bool Mqtt::publish(String topic, JsonDocument &payload, const bool retain) {
-    if (!cli.connected())
-        return false;
-
     String ps;
     if (!payload.isNull())
         serializeJson(payload, ps);
-    cli.publish(topic.c_str(), 0, retain, ps.c_str());
-    return true;
+    return publishRaw(topic.c_str(), ps.c_str(), ps.length(), retain);
 }
 
-void Mqtt::onMessage(const char *topic, String &payload) {
-    String topicStr = topic;
-    topicStr.remove(0, baseTopic.length() + 1);
-    topicStr.remove(topicStr.length() - 4, 4);
+/**
+ * Queues a retained discovery message. A message for a topic already queued replaces the queued one,
+ * a message already queued in the current discovery run is skipped.
+ * @return false if not connected or queue is full, caller has to retry later
+ */
+bool Mqtt::queueDiscovery(const char *topic, const char *payload, const size_t len) {
+    if (!isConnected)
+        return false;
+
+    const size_t topicLen = strlen(topic);
+    const uint32_t topicHash = crc32_le(0, (const uint8_t*) topic, topicLen);
+    const uint32_t payloadHash = crc32_le(0, (const uint8_t*) payload, len);
 
-    String log = F("MQTT: ");
-    log += topic;
-    log += " ";
-    log += payload;
-    portal.textAll(log);
+    DiscLock lock(discMutex);
+    if (!lock)
+        return false;
 
-    enum MqttTopic etop = TOPIC_UNKNOWN;
-    for (int i=0; i<sizeof(topicList) / sizeof(topicList[0]); i++)
-        if (topicStr.compareTo(FPSTR(topicList[i].str)) == 0) {
-            etop = topicList[i].topic;
-            break;
+    for (auto &msg: discQueue) {
+        if (msg.topic == topic) {
+            discQueueBytes -= msg.payload.length();
+            discQueueBytes += len;
+            msg.payload = String(payload, len);
+            msg.payloadHash = payloadHash;
+            msg.tries = 0;
+            storeHash(discRun, topicHash, payloadHash);
+            return true;
         }
+    }
+
+    if (findHash(discRun, topicHash, payloadHash))
+        return true; // queued by an earlier pass of this run
+
+    if (!discForce && isDiscPublished(topicHash, payloadHash)) {
+        // retained message on broker is still up to date
+        discSkipped++;
+        return true;
+    }
+
+    if ( (discQueue.size() >= DISC_QUEUE_MAX_ITEMS) ||
+         (discQueueBytes + topicLen + len > DISC_QUEUE_MAX_BYTES) )
+        return false;
+
+    discQueueBytes += topicLen + len;
+    discQueue.push_back({String(topic), String(payload, len), topicHash, payloadHash, 0});
+    storeHash(discRun, topicHash, payloadHash);
+    return true;
+}
+
+/**
+ * Schedules a discovery run after a config change, only changed messages are published
+ */
+void Mqtt::refreshDiscovery() {
+    discFlag = false;
+    lastDiscRun = millis() - DISC_RUN_INTERVAL;
+}
+
+/**
+ * Publishes the oldest queued discovery message. The message is copied and published without holding
+ * discMutex, the client's API lock must not be waited for with it (the client task takes it in onMessage()).
+ */
+void Mqtt::loopDiscQueue() {
+    if ((millis() - lastDiscSlot) < DISC_SLOT)
+        return;
+    lastDiscSlot = millis();
+
+    DiscMsg msg;
+    {
+        DiscLock lock(discMutex);
+        if (!lock)
+            return;
+
+        if (discQueue.empty()) {
+            if (discHashesDirty)
+                saveDiscHashes();
+            return;
+        }
+        msg = discQueue.front();
+    }
 
+    // publish fails if message doesn't fit into client's outbox
+    const bool sent = publishRaw(msg.topic.c_str(), msg.payload.c_str(), msg.payload.length(), true);
+
+    DiscLock lock(discMutex);
+    if (!lock)
+        return;
+    if (sent) {
+        discSent++;
+        setDiscPublished(msg.topicHash, msg.payloadHash);
+    }
+    // the queued message may have been replaced in the meantime, then it is kept
+    if (discQueue.empty() || (discQueue.front().topicHash != msg.topicHash) ||
+        (discQueue.front().payloadHash != msg.payloadHash))
+        return;
+
+    if (!sent) {
+        if (++discQueue.front().tries < DISC_MAX_TRIES)
+            return;
+        discFailed++;
+        discFlag = false; // schedule a new discovery run
+        removeHash(discRun, msg.topicHash);
+    }
+    discQueueBytes -= msg.topic.length() + msg.payload.length();
+    discQueue.pop_front();
+}
+
+void Mqtt::clearDiscQueue() {
+    DiscLock lock(discMutex);
+    if (!lock)
+        return;
+    discQueue.clear();
+    discQueueBytes = 0;
+    discRun.clear();
+}
+
+/**
+ * Stores the current status with a time stamp, to be replayed on the history topic after reconnect.
+ * Oldest records are dropped when the queue is full, a status too large to be stored is dropped at once.
+ */
+void Mqtt::captureTelemetry() {
+    JsonDocument doc;
+    devstatus.buildDoc(doc);
+    if (!serializeStatus(doc)) {
+        telemDropped++;
+        return;
+    }
+
+    time_t now;
+    time(&now);
+    String rec;
+    rec.reserve(strlen(statBuf) + 48);
+    rec = F("{\"ts\":");
+    rec += (now > 1700000000) ? (uint32_t) now : 0; // 0 if time is not synced
+    rec += F(",\"uptime\":");
+    rec += millis() / 1000;
+    rec += F(",\"state\":");
+    rec += statBuf;
+    rec += '}';
+
+    if (rec.length() > TELEM_QUEUE_MAX_BYTES) {
+        telemDropped++;
+        return;
+    }
+    while (telemQueueBytes + rec.length() > TELEM_QUEUE_MAX_BYTES) {
+        telemQueueBytes -= telemQueue.front().length();
+        telemQueue.pop_front();
+        telemDropped++;
+    }
+    telemQueueBytes += rec.length();
+    telemQueue.push_back(std::move(rec));
+    telemPending = telemQueue.size();
+}
+
+void Mqtt::loopTelemReplay() {
+    if (telemQueue.empty() || ((millis() - lastTelemSlot) < TELEM_REPLAY_SLOT))
+        return;
+    lastTelemSlot = millis();
+
+    // publish fails if message doesn't fit into client's outbox, retry in next slot
+    String &rec = telemQueue.front();
+    if (!publishRaw(historyTopic.c_str(), rec.c_str(), rec.length(), false))
+        return;
+    telemReplayed++;
+    telemQueueBytes -= rec.length();
+    telemQueue.pop_front();
+    telemPending = telemQueue.size();
+}
+
+void Mqtt::getTelemStatus(JsonObject &obj) {
+    obj[F("telemPending")] = telemPending;
+    obj[F("telemDropped")] = telemDropped;
+    obj[F("telemReplayed")] = telemReplayed;
+}
+
+std::vector<Mqtt::DiscHash>::iterator Mqtt::lowerBound(std::vector<DiscHash> &list, const uint32_t topicHash) {
+    return std::lower_bound(list.begin(), list.end(), topicHash, [](const DiscHash &dh, const uint32_t th) {
+        return dh.topic < th;
+    });
+}
+
+/**
+ * @return true if list, sorted by topic, contains the topic with this payload
+ */
+bool Mqtt::findHash(std::vector<DiscHash> &list, const uint32_t topicHash, const uint32_t payloadHash) {
+    auto it = lowerBound(list, topicHash);
+    return (it != list.end()) && (it->topic == topicHash) && (it->payload == payloadHash);
+}
+
+/**
+ * Inserts or updates the entry of a topic, list is limited to DISC_HASHES_MAX entries
+ * @return true if list has been changed
+ */
+bool Mqtt::storeHash(std::vector<DiscHash> &list, const uint32_t topicHash, const uint32_t payloadHash) {
+    auto it = lowerBound(list, topicHash);
+    if ((it != list.end()) && (it->topic == topicHash)) {
+        if (it->payload == payloadHash)
+            return false;
+        it->payload = payloadHash;
+        return true;
+    }
+    if (list.size() >= DISC_HASHES_MAX)
+        return false;
+    list.insert(it, {topicHash, payloadHash});
+    return true;
+}
+
+void Mqtt::removeHash(std::vector<DiscHash> &list, const uint32_t topicHash) {
+    auto it = lowerBound(list, topicHash);
+    if ((it != list.end()) && (it->topic == topicHash))
+        list.erase(it);
+}
+
+bool Mqtt::isDiscPublished(const uint32_t topicHash, const uint32_t payloadHash) {
+    return findHash(discHashes, topicHash, payloadHash);
+}
+
+void Mqtt::setDiscPublished(const uint32_t topicHash, const uint32_t payloadHash) {
+    if (storeHash(discHashes, topicHash, payloadHash))
+        discHashesDirty = true;
+}
+
+/**
+ * Published hashes are only valid for the broker and HA prefix they were published to,
+ * they are dropped if one of them changed.
+ */
+void Mqtt::checkDiscScope() {
+    String scope = activeConfig.host;
+    scope += ':';
+    scope += activeConfig.port;
+    scope += '/';
+    scope += activeConfig.user;
+    scope += '/';
+    scope += HADiscovery::getHAPrefix();
+    const uint32_t hash = crc32_le(0, (const uint8_t*) scope.c_str(), scope.length());
+    if (hash == discScope)
+        return;
+
+    {
+        DiscLock lock(discMutex);
+        if (!lock)
+            return;
+        discScope = hash;
+        discHashes.clear();
+        discRun.clear();
+        saveDiscHashes();
+    }
+
+    // outside of discMutex, the client calls wait for the client's API lock
+    const String topic = HADiscovery::getHAPrefix() + F("/status");
+    const char *oldTopic = haStatusTopic[haStatusIdx];
+    if (topic != oldTopic) {
+        esp_mqtt_client_unsubscribe(cli, oldTopic);
+        setHAStatusTopic(topic);
+        esp_mqtt_client_subscribe_single(cli, haStatusTopic[haStatusIdx], 0);
+    }
+}
+
+void Mqtt::loadDiscHashes() {
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, true))
+        return;
+
+    discScope = prefs.getUInt(NVS_DISC_SCOPE, 0);
+
+    const size_t len = prefs.getBytesLength(NVS_DISC_HASHES);
+    if ((len % sizeof(DiscHash) == 0) && (len <= DISC_HASHES_MAX * sizeof(DiscHash))) {
+        discHashes.resize(len / sizeof(DiscHash));
+        prefs.getBytes(NVS_DISC_HASHES, discHashes.data(), len);
+    }
+    prefs.end();
+}
+
+void Mqtt::saveDiscHashes() {
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, false))
+        return;
+
+    prefs.putBytes(NVS_DISC_HASHES, discHashes.data(), discHashes.size() * sizeof(DiscHash));
+    prefs.putUInt(NVS_DISC_SCOPE, discScope);
+    prefs.end();
+    discHashesDirty = false;
+}
+
+void Mqtt::getDiscStatus(JsonObject &obj) {
+    obj[F("discSent")] = discSent;
+    obj[F("discSkipped")] = discSkipped;
+    obj[F("discFailed")] = discFailed;
+
+    DiscLock lock(discMutex);
+    if (lock)
+        obj[F("discPending")] = discQueue.size();
+}
+
+/**
+ * Handles a complete message. Payload has to be null terminated, its length excluding the terminator.
+ * A payload containing a null character is ignored, it would be cut there.
+ */
+void Mqtt::onMessage(const char *topic, const char *payload, const size_t len) {
+    if (strnlen(payload, len) != len)
+        return;
+
+    if (strcmp(topic, haStatusTopic[haStatusIdx]) == 0) {
+        if (strcmp(payload, "online") == 0)
+            events |= EVENT_HA_ONLINE;
+        return;
+    }
+
+    // topic is <baseTopic>/<name>/set
+    const size_t topicLen = strlen(topic);
+    const size_t baseLen = baseTopic.length();
+    const size_t suffixLen = sizeof(SET_SUFFIX) - 1;
+    if ( (topicLen <= baseLen + 1 + suffixLen) ||
+         (strncmp(topic, baseTopic.c_str(), baseLen) != 0) || (topic[baseLen] != '/') ||
+         (strcmp(topic + topicLen - suffixLen, SET_SUFFIX) != 0) )
+        return;
+
+    const enum MqttTopic etop = findTopic(topic + baseLen + 1, topicLen - baseLen - 1 - suffixLen);
+    if (eventlog.enabled(LOGMOD_MQTT, LOGLVL_INFO)) {
+        int32_t a0, a1;
+        EventLog::packStr(payload, a0, a1);
+        eventlog.add(LOGMOD_MQTT, LOGLVL_INFO, LOGMSG_MQTT_CMD, etop, a0, a1);
+    }
+    const bool on = (strcmp(payload, "ON") == 0);
+    double d;
 
     switch (etop) {
-    case TOPIC_OUTSIDETEMP: {
-        double d = payload.toFloat();
-        outsideTemp.set(d, Sensor::SOURCE_MQTT);
+    case TOPIC_OUTSIDETEMP:
+        if (parseDouble(payload, d))
+            outsideTemp.set(d, Sensor::SOURCE_MQTT);
         break;
-    }
 
-    case TOPIC_DHWSETTEMP: {
-        double d = payload.toFloat();
-        otcontrol.setDhwTemp(d);
+    case TOPIC_DHWSETTEMP:
+        if (parseDouble(payload, d))
+            otcontrol.setDhwTemp(d);
         break;
-    }   
 
     case TOPIC_DHWMODE: {
         OTControl::CtrlMode mode = strToCtrlMode(payload);
@@ -223,11 +790,10 @@ void Mqtt::onMessage(const char *topic, String &payload) {
     }
 
     case TOPIC_CHSETTEMP1:
-    case TOPIC_CHSETTEMP2: {
-        double d = payload.toFloat();
-        otcontrol.setChTemp(d, (uint8_t) (etop - TOPIC_CHSETTEMP1));
+    case TOPIC_CHSETTEMP2:
+        if (parseDouble(payload, d))
+            otcontrol.setChTemp(d, (uint8_t) (etop - TOPIC_CHSETTEMP1));
         break;
-    }
 
     case TOPIC_CHMODE1:
     case TOPIC_CHMODE2: {
@@ -241,18 +807,20 @@ void Mqtt::onMessage(const char *topic, String &payload) {
     case TOPIC_ROOMTEMP1:
     case TOPIC_ROOMTEMP2: {
         const uint8_t ch = (uint8_t) (etop - TOPIC_ROOMTEMP1);
-        double d = payload.toFloat();
-        roomTemp[ch].set(d, Sensor::SOURCE_MQTT);
-        otcontrol.forceFlowCalc(ch);
+        if (parseDouble(payload, d)) {
+            roomTemp[ch].set(d, Sensor::SOURCE_MQTT);
+            otcontrol.forceFlowCalc(ch);
+        }
         break;
     }
 
     case TOPIC_ROOMSETPOINT1:
     case TOPIC_ROOMSETPOINT2: {
         const uint8_t ch = (uint8_t) (etop - TOPIC_ROOMSETPOINT1);
-        double d = payload.toFloat();
-        roomSetPoint[ch].set(d, Sensor::SOURCE_MQTT);
-        otcontrol.forceFlowCalc(ch);
+        if (parseDouble(payload, d)) {
+            roomSetPoint[ch].set(d, Sensor::SOURCE_MQTT);
+            otcontrol.forceFlowCalc(ch);
+        }
         break;
     }
 
@@ -265,21 +833,20 @@ void Mqtt::onMessage(const char *topic, String &payload) {
 
     case TOPIC_OVERRIDECH1:
     case TOPIC_OVERRIDECH2:
-        otcontrol.setOverrideCh(payload == F("ON"), (uint8_t) (etop - TOPIC_OVERRIDECH1));
+        otcontrol.setOverrideCh(on, (uint8_t) (etop - TOPIC_OVERRIDECH1));
         break;
 
     case TOPIC_OVERRIDEDHW:
-        otcontrol.setOverrideDhw(payload == F("ON"));
+        otcontrol.setOverrideDhw(on);
         break;
 
-    case TOPIC_VENTSETPOINT: {
-        uint8_t val = payload.toInt();
-        otcontrol.setVentSetpoint(val);
+    case TOPIC_VENTSETPOINT:
+        if (parseDouble(payload, d))
+            otcontrol.setVentSetpoint((uint8_t) d);
         break;
-    }
 
     case TOPIC_VENTENABLE:
-        otcontrol.setVentEnable(payload == F("ON"));
+        otcontrol.setVentEnable(on);
         break;
 
     case TOPIC_OPENBYPASS:
@@ -291,9 +858,26 @@ void Mqtt::onMessage(const char *topic, String &payload) {
     case TOPIC_FREEVENTENABLE:
         break;
 
-    case TOPIC_MAXMODULATION: {
-        int i= payload.toInt();
-        otcontrol.setMaxMod(i);
+    case TOPIC_MAXMODULATION:
+        if (parseDouble(payload, d))
+            otcontrol.setMaxMod((int) d);
+        break;
+
+    case TOPIC_LOGLEVEL: {
+        // "<module>=<level>" or "<level>" for all modules
+        char module[16] = "*";
+        const char *level = payload;
+        const char *eq = strchr(payload, '=');
+        if ((eq != nullptr) && ((size_t) (eq - payload) < sizeof(module))) {
+            memcpy(module, payload, eq - payload);
+            module[eq - payload] = 0;
+            level = eq + 1;
+        }
+        if (eventlog.setLevel(module, level)) {
+            int32_t a0, a1;
+            EventLog::packStr(payload, a0, a1);
+            eventlog.add(LOGMOD_SYS, LOGLVL_INFO, LOGMSG_LOG_LEVEL, a0, a1);
+        }
         break;
     }
 
@@ -303,7 +887,7 @@ void Mqtt::onMessage(const char *topic, String &payload) {
 }
 
 String Mqtt::getTopicString(const MqttTopic topic) {
-    for (int i=0; i<sizeof(topicList) / sizeof(topicList[0]); i++)
+    for (size_t i=0; i<sizeof(topicList) / sizeof(topicList[0]); i++)
         if (topicList[i].topic == topic)
             return FPSTR(topicList[i].str);
     return "";
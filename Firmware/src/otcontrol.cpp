@@ -1,4 +1,8 @@
 #include <WiFi.h>
+#include <Preferences.h>
+#include <rom/crc.h>
+#include <esp_attr.h>
+#include <esp_random.h>
 #include "otcontrol.h"
 #include "otvalues.h"
 #include "command.h"
@@ -7,14 +11,29 @@
 #include "hwdef.h"
 #include "portal.h"
 #include "sensors.h"
+#include "eventlog.h"
 
 const int PI_INTERVAL = 60; // seconds
+const unsigned long CONFIG_TIMEOUT = 2000; // ms of waiting for an idle bus until a warning is logged
+const unsigned long STATE_SAVE_INTERVAL = 30 * 60 * 1000UL; // ms, limits flash wear
+const unsigned long STATE_MAX_AGE = 10 * 60 * 1000UL; // ms, older state isn't restored
+const uint32_t RTC_MAGIC = 0x4f54424f;
+static const char NVS_NAMESPACE[] PROGMEM = "otcontrol";
+static const char NVS_STATE[] PROGMEM = "state";
 const char SLAVE_BRAND[] PROGMEM = "Seegel Systeme";
 
 using enum OpenThermMessageID;
 
 OTControl otcontrol;
 
+// survives software resets and crashes, not power loss
+static RTC_NOINIT_ATTR struct {
+    uint32_t magic;
+    uint32_t bootId;
+    uint32_t uptime; // ms, updated by loop()
+    uint32_t stateTime; // uptime when the state in NVS was last known to be current
+} rtcBoot;
+
 constexpr uint16_t floatToOT(double f) {
     return (((int) f) << 8) | (int) ((f - (int) f) * 256);
 }
@@ -253,6 +272,132 @@ void OTControl::FlameRatio::Ringbuf::update(const uint8_t idx) {
     current = 0;
 }
 
+void OTControl::FlameRatio::getState(State &state) const {
+    memcpy(state.on, on.buf, sizeof(state.on));
+    memcpy(state.cycles, cycles.buf, sizeof(state.cycles));
+    state.idx = idx;
+    state.init = init;
+}
+
+void OTControl::FlameRatio::setState(const State &state) {
+    memcpy(on.buf, state.on, sizeof(on.buf));
+    memcpy(cycles.buf, state.cycles, sizeof(cycles.buf));
+    on.sum = 0;
+    cycles.sum = 0;
+    for (int i=0; i<FLAMERAT_BUFSIZE; i++) {
+        on.sum += on.buf[i];
+        cycles.sum += cycles.buf[i];
+    }
+    idx = state.idx % FLAMERAT_BUFSIZE;
+    init = state.init;
+}
+
+/**
+ * Controller state kept in NVS for warm restarts. Increment VERSION when changing the layout,
+ * a stored state of another version is ignored. Values are stored with the types PiCtrl uses.
+ */
+struct OTControl::RuntimeState {
+    static const uint8_t VERSION = 2;
+    uint8_t version;
+    uint32_t writes;
+    uint32_t bootId; // boot which wrote the state
+    struct {
+        double integState;
+        double roomTempFilt;
+        double rspPrev;
+        bool piInit;
+        bool suspended;
+    } hc[NUM_HEATCIRCUITS];
+    FlameRatio::State flame;
+};
+
+/**
+ * Restores the controller state, but only after a warm restart and if the state was current
+ * shortly before. After a power loss or a longer downtime the integrator and flame history
+ * don't match the building anymore.
+ */
+void OTControl::loadState() {
+    const bool warm = (rtcBoot.magic == RTC_MAGIC);
+    const uint32_t prevBootId = rtcBoot.bootId;
+    const uint32_t stateAge = rtcBoot.uptime - rtcBoot.stateTime; // when the device went down
+    rtcBoot.magic = RTC_MAGIC;
+    rtcBoot.bootId = warm ? (prevBootId + 1) : esp_random();
+    rtcBoot.uptime = 0;
+    rtcBoot.stateTime = 0;
+
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, true))
+        return;
+
+    RuntimeState state;
+    const bool ok = (prefs.getBytesLength(NVS_STATE) == sizeof(state)) &&
+            (prefs.getBytes(NVS_STATE, &state, sizeof(state)) == sizeof(state));
+    prefs.end();
+    if (!ok)
+        return;
+
+    stateWrites = state.writes;
+    if (state.version != RuntimeState::VERSION)
+        return;
+
+    if (!warm || (state.bootId != prevBootId) || (stateAge > STATE_MAX_AGE))
+        return;
+
+    for (int i=0; i<NUM_HEATCIRCUITS; i++) {
+        HeatingControl::PiCtrl &pictrl = heatingCtrl[i].piCtrl;
+        pictrl.integState = state.hc[i].integState;
+        pictrl.roomTempFilt = state.hc[i].roomTempFilt;
+        pictrl.rspPrev = state.hc[i].rspPrev;
+        pictrl.init = state.hc[i].piInit;
+        heatingCtrl[i].suspended = state.hc[i].suspended;
+    }
+    flameRatio.setState(state.flame);
+    stateRestored = true;
+}
+
+/**
+ * Writes controller state to NVS, at most every STATE_SAVE_INTERVAL and only if it has changed.
+ * @param force write now, used before planned restarts
+ */
+void OTControl::saveState(const bool force) {
+    rtcBoot.uptime = millis();
+    if (!force && (millis() - lastStateSave < STATE_SAVE_INTERVAL))
+        return;
+    lastStateSave = millis();
+
+    RuntimeState state;
+    memset(&state, 0, sizeof(state)); // defined padding for crc
+    state.version = RuntimeState::VERSION;
+    state.bootId = rtcBoot.bootId;
+    for (int i=0; i<NUM_HEATCIRCUITS; i++) {
+        const HeatingControl::PiCtrl &pictrl = heatingCtrl[i].piCtrl;
+        state.hc[i].integState = pictrl.integState;
+        state.hc[i].roomTempFilt = pictrl.roomTempFilt;
+        state.hc[i].rspPrev = pictrl.rspPrev;
+        state.hc[i].piInit = pictrl.init;
+        state.hc[i].suspended = heatingCtrl[i].suspended;
+    }
+    flameRatio.getState(state.flame);
+
+    const uint32_t crc = crc32_le(0, (const uint8_t*) &state, sizeof(state));
+    if (crc == stateCrc) {
+        rtcBoot.stateTime = millis();
+        return;
+    }
+
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, false))
+        return;
+
+    state.writes = stateWrites + 1;
+    if (prefs.putBytes(NVS_STATE, &state, sizeof(state)) == sizeof(state)) {
+        stateWrites = state.writes;
+        stateCrc = crc;
+        rtcBoot.stateTime = millis();
+    }
+    prefs.end();
+}
+
 
 OTControl::OTControl():
         lastBoilerStatus(0),
@@ -279,6 +424,9 @@ void OTControl::begin() {
     slave.hal.begin(handleIrqSlave, otCbSlave);
 
     setOTMode(otMode);
+    loadState();
+    // a restored state is written again right away, so it belongs to this boot
+    lastStateSave = stateRestored ? (millis() - STATE_SAVE_INTERVAL) : millis();
 }
 
 void OTControl::masterPinIrq() {
@@ -384,6 +532,7 @@ void OTControl::bypass() {
 
 void OTControl::loop() {
     hwYield();
+    loopConfig();
 
     if (millis() > nextPiCtrl) {
         loopPiCtrl();
@@ -394,6 +543,7 @@ void OTControl::loop() {
         discFlag = sendDiscovery();
 
     flameRatio.loop();
+    saveState();
 
     SemMaster sem(10);
     if (!sem)
@@ -633,7 +783,7 @@ void OTControl::sendRequest(const char source, const unsigned long msg) {
 void OTControl::OnRxMaster(const unsigned long msg, const OpenThermResponseStatus status) {
     if (status == OpenThermResponseStatus::TIMEOUT) {
         master.timeoutCount++;
-        command.sendAll(FPSTR("RX master timeout"));
+        eventlog.add(LOGMOD_OT, LOGLVL_WARN, LOGMSG_RX_MASTER_TIMEOUT);
         return;
     }
   
@@ -646,9 +796,7 @@ void OTControl::OnRxMaster(const unsigned long msg, const OpenThermResponseStatu
     switch (mt) {
     case OpenThermMessageType::READ_DATA:
     case OpenThermMessageType::WRITE_DATA: {
-        String log = FPSTR("RX master invalid: 0x");
-        log += String(msg, HEX);
-        command.sendAll(log);
+        eventlog.add(LOGMOD_OT, LOGLVL_WARN, LOGMSG_RX_MASTER_INVALID, msg);
         return;
     }
     default:
@@ -731,7 +879,7 @@ void OTControl::OnRxMaster(const unsigned long msg, const OpenThermResponseStatu
     }
 
     if (!otval && (mt == OpenThermMessageType::READ_ACK))
-        portal.textAll(F("no slave val!"));
+        eventlog.add(LOGMOD_OT, LOGLVL_INFO, LOGMSG_NO_SLAVE_VAL, id);
 }
 
 unsigned long OTControl::buildBrandResponse(const OpenThermMessageID id, const String &str, const uint8_t idx) {
@@ -760,9 +908,7 @@ void OTControl::OnRxSlave(const unsigned long msg, const OpenThermResponseStatus
         break;
     }
     default:
-        String log = FPSTR("RX slave invalid: 0x");
-        log += String(msg, HEX);
-        command.sendAll(log);
+        eventlog.add(LOGMOD_OT, LOGLVL_WARN, LOGMSG_RX_SLAVE_INVALID, msg);
         return;
     }
 
@@ -839,6 +985,8 @@ void OTControl::OnRxSlave(const unsigned long msg, const OpenThermResponseStatus
             default:
                 if ((otval != nullptr) && otval->hasReply())
                     resp = OpenTherm::buildResponse(otval->getLastMsgType(), id, otval->getValue());
+                else if (otval != nullptr) // not read from boiler yet, room unit shall ask again
+                    resp = OpenTherm::buildResponse(OpenThermMessageType::DATA_INVALID, id, 0x0000);
             }
 
             slave.sendResponse(resp, 'P');
@@ -1015,7 +1163,7 @@ void OTControl::OnRxSlave(const unsigned long msg, const OpenThermResponseStatus
         }
         if (otMode != OTMODE_MASTER)
             if (!setThermostatVal(newMsg))
-                portal.textAll(F("T no otval!"));
+                eventlog.add(LOGMOD_OT, LOGLVL_INFO, LOGMSG_NO_THERMOSTAT_VAL, id);
     }
 }
 
@@ -1032,6 +1180,11 @@ bool OTControl::setThermostatVal(const unsigned long msg) {
 }
 
 void OTControl::getJson(JsonObject &obj) {
+    obj[F("configPending")] = configPending;
+    JsonObject jstate = obj[F("stateStore")].to<JsonObject>();
+    jstate[F("restored")] = stateRestored;
+    jstate[F("writes")] = stateWrites;
+
     JsonObject jSlave = obj[F("slave")].to<JsonObject>();
     for (auto *valobj: slaveValues)
         valobj->getJson(jSlave);
@@ -1310,23 +1463,55 @@ void OTControl::setDhwCtrlMode(const CtrlMode mode) {
     setDhwRequest.force();
 }
 
-void OTControl::setConfig(JsonObject &config) {
-    while (!master.hal.isReady()) {
-        master.hal.process();
-        yield();
+/**
+ * Stages config, it is applied by loop() as soon as no OT transfer is in progress.
+ * @param prev previously applied config, null applies everything
+ */
+void OTControl::setConfig(JsonObjectConst config, JsonObjectConst prev) {
+    if (!configPending) {
+        pendingPrev.set(prev); // keep what is really applied if a staged config gets replaced
+        configStaged = millis();
+        configPending = true;
+        configWarned = false;
     }
-    while (!slave.hal.isReady()) {
-        slave.hal.process();
-        yield();
+    pendingConfig.set(config);
+}
+
+void OTControl::loopConfig() {
+    if (!configPending)
+        return;
+
+    // switching modes and relays mid-transfer would corrupt it, so keep waiting even if it takes long
+    if (!master.hal.isReady() || !slave.hal.isReady()) {
+        const unsigned long waited = millis() - configStaged;
+        if (!configWarned && (waited >= CONFIG_TIMEOUT)) {
+            eventlog.add(LOGMOD_OT, LOGLVL_WARN, LOGMSG_CONFIG_DELAYED, waited);
+            configWarned = true;
+        }
+        return;
     }
 
-    OTMode mode = OTMODE_BYPASS;
+    applyConfig(pendingConfig.as<JsonObjectConst>(), pendingPrev.as<JsonObjectConst>());
+    configPending = false;
+    pendingConfig.clear();
+    pendingPrev.clear();
+}
 
-    if (config[F("otMode")].is<JsonInteger>())
-        mode = (OTMode) (int) config[F("otMode")];
+/**
+ * Applies config, only parts which differ from prev are applied.
+ * @param prev previously applied config, null applies everything
+ */
+void OTControl::applyConfig(JsonObjectConst config, JsonObjectConst prev) {
+    const bool all = prev.isNull();
+    auto changed = [&](const __FlashStringHelper *key) {
+        return all || (config[key] != prev[key]);
+    };
 
     for (int i=0; i<NUM_HEATCIRCUITS; i++) {
-        JsonObject hpObj = config[F("heating")][i];
+        JsonObjectConst hpObj = config[F("heating")][i];
+        if (!all && (hpObj == prev[F("heating")][i]))
+            continue;
+
         HeatingConfig &hc = heatingConfig[i];
         hc.chOn = hpObj[F("chOn")];
         hc.roomSet = hpObj[F("roomsetpoint")][F("temp")] | 21.0; // default room set point
@@ -1335,7 +1520,7 @@ void OTControl::setConfig(JsonObject &config) {
         hc.gradient = hpObj[F("gradient")] | 1.0;
         hc.offset = hpObj[F("offset")] | 0;
         hc.flow = hpObj[F("flow")] | 35;
-        JsonObject roomComp = hpObj[F("roomComp")];
+        JsonObjectConst roomComp = hpObj[F("roomComp")];
         hc.roomComp.enabled = roomComp[F("enabled")] | false;
         hc.roomComp.p = roomComp[F("p")] | 0.0;
         hc.roomComp.i = roomComp[F("i")] | 0.0;
@@ -1354,43 +1539,62 @@ void OTControl::setConfig(JsonObject &config) {
             roomSetPoint[i].set(hc.roomSet, Sensor::SOURCE_NA);
             heatingCtrl[i].piCtrl.rspPrev = hc.roomSet;
         }
+        setBoilerRequest[i].force();
+        setMaxCh.force();
+    }
+
+    if (changed(F("vent"))) {
+        JsonObjectConst ventObj = config[F("vent")];
+        ventCtrl.ventEnable = ventObj["ventEnable"] | false;
+        ventCtrl.openBypass = ventObj["openBypass"] | false;
+        ventCtrl.autoBypass = ventObj["autoBypass"] | false;
+        ventCtrl.freeVentEnable = ventObj["freeVentEnable"] | false;
+        ventCtrl.setpoint = ventObj["setpoint"] | 0;
+        setVentSetpointRequest.force();
     }
 
-    JsonObject ventObj = config[F("vent")];
-    ventCtrl.ventEnable = ventObj["ventEnable"] | false;
-    ventCtrl.openBypass = ventObj["openBypass"] | false;
-    ventCtrl.autoBypass = ventObj["autoBypass"] | false;
-    ventCtrl.freeVentEnable = ventObj["freeVentEnable"] | false;
-    ventCtrl.setpoint = ventObj["setpoint"] | 0;
+    if (changed(F("boiler"))) {
+        JsonObjectConst boiler = config[F("boiler")];
+        boilerCtrl.dhwOn = boiler[F("dhwOn")];
+        boilerCtrl.dhwTemp = boiler[F("dhwTemperature")] | 45;
+        boilerCtrl.overrideDhw = boiler[F("overrideDhw")] | false;
+        boilerCtrl.maxModulation = boiler[F("maxModulation")] | 100;
+        statusReqOvl = boiler[F("statusReq")] | 0x0000;
+        boilerConfig.otc = boiler[F("otc")] | false;
+        boilerConfig.summerMode = boiler[F("summerMode")] | false;
+        boilerConfig.dhwBlocking = boiler[F("dhwBlocking")] | false;
+        setDhwRequest.force();
+        setMaxModulation.force();
+    }
 
-    JsonObject boiler = config[F("boiler")];
-    boilerCtrl.dhwOn = boiler[F("dhwOn")];
-    boilerCtrl.dhwTemp = boiler[F("dhwTemperature")] | 45;
-    boilerCtrl.overrideDhw = boiler[F("overrideDhw")] | false;
-    boilerCtrl.maxModulation = boiler[F("maxModulation")] | 100;
-    statusReqOvl = boiler[F("statusReq")] | 0x0000;
-    boilerConfig.otc = boiler[F("otc")] | false;
-    boilerConfig.summerMode = boiler[F("summerMode")] | false;
-    boilerConfig.dhwBlocking = boiler[F("dhwBlocking")] | false;
+    if (changed(F("masterMemberId"))) {
+        masterMemberId = config[F("masterMemberId")] | 22;
+        setMasterConfigMember.force();
+    }
 
-    masterMemberId = config[F("masterMemberId")] | 22;
+    // a mode change re-initializes all values, only done if really needed
+    if (changed(F("otMode")) || changed(F("enableSlave")) || changed(F("slaveApp"))) {
+        OTMode mode = OTMODE_BYPASS;
+        if (config[F("otMode")].is<JsonInteger>())
+            mode = (OTMode) (int) config[F("otMode")];
 
-    slaveApp = (SlaveApplication) ((int) config[F("slaveApp")] | 0);
+        slaveApp = (SlaveApplication) ((int) config[F("slaveApp")] | 0);
 
-    setOTMode(mode, config[F("enableSlave")] | false);
+        setOTMode(mode, config[F("enableSlave")] | false);
 
-    setDhwRequest.force();
-    setBoilerRequest[0].force();
-    setBoilerRequest[1].force();
-    setMasterConfigMember.force();
-    setVentSetpointRequest.force();
-    setMaxModulation.force();
-    setProdVersion.force();
-    setOTVersion.force();
-    setMaxCh.force();
+        setDhwRequest.force();
+        setBoilerRequest[0].force();
+        setBoilerRequest[1].force();
+        setMasterConfigMember.force();
+        setVentSetpointRequest.force();
+        setMaxModulation.force();
+        setProdVersion.force();
+        setOTVersion.force();
+        setMaxCh.force();
 
-    master.resetCounters();
-    slave.resetCounters();
+        master.resetCounters();
+        slave.resetCounters();
+    }
 }
 
 void OTControl::setChCtrlMode(const CtrlMode mode, const uint8_t channel) {
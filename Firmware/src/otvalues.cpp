@@ -176,7 +176,7 @@ const char* getOTname(OpenThermMessageID id) {
 }
 
 const char* OTItem::getName(OpenThermMessageID id) {
-    for (int i=0; i<sizeof(OTITEMS) / sizeof(OTITEMS[0]); i++)
+    for (size_t i=0; i<sizeof(OTITEMS) / sizeof(OTITEMS[0]); i++)
         if (OTITEMS[i].id == id)
             return OTITEMS[i].name;
     return nullptr;
@@ -226,7 +226,7 @@ bool OTValue::process() {
     if (isSet() && (interval == 0))
         return false;
 
-    if ((lastTransfer > 0) && ((millis() - lastTransfer) / 1000 < interval))
+    if ((lastTransfer > 0) && ((millis() - lastTransfer) / 1000 < (unsigned long) interval)) // interval >= 0 here
         return false;
 
     unsigned long request = OpenTherm::buildRequest(OpenThermMessageType::READ_DATA, id, value);
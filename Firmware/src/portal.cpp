@@ -11,8 +11,16 @@
 #include "otcontrol.h"
 #include "otvalues.h"
 #include "httpUpdate.h"
+#include "util.h"
+#include "eventlog.h"
 
 static const char APP_JSON[] PROGMEM = "application/json";
+static const char WS_SUBSCRIBE_STATUS[] PROGMEM = "status";
+static const char HDR_ETAG[] PROGMEM = "ETag";
+static const char HDR_IF_NONE_MATCH[] PROGMEM = "If-None-Match";
+static const char HDR_CACHE_CONTROL[] PROGMEM = "Cache-Control";
+static const char CACHE_REVALIDATE[] PROGMEM = "no-cache";
+const uint32_t STATUS_PUSH_INTERVAL = 2000; // ms
 #ifdef NODO
 const IPAddress apAddress(4, 3, 2, 1);
 const IPAddress apMask(255, 255, 255, 0);
@@ -24,10 +32,68 @@ Portal portal;
 static AsyncWebServer websrv(80);
 AsyncWebSocket ws("/ws");
 
+class WsLock: public SemHelper {
+public:
+    WsLock(SemaphoreHandle_t &mtx): SemHelper(mtx, 100) {
+    }
+};
+
+/**
+ * Answers with 304 if the client already has the content tagged with etag.
+ * @return true if the request has been answered
+ */
+static bool sendNotModified(AsyncWebServerRequest *request, const String &etag) {
+    if (etag.isEmpty() || !request->hasHeader(HDR_IF_NONE_MATCH))
+        return false;
+
+    if (request->header(HDR_IF_NONE_MATCH) != etag)
+        return false;
+
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader(HDR_ETAG, etag.c_str());
+    response->addHeader(HDR_CACHE_CONTROL, CACHE_REVALIDATE);
+    request->send(response);
+    return true;
+}
+
+/**
+ * Writes all members of cur which differ from prev into delta. Nested objects
+ * are compared recursively, arrays and values are replaced as a whole.
+ * Members missing in cur are written as null.
+ * @return true if any member differs
+ */
+static bool jsonDelta(JsonObjectConst prev, JsonObjectConst cur, JsonObject delta) {
+    bool changed = false;
+
+    for (JsonPairConst kv: cur) {
+        JsonVariantConst old = prev[kv.key()];
+        if (kv.value().is<JsonObjectConst>() && old.is<JsonObjectConst>()) {
+            JsonObject sub = delta[kv.key()].to<JsonObject>();
+            if (jsonDelta(old.as<JsonObjectConst>(), kv.value().as<JsonObjectConst>(), sub))
+                changed = true;
+            else
+                delta.remove(kv.key());
+        }
+        else if (old != kv.value()) {
+            delta[kv.key()] = kv.value();
+            changed = true;
+        }
+    }
+
+    for (JsonPairConst kv: prev) {
+        if (!kv.value().isNull() && cur[kv.key()].isNull()) {
+            delta[kv.key()] = nullptr;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
 
 Portal::Portal():
     reboot(false),
     updateEnable(true) {
+    wsMutex = xSemaphoreCreateMutex();
 }
 
 void Portal::begin(bool configMode) {
@@ -58,6 +124,25 @@ void Portal::begin(bool configMode) {
 #endif
     }
 
+    ws.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+        switch (type) {
+        case WS_EVT_DATA: {
+            AwsFrameInfo *info = (AwsFrameInfo*) arg;
+            if (info->final && (info->index == 0) && (info->len == len) && (info->opcode == WS_TEXT) &&
+                    (len == strlen_P(WS_SUBSCRIBE_STATUS)) && (strncmp_P((const char*) data, WS_SUBSCRIBE_STATUS, len) == 0))
+                onWsSubscribe(client->id());
+            break;
+        }
+
+        case WS_EVT_DISCONNECT:
+            onWsDisconnect(client->id());
+            break;
+
+        default:
+            break;
+        }
+    });
+
     websrv.begin();
     websrv.addHandler(&ws);
 
@@ -68,33 +153,80 @@ void Portal::begin(bool configMode) {
             return;
         }
         #endif
-        request->send(200, F("text/html"), (uint8_t*) html, strlen_P(html));
+        const String etag = FPSTR(html_etag);
+        if (sendNotModified(request, etag))
+            return;
+
+        AsyncWebServerResponse *response = request->beginResponse(200, F("text/html"), html_gz, html_gz_len);
+        response->addHeader(F("Content-Encoding"), F("gzip"));
+        response->addHeader(HDR_ETAG, etag.c_str());
+        response->addHeader(HDR_CACHE_CONTROL, CACHE_REVALIDATE);
+        request->send(response);
     });
 
     websrv.on(PSTR("/config"), HTTP_GET, [this] (AsyncWebServerRequest *request) {
-        if (LittleFS.exists(FPSTR(CFG_FILENAME)))
-            request->send(LittleFS, FPSTR(CFG_FILENAME), FPSTR(APP_JSON));
-        else
+        if (!LittleFS.exists(FPSTR(CFG_FILENAME))) {
             request->send(404);
+            return;
+        }
+
+        const String etag = devconfig.getETag();
+        if (sendNotModified(request, etag))
+            return;
+
+        AsyncWebServerResponse *response = request->beginResponse(LittleFS, FPSTR(CFG_FILENAME), FPSTR(APP_JSON));
+        if (!etag.isEmpty())
+            response->addHeader(HDR_ETAG, etag.c_str());
+        response->addHeader(HDR_CACHE_CONTROL, CACHE_REVALIDATE);
+        request->send(response);
     });
 
     websrv.on(PSTR("/config"), HTTP_POST, 
         [this] (AsyncWebServerRequest *request) {
+            // the body handler isn't called without a body
+            if (request->contentLength() == 0)
+                request->send(400, "text/plain", F("empty body"));
         },
         [] (AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
         },
         [this] (AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-            static String confBuf;
-            if (!index)
-                confBuf.clear();
-
-            confBuf.concat((const char*) data, len);
+            // upload id, kept with the request and freed by it
+            if (index == 0)
+                request->_tempObject = calloc(1, sizeof(uint32_t));
+            uint32_t *id = (uint32_t*) request->_tempObject;
+            if (id == nullptr) {
+                if (index == 0)
+                    request->send(500, "text/plain", F("out of memory"));
+                return;
+            }
+            String err;
+            const int status = devconfig.receive(*id, DevConfig::UPLOAD_REPLACE, data, len, index, total, err);
+            if (status != 0)
+                request->send(status, "text/plain", err);
+        }
+    );
 
-            if (confBuf.length() == total) {
-                devconfig.write(confBuf);
-                confBuf.clear();
-                request->send(200);
+    websrv.on(PSTR("/config"), HTTP_PATCH,
+        [this] (AsyncWebServerRequest *request) {
+            if (request->contentLength() == 0)
+                request->send(400, "text/plain", F("empty body"));
+        },
+        [] (AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
+        },
+        [this] (AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            // upload id, kept with the request and freed by it
+            if (index == 0)
+                request->_tempObject = calloc(1, sizeof(uint32_t));
+            uint32_t *id = (uint32_t*) request->_tempObject;
+            if (id == nullptr) {
+                if (index == 0)
+                    request->send(500, "text/plain", F("out of memory"));
+                return;
             }
+            String err;
+            const int status = devconfig.receive(*id, DevConfig::UPLOAD_PATCH, data, len, index, total, err);
+            if (status != 0)
+                request->send(status, "text/plain", err);
         }
     );
 
@@ -263,6 +395,28 @@ void Portal::begin(bool configMode) {
         request->send(200);
     });
 
+    websrv.on(PSTR("/log"), HTTP_GET, [this](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream(F("text/plain"));
+        eventlog.writeAll(*response);
+        request->send(response);
+    });
+
+    websrv.on(PSTR("/loglevel"), HTTP_GET, [this](AsyncWebServerRequest *request) {
+        // without parameters only the current levels are returned
+        if (request->hasParam(PSTR("module")) && request->hasParam(PSTR("level"))) {
+            if (!eventlog.setLevel(request->getParam(PSTR("module"))->value().c_str(), request->getParam(PSTR("level"))->value().c_str())) {
+                request->send(400); // bad request
+                return;
+            }
+        }
+        JsonDocument doc;
+        JsonObject obj = doc.to<JsonObject>();
+        eventlog.getJson(obj);
+        AsyncResponseStream *response = request->beginResponseStream(FPSTR(APP_JSON));
+        serializeJson(doc, *response);
+        request->send(response);
+    });
+
     websrv.on(PSTR("/topics"), HTTP_GET, [this](AsyncWebServerRequest *request) {
         String list;
         for (uint8_t topic = Mqtt::TOPIC_OUTSIDETEMP; topic < Mqtt::TOPIC_UNKNOWN; topic++) {
@@ -276,6 +430,7 @@ void Portal::begin(bool configMode) {
 
 void Portal::loop() {
     if (reboot) {
+        otcontrol.saveState(true);
         delay(500);
         ESP.restart();
     }
@@ -291,8 +446,108 @@ void Portal::loop() {
     }
 
     ws.cleanupClients();
+
+    if ((millis() - lastStatusPush) > STATUS_PUSH_INTERVAL) {
+        lastStatusPush = millis();
+        pushStatus();
+    }
+}
+
+void Portal::onWsSubscribe(const uint32_t id) {
+    WsLock lock(wsMutex);
+    if (!lock)
+        return;
+
+    for (auto cid: statusClients)
+        if (cid == id)
+            return;
+    for (auto cid: newStatusClients)
+        if (cid == id)
+            return;
+
+    newStatusClients.push_back(id);
+    lastStatusPush = millis() - STATUS_PUSH_INTERVAL; // send snapshot with next loop
+}
+
+void Portal::onWsDisconnect(const uint32_t id) {
+    WsLock lock(wsMutex);
+    if (!lock)
+        return;
+
+    std::erase(statusClients, id);
+    std::erase(newStatusClients, id);
+}
+
+void Portal::pushStatus() {
+    if (httpupdate.isUpdating())
+        return;
+
+    // subscribers stay in newStatusClients until they got their snapshot
+    std::vector<uint32_t> clients, newClients;
+    {
+        WsLock lock(wsMutex);
+        if (!lock)
+            return;
+
+        if (statusClients.empty() && newStatusClients.empty()) {
+            statusDoc.clear();
+            return;
+        }
+        clients = statusClients;
+        newClients = newStatusClients;
+    }
+
+    JsonDocument doc;
+    devstatus.buildDoc(doc);
+
+    if (!clients.empty()) {
+        // existing subscribers get changed members only
+        JsonDocument msg;
+        JsonObject delta = msg[F("delta")].to<JsonObject>();
+        if (jsonDelta(statusDoc.as<JsonObjectConst>(), doc.as<JsonObjectConst>(), delta)) {
+            String str;
+            serializeJson(msg, str);
+            for (auto id: clients)
+                ws.text(id, str);
+        }
+    }
+
+    if (!newClients.empty()) {
+        // new subscribers get the full snapshot
+        JsonDocument msg;
+        msg[F("status")] = doc;
+        String str;
+        serializeJson(msg, str);
+        for (auto id: newClients)
+            ws.text(id, str);
+    }
+
+    statusDoc = std::move(doc);
+
+    // if the lock fails, new subscribers get another snapshot with the next push
+    WsLock lock(wsMutex);
+    if (lock) {
+        for (auto id: newClients) {
+            if (std::erase(newStatusClients, id) > 0)
+                statusClients.push_back(id);
+        }
+        std::erase_if(statusClients, [](const uint32_t id) {
+            return !ws.hasClient(id);
+        });
+    }
+}
+
+bool Portal::hasWsClients() {
+    return ws.count() > 0;
 }
 
-void Portal::textAll(String text) {
-    ws.textAll(text);
+/**
+ * Sends a log line to all websocket clients, called by the log sink task
+ * @return false if a client's queue is full and the line was dropped
+ */
+bool Portal::wsLog(const char *text, const size_t len) {
+    if (!ws.availableForWriteAll())
+        return false;
+    ws.textAll(text, len);
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "sensorfilter.h"
+
+SensorFilter::SensorFilter():
+        type(FILTER_NONE),
+        n(5),
+        alpha(0.2),
+        rate(1.0) {
+    reset();
+}
+
+/**
+ * Configures filter from {"type": "median"|"ema"|"rate", "n": .., "alpha": .., "rate": ..}
+ */
+void SensorFilter::setConfig(JsonObjectConst obj) {
+    const char *t = obj[F("type")] | "";
+    if (strcmp(t, "median") == 0)
+        type = FILTER_MEDIAN;
+    else if (strcmp(t, "ema") == 0)
+        type = FILTER_EMA;
+    else if (strcmp(t, "rate") == 0)
+        type = FILTER_RATE;
+    else
+        type = FILTER_NONE;
+
+    n = constrain(obj[F("n")] | 5, 1, MEDIAN_MAX);
+    alpha = constrain(obj[F("alpha")] | 0.2, 0.01, 1.0);
+    rate = obj[F("rate")] | 1.0;
+    if (rate <= 0)
+        rate = 1.0;
+    reset();
+}
+
+void SensorFilter::reset() {
+    histLen = 0;
+    histPos = 0;
+    primed = false;
+}
+
+double SensorFilter::apply(const double val, const uint32_t now) {
+    switch (type) {
+    case FILTER_MEDIAN: {
+        hist[histPos] = val;
+        histPos = (histPos + 1) % n;
+        if (histLen < n)
+            histLen++;
+        // insertion sort, window is at most MEDIAN_MAX values
+        double sorted[MEDIAN_MAX];
+        for (uint8_t i=0; i<histLen; i++) {
+            uint8_t j = i;
+            for (; (j > 0) && (sorted[j - 1] > hist[i]); j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = hist[i];
+        }
+        return sorted[histLen / 2];
+    }
+
+    case FILTER_EMA:
+        last = primed ? (alpha * val + (1 - alpha) * last) : val;
+        break;
+
+    case FILTER_RATE:
+        if (primed) {
+            const double maxStep = rate * (now - lastTime) / 60000.0;
+            last += constrain(val - last, -maxStep, maxStep);
+        }
+        else
+            last = val;
+        break;
+
+    default:
+        return val;
+    }
+    primed = true;
+    lastTime = now;
+    return last;
+}
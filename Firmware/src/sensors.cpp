@@ -9,9 +9,40 @@ OutsideTemp outsideTemp;
 
 SemaphoreHandle_t AddressableSensor::mutex;
 Sensor* Sensor::lastSensor = nullptr;
-BLESensor* BLESensor::last = nullptr;
-OneWireNode *OneWireNode::last = nullptr;
+AddressableSensor::Registry BLESensor::sensors;
+uint8_t BLESensor::allowList[BLE_MAX_SENSORS][6];
+uint8_t BLESensor::allowCount = 0;
+uint32_t BLESensor::numEvicted = 0;
+uint32_t BLESensor::numRejected = 0;
+uint32_t BLESensor::lastPurge = 0;
+NimBLEScan *BLESensor::scan = nullptr;
+uint32_t BLESensor::discoveryStart = 0;
+uint32_t BLESensor::scanStart = 0;
+uint32_t BLESensor::scanTime = 0;
+uint32_t BLESensor::lastScanCheck = 0;
+AddressableSensor::Registry OneWireNode::nodes;
+OneWireNode::State OneWireNode::state = OneWireNode::OW_IDLE;
+size_t OneWireNode::readIdx = 0;
+uint32_t OneWireNode::convStart = 0;
+uint32_t OneWireNode::convTime = 0;
+uint32_t OneWireNode::crcErrors = 0;
 static OneWire oneWire(4);
+static DallasTemperature ds(&oneWire);
+
+const uint32_t OW_INTERVAL = 5000; // ms between two conversions
+const uint32_t OW_CONV_MARGIN = 10; // ms added to datasheet conversion time
+const char OW_HOST[] PROGMEM = "api.openweathermap.org";
+const uint32_t OW_TIMEOUT = 5000; // ms for connect and response
+const uint32_t OW_BACKOFF_MIN = 30000; // ms, retry delay after first error
+const uint32_t OW_BACKOFF_MAX = 1800000; // ms
+const uint32_t BLE_STALE_TIME = 3600000; // ms without advertisement until an unpinned sensor is dropped
+const uint32_t BLE_PURGE_INTERVAL = 60000; // ms between checks for stale sensors
+const uint16_t BLE_SCAN_INTERVAL = 160; // ms
+const uint16_t BLE_SCAN_WINDOW = 80; // ms
+const uint32_t BLE_DISCOVERY_TIME = 300000; // ms of scanning for new sensors after boot / config change
+const uint32_t BLE_SCAN_LEAD = 1000; // ms scanning starts before next expected advertisement
+const uint32_t BLE_MIN_ADV_INTERVAL = 1000; // ms, shorter gaps are repetitions of the same packet
+const uint32_t BLE_SCAN_CHECK = 100; // ms between scan schedule checks
 
 class SensorLock: public SemHelper {
 public:
@@ -20,60 +51,198 @@ public:
 };
 
 Sensor::Sensor():
-    src(SOURCE_NA),
-    setFlag(false) {
+        numInputs(1),
+        maxAge(0),
+        src(SOURCE_NA),
+        defValue(0),
+        defValid(false) {
+    for (auto &in: inputs) {
+        in.src = SOURCE_NA;
+        in.own = nullptr;
+        in.ble = nullptr;
+        in.value = 0;
+        in.time = 0;
+        in.valid = false;
+    }
     prevSensor = lastSensor;
     lastSensor = this;
 }
 
+void Sensor::setInput(Input &in, const double val) {
+    in.value = round(in.filter.apply(val, millis()) * 10) / 10;
+    in.time = millis();
+    in.valid = true;
+    defValid = false;
+}
+
 void Sensor::set(const double val, const Source src) {
-    if ((src == this->src) || (src == SOURCE_NA)) {
-        this->value = round(val * 10) / 10;
-        setFlag = true;
+    if (src == SOURCE_NA) {
+        // default value, valid until a configured source delivers, neither filtered nor aged
+        defValue = val;
+        defValid = true;
+        return;
+    }
+
+    for (uint8_t i=0; i<numInputs; i++) {
+        if (inputs[i].src == src)
+            setInput(inputs[i], val);
     }
 }
 
-bool Sensor::get(double &val) {
-    if (src == SOURCE_BLE) {
+void Sensor::setOneWire(const OneWireNode *node, const double val) {
+    for (uint8_t i=0; i<numInputs; i++) {
+        if ((inputs[i].src == SOURCE_1WIRE) && (inputs[i].own == node))
+            setInput(inputs[i], val);
+    }
+}
+
+void Sensor::invalidate(const Source src) {
+    for (uint8_t i=0; i<numInputs; i++) {
+        if (inputs[i].src == src)
+            inputs[i].valid = false;
+    }
+}
+
+/**
+ * Pulls new values of polled sources and checks age
+ * @return true if input has a valid value which is not too old
+ */
+bool Sensor::refresh(Input &in) {
+    if (in.src == SOURCE_BLE) {
         SensorLock lock;
         if (!lock)
             return false;
 
-        auto *sensor = BLESensor::find(adr);
-        if (sensor != nullptr)
-            val = sensor->temp;
+        if (in.ble == nullptr)
+            in.ble = BLESensor::find(in.bleAdr);
+
+        double t;
+        uint32_t seen;
+        if ((in.ble != nullptr) && in.ble->getTemp(t, seen) && (!in.valid || (seen != in.time))) {
+            setInput(in, t);
+            in.time = seen;
+        }
+    }
+
+    return isFresh(in);
+}
+
+bool Sensor::isFresh(const Input &in) const {
+    if (!in.valid)
+        return false;
+
+    return (maxAge == 0) || ((millis() - in.time) <= maxAge);
+}
+
+/**
+ * Gets value of the first source in the fallback chain with a fresh value, or the default
+ */
+bool Sensor::get(double &val) {
+    for (uint8_t i=0; i<numInputs; i++) {
+        if (refresh(inputs[i])) {
+            val = inputs[i].value;
+            return true;
+        }
+    }
+    if (defValid) {
+        val = defValue;
         return true;
     }
+    return false;
+}
 
-    if (setFlag)
-        val = this->value;
-    
-    return setFlag;
+Sensor::Source Sensor::activeSource() {
+    for (uint8_t i=0; i<numInputs; i++) {
+        if (refresh(inputs[i]))
+            return inputs[i].src;
+    }
+    return SOURCE_NA;
 }
 
+/**
+ * @return true if get() would deliver a value, polled sources aren't checked for new values
+ */
 Sensor::operator bool() const {
-    return setFlag;
+    for (uint8_t i=0; i<numInputs; i++) {
+        if (isFresh(inputs[i]))
+            return true;
+    }
+    return defValid;
+}
+
+void Sensor::setInputConfig(Input &in, JsonObjectConst obj) {
+    SensorLock lock;
+    in.src = (Source) (obj[F("source")] | (int) SOURCE_NA);
+    in.valid = false;
+    in.own = nullptr;
+    in.ble = nullptr;
+    in.filter.setConfig(obj[F("filter")].as<JsonObjectConst>());
+
+    if (in.src == SOURCE_1WIRE) {
+        uint8_t owAdr[8];
+        if (AddressableSensor::parseAdr(obj[F("adr")] | "", owAdr, sizeof(owAdr)))
+            in.own = OneWireNode::find(owAdr);
+        if (in.own != nullptr)
+            in.own->setResolution(obj[F("res")] | 12);
+    }
+    else if (in.src == SOURCE_BLE) {
+        if (!AddressableSensor::parseAdr(obj[F("adr")] | "", in.bleAdr, sizeof(in.bleAdr)))
+            memset(in.bleAdr, 0, sizeof(in.bleAdr));
+    }
 }
 
+/**
+ * Configures source, optional "filter", "maxAge" in seconds and a
+ * "fallback" array of further sources with the same structure
+ */
 void Sensor::setConfig(JsonObject &obj) {
-    src = (Source) (obj["source"] | (int) SOURCE_NA);
-    setFlag = false;
-    own = nullptr;
-    if (src == SOURCE_1WIRE) {
-        own = OneWireNode::find(String(obj["adr"]));
+    src = (Source) (obj[F("source")] | (int) SOURCE_NA);
+    maxAge = (uint32_t) (obj[F("maxAge")] | 0) * 1000;
+    defValid = false;
+    numInputs = 1;
+    setInputConfig(inputs[0], obj);
+    for (JsonObjectConst fb: obj[F("fallback")].as<JsonArrayConst>()) {
+        if (numInputs >= MAX_INPUTS)
+            break;
+        setInputConfig(inputs[numInputs++], fb);
     }
-    else if (src == SOURCE_BLE) {
-        for (int i=0; i<6; i++)
-            adr[i] = strtol(String(obj[F("adr")]).substring(i * 2, i * 2 + 2).c_str(), 0, 16);
+}
+
+bool Sensor::hasSource(const Source s) const {
+    for (uint8_t i=0; i<numInputs; i++) {
+        if (inputs[i].src == s)
+            return true;
     }
+    return false;
 }
 
 bool Sensor::isMqttSource() {
-    return (src == SOURCE_MQTT) || (src == SOURCE_AUTO);
+    return hasSource(SOURCE_MQTT) || hasSource(SOURCE_AUTO);
 }
 
+/**
+ * @return true if the value currently used comes from OpenTherm
+ */
 bool Sensor::isOtSource() {
-    return (src == SOURCE_OT);
+    const Source active = activeSource();
+    return (active == SOURCE_OT) || ((active == SOURCE_NA) && (src == SOURCE_OT));
+}
+
+bool Sensor::usesBle(const uint8_t *adr) const {
+    for (uint8_t i=0; i<numInputs; i++) {
+        if ((inputs[i].src == SOURCE_BLE) && (memcmp(inputs[i].bleAdr, adr, sizeof(inputs[i].bleAdr)) == 0))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @return configured BLE address of input idx or nullptr if its source is not BLE
+ */
+const uint8_t* Sensor::getBleAdr(const uint8_t idx) const {
+    if ((idx < numInputs) && (inputs[idx].src == SOURCE_BLE))
+        return inputs[idx].bleAdr;
+    return nullptr;
 }
 
 void Sensor::loopAll() {
@@ -84,34 +253,73 @@ void Sensor::loopAll() {
     }
 }
 
-AutoSensor::AutoSensor() {
+AutoSensor::AutoSensor():
+        seen(0),
+        ovrMode(OVERRIDE_NONE),
+        ovrValue(0) {
     memset(values, 0, sizeof(values));
 }
 
 void AutoSensor::set(const double val, const Source src) {
-    if ((this->src == SOURCE_AUTO) && (src != SOURCE_NA)) {
-        if (val != values[src]) {
+    if (src == SOURCE_NA) {
+        Sensor::set(val, src);
+        return;
+    }
+
+    // a changed value, e.g. the thermostat's program, ends a temporary override
+    if ((ovrMode == OVERRIDE_TEMP) && (seen & (1 << src)) && (val != values[src]) &&
+        (hasSource(src) || hasSource(SOURCE_AUTO)))
+        ovrMode = OVERRIDE_NONE;
+    seen |= 1 << src;
+
+    if (this->src == SOURCE_AUTO) {
+        if (val != values[src])
             Sensor::set(val, this->src);
-            values[src] = val;
-        }
     }
     else
         Sensor::set(val, src);
+    values[src] = val;
+}
+
+/**
+ * Overrides the value of the configured sources, 0 cancels the override
+ */
+void AutoSensor::setOverride(const double val, const OverrideMode mode) {
+    ovrMode = (val == 0) ? OVERRIDE_NONE : mode;
+    ovrValue = val;
+}
+
+bool AutoSensor::get(double &val) {
+    if (ovrMode != OVERRIDE_NONE) {
+        val = ovrValue;
+        return true;
+    }
+    return Sensor::get(val);
+}
+
+AutoSensor::operator bool() const {
+    return (ovrMode != OVERRIDE_NONE) || Sensor::operator bool();
 }
 
 OutsideTemp::OutsideTemp():
         nextMillis(0),
+        interval(30000),
+        backoff(0),
+        port(80),
+        parseState(PARSE_DONE),
         httpState(HTTP_IDLE) {
 
-    acli.onData([this](void *arg, AsyncClient *client, void *data, size_t len) {
-        replyBuf += String((char*) data, len);
+    acli.onData([this](void*, AsyncClient*, void *data, size_t len) {
+        onData((const char*) data, len);
     });
 
-    acli.onDisconnect([](void *arg, AsyncClient *client) {
-        client->close(true);
+    acli.onDisconnect([this](void*, AsyncClient*) {
+        // body without length ends with the connection
+        if ((parseState == PARSE_BODY) && !hasLength)
+            parseState = PARSE_DONE;
     });
 
-    acli.onError([](void *arg, AsyncClient *client, int8_t error) {
+    acli.onError([](void*, AsyncClient *client, int8_t) {
         client->close(true);
     });
 }
@@ -121,85 +329,271 @@ void OutsideTemp::setConfig(JsonObject &obj) {
     lat = obj[F("lat")];
     lon = obj[F("lon")];
     apikey = obj[F("apikey")].as<String>();
+    host = obj[F("host")] | OW_HOST;
+    port = obj[F("port")] | 80;
     interval = (uint16_t) obj[F("interval")] * 1000;
     if (interval == 0)
         interval = 30000;
     owResult.clear();
-    nextMillis = 0;
+    backoff = 0;
+    nextMillis = millis();
+    // server may have changed
+    acli.close(true);
+    httpState = HTTP_IDLE;
+}
+
+void OutsideTemp::sendRequest() {
+    char req[320];
+    const int len = snprintf(req, sizeof(req),
+        "GET /data/2.5/weather?units=metric&lat=%.4f&lon=%.4f&appid=%s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Connection: keep-alive\r\n\r\n",
+        lat, lon, apikey.c_str(), host.c_str());
+    if ((len < 0) || ((size_t) len >= sizeof(req))) {
+        onError(F("request too long"));
+        return;
+    }
+
+    // reset parser before sending, the reply is handled in the AsyncTCP task
+    lineLen = 0;
+    bodyLen = 0;
+    remaining = 0;
+    hasLength = false;
+    chunked = false;
+    keepAlive = true;
+    httpStatus = 0;
+    parseState = PARSE_STATUS;
+    httpState = HTTP_RECEIVING;
+    timeout = millis() + OW_TIMEOUT;
+
+    if (acli.write(req, len) != (size_t) len) {
+        acli.close(true);
+        onError(F("send failed"));
+    }
+}
+
+bool OutsideTemp::appendBody(const char *data, const size_t len) {
+    if (bodyLen + len >= BODY_MAX_LEN)
+        return false;
+    memcpy(body + bodyLen, data, len);
+    bodyLen += len;
+    return true;
+}
+
+/**
+ * Handles a complete status, header or chunk line
+ * @return false if response is malformed
+ */
+bool OutsideTemp::onLine() {
+    switch (parseState) {
+    case PARSE_STATUS: {
+        // HTTP/1.x <status> <reason>
+        if (strncmp(line, "HTTP/1.", 7) != 0)
+            return false;
+        const char *sp = strchr(line, ' ');
+        if (sp == nullptr)
+            return false;
+        httpStatus = atoi(sp + 1);
+        keepAlive = (line[7] == '1');
+        parseState = PARSE_HEADER;
+        return true;
+    }
+
+    case PARSE_HEADER:
+        if (lineLen == 0) {
+            if (chunked)
+                parseState = PARSE_CHUNK_SIZE;
+            else if (hasLength && (remaining == 0))
+                parseState = PARSE_DONE;
+            else
+                parseState = PARSE_BODY;
+        }
+        else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            remaining = strtoul(line + 15, nullptr, 10);
+            hasLength = true;
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            chunked = (strcasestr(line + 18, "chunked") != nullptr);
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+            keepAlive = (strcasestr(line + 11, "close") == nullptr);
+        return true;
+
+    case PARSE_CHUNK_SIZE: {
+        char *end;
+        remaining = strtoul(line, &end, 16);
+        if (end == line)
+            return false;
+        parseState = (remaining == 0) ? PARSE_TRAILER : PARSE_CHUNK_DATA;
+        return true;
+    }
+
+    case PARSE_CHUNK_END:
+        // CRLF after chunk data
+        if (lineLen != 0)
+            return false;
+        parseState = PARSE_CHUNK_SIZE;
+        return true;
+
+    case PARSE_TRAILER:
+        if (lineLen == 0)
+            parseState = PARSE_DONE;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * Incremental HTTP response parser, only the body is kept
+ */
+void OutsideTemp::onData(const char *data, size_t len) {
+    while ((len > 0) && (parseState != PARSE_DONE) && (parseState != PARSE_ERROR)) {
+        if ((parseState == PARSE_BODY) || (parseState == PARSE_CHUNK_DATA)) {
+            const bool counted = hasLength || (parseState == PARSE_CHUNK_DATA);
+            const size_t n = counted ? std::min(len, remaining) : len;
+            if (!appendBody(data, n)) {
+                parseState = PARSE_ERROR;
+                break;
+            }
+            data += n;
+            len -= n;
+            if (counted) {
+                remaining -= n;
+                if (remaining == 0)
+                    parseState = (parseState == PARSE_CHUNK_DATA) ? PARSE_CHUNK_END : PARSE_DONE;
+            }
+            continue;
+        }
+
+        const char c = *data++;
+        len--;
+        if (c == '\n') {
+            if ((lineLen > 0) && (line[lineLen - 1] == '\r'))
+                lineLen--;
+            line[lineLen] = 0;
+            if (!onLine())
+                parseState = PARSE_ERROR;
+            lineLen = 0;
+        }
+        else if (lineLen < LINE_MAX_LEN - 1) // longer lines are truncated, not needed
+            line[lineLen++] = c;
+    }
+}
+
+/**
+ * Parses the complete body. It isn't streamed into the deserializer: ArduinoJson pulls its input
+ * and can't pause between TCP segments, which AsyncTCP pushes in its own task. Streaming would need
+ * a task blocking on a stream buffer, its stack costs more than the body buffer (a /weather body is
+ * below 1 KB). The filter keeps the document small, a larger body fails with "invalid response".
+ */
+void OutsideTemp::onResponse() {
+    if (!keepAlive)
+        acli.close(true);
+    httpState = HTTP_IDLE;
+
+    // only keep the fields we need
+    JsonDocument filter;
+    filter[F("main")][F("temp")] = true;
+    filter[F("message")] = true;
+    JsonDocument doc;
+    if (deserializeJson(doc, body, bodyLen, DeserializationOption::Filter(filter)) != DeserializationError::Ok) {
+        onError(F("invalid JSON"));
+        return;
+    }
+
+    if ((httpStatus == 200) && doc[F("main")][F("temp")].is<JsonFloat>()) {
+        set(doc[F("main")][F("temp")].as<double>(), SOURCE_OPENWEATHER);
+        owResult = F("Ok");
+        backoff = 0;
+        nextMillis = millis() + interval;
+        return;
+    }
+
+    invalidate(SOURCE_OPENWEATHER);
+    String msg = F("HTTP ");
+    msg += httpStatus;
+    if (doc[F("message")].is<const char*>()) {
+        msg += F(": ");
+        msg += doc[F("message")].as<const char*>();
+    }
+    onError(msg);
+}
+
+/**
+ * Records error and schedules next request with exponential backoff
+ */
+void OutsideTemp::onError(const String &msg) {
+    owResult = msg;
+    backoff = (backoff == 0) ? OW_BACKOFF_MIN : std::min(backoff * 2, OW_BACKOFF_MAX);
+    nextMillis = millis() + std::max(interval, backoff);
+    httpState = HTTP_IDLE;
 }
 
 void OutsideTemp::loop() {
-    if (src != SOURCE_OPENWEATHER)
+    if (!hasSource(SOURCE_OPENWEATHER))
         return;
 
     switch (httpState) {
     case HTTP_IDLE:
-        if (millis() > nextMillis) {
-            acli.connect("api.openweathermap.org", 80);
-            httpState = HTTP_CONNECTING;
-            nextMillis = millis() + 5000;
+        if ((int32_t) (millis() - nextMillis) >= 0) {
+            if (acli.connected())
+                sendRequest(); // reuse kept alive connection
+            else {
+                acli.connect(host.c_str(), port);
+                httpState = HTTP_CONNECTING;
+                timeout = millis() + OW_TIMEOUT;
+            }
         }
         break;
-    
+
     case HTTP_CONNECTING:
-        if (acli.connected()) {
-            // send HTTP GET
-            httpState = HTTP_RECEIVING;
-            String cmd = "GET /data/2.5/weather/?units=metric";
-            cmd += "&lat=" + String(lat);
-            cmd += "&lon=" + String(lon);
-            cmd += "&appid=" + apikey + "\r\n\r\n";
-            replyBuf.clear();
-            acli.write(cmd.c_str());
-            nextMillis = millis() + 5000;
-        }
-        else {
-            if (millis() > nextMillis) {
-                nextMillis = millis() + interval;
-                acli.close(true);
-                httpState = HTTP_IDLE;
-            }
+        if (acli.connected())
+            sendRequest();
+        else if ((int32_t) (millis() - timeout) >= 0) {
+            acli.close(true);
+            onError(F("connect failed"));
         }
         break;
 
-    case HTTP_RECEIVING: {
-        if (millis() > nextMillis)
-            acli.close();
-
-        if (!acli.connected()) {
-            JsonDocument doc;
-            owResult.clear();
-            
-            if (deserializeJson(doc, replyBuf) == DeserializationError::Ok) {
-                if (doc[F("main")][F("temp")].is<JsonFloat>()) {
-                    value = doc[F("main")][F("temp")];
-                    setFlag = true;
-                    owResult = F("Ok");
-                }
-                else
-                    setFlag = false;
-            }
-            if (owResult.isEmpty())
-                owResult = replyBuf;
-            replyBuf.clear();
-
-            nextMillis = millis() + interval;
-            httpState = HTTP_IDLE;
+    case HTTP_RECEIVING:
+        if (parseState == PARSE_DONE)
+            onResponse();
+        else if (parseState == PARSE_ERROR) {
+            acli.close(true);
+            onError(F("invalid response"));
+        }
+        else if (!acli.connected()) {
+            // disconnect may have completed the body meanwhile
+            if (parseState == PARSE_DONE)
+                onResponse();
+            else
+                onError(F("connection closed"));
+        }
+        else if ((int32_t) (millis() - timeout) >= 0) {
+            acli.close(true);
+            onError(F("timeout"));
         }
         break;
-    }
+
     default:
         break;
     }
 }
 
 
-AddressableSensor::AddressableSensor(const uint8_t *adr, const uint8_t adrLen, AddressableSensor **prev):
-        next(*prev) {
-
-    *prev = this;
+AddressableSensor::AddressableSensor(const uint8_t *adr, const uint8_t adrLen, Registry &reg) {
     this->adrLen = adrLen;
     memcpy(this->adr, adr, adrLen);
+    for (uint8_t i=0; i<adrLen; i++)
+        snprintf(adrStr + i * 2, 3, "%02x", adr[i]);
+    adrStr[adrLen * 2] = 0;
+
+    auto it = std::lower_bound(reg.begin(), reg.end(), this->adr,
+        [adrLen](const AddressableSensor *node, const uint8_t *key) {
+            return memcmp(node->adr, key, adrLen) < 0;
+        });
+    reg.insert(it, this);
 }
 
 void AddressableSensor::begin() {
@@ -224,91 +618,209 @@ void AddressableSensor::unlock() {
     xSemaphoreGive(mutex);
 }
 
-String AddressableSensor::getAdr() const {
-    String result;
-    for (uint8_t i=0; i<adrLen; i++) {
-        if (adr[i] < 0x10)
-            result += '0';
-        result += String(adr[i], 16);
-    }
-    return result;
+const char* AddressableSensor::getAdr() const {
+    return adrStr;
 }
 
-AddressableSensor* AddressableSensor::find(String adr, AddressableSensor *last) {
-    AddressableSensor *node = last;
-    while (node) {
-        if (node->getAdr() == adr)
-            break;
-        node = node->next;
+/**
+ * Parses a hex address string of exactly len bytes
+ * @return false if string is malformed
+ */
+bool AddressableSensor::parseAdr(const char *str, uint8_t *adr, const uint8_t len) {
+    if (strlen(str) != len * 2)
+        return false;
+
+    for (uint8_t i=0; i<len * 2; i++) {
+        const char c = str[i];
+        uint8_t nibble;
+        if ((c >= '0') && (c <= '9'))
+            nibble = c - '0';
+        else if ((c >= 'a') && (c <= 'f'))
+            nibble = c - 'a' + 10;
+        else if ((c >= 'A') && (c <= 'F'))
+            nibble = c - 'A' + 10;
+        else
+            return false;
+        if (i & 1)
+            adr[i / 2] |= nibble;
+        else
+            adr[i / 2] = nibble << 4;
     }
-    return node;
+    return true;
+}
+
+/**
+ * Binary search for a raw address in a registry
+ */
+AddressableSensor* AddressableSensor::find(const uint8_t *adr, const Registry &reg) {
+    if (reg.empty())
+        return nullptr;
+
+    const uint8_t len = reg.front()->adrLen;
+    auto it = std::lower_bound(reg.begin(), reg.end(), adr,
+        [len](const AddressableSensor *node, const uint8_t *key) {
+            return memcmp(node->adr, key, len) < 0;
+        });
+    if ((it != reg.end()) && (memcmp((*it)->adr, adr, len) == 0))
+        return *it;
+    return nullptr;
 }
 
-void AddressableSensor::writeJsonAll(JsonObject &status, AddressableSensor *last) {
+void AddressableSensor::writeJsonAll(JsonObject &status, const Registry &reg) {
     SensorLock lock;
     if (!lock)
         return;
 
-    AddressableSensor *node = last;
-    while (node) {
-        String adrStr = node->getAdr();
-        JsonVariant var = status[adrStr].to<JsonVariant>();
-        node->writeJson(var);            
-        node = node->next;
+    for (auto *node: reg) {
+        JsonVariant var = status[node->getAdr()].to<JsonVariant>();
+        node->writeJson(var);
     }
 }
 
-bool AddressableSensor::sendDiscoveryAll(AddressableSensor *last) {
+bool AddressableSensor::sendDiscoveryAll(const Registry &reg) {
     SensorLock lock;
     if (!lock)
         return false;
 
     bool result = true;
-    
-    AddressableSensor *node = last;
-    while (node) {
-        result &= node->sendDiscovery();  
-        node = node->next;
-    }
+    for (auto *node: reg)
+        result &= node->sendDiscovery();
     return result;
 }
 
 
 OneWireNode::OneWireNode(uint8_t *addr):
-        AddressableSensor(addr, 8, (AddressableSensor**) &last) {
+        AddressableSensor(addr, 8, nodes),
+        resolution(12),
+        resChanged(false) {
     temp = DEVICE_DISCONNECTED_C;
 }
 
 void OneWireNode::begin() {
+    ds.setWaitForConversion(false);
+    ds.setCheckForConversion(false);
     oneWire.reset_search();
     uint8_t addr[8];
-    while (oneWire.search(addr))
-        new OneWireNode(addr);
-    loop();
+    while (oneWire.search(addr)) {
+        auto *node = new OneWireNode(addr);
+        const uint8_t res = ds.getResolution(addr);
+        if (res != 0)
+            node->resolution = res;
+    }
+    if (!nodes.empty())
+        startConversion();
+}
+
+/**
+ * Sets conversion resolution, written to the sensor before the next conversion
+ */
+void OneWireNode::setResolution(const uint8_t bits) {
+    const uint8_t res = constrain(bits, 9, 12);
+    if (res != resolution) {
+        resolution = res;
+        resChanged = true;
+    }
+}
+
+/**
+ * Starts a conversion on all sensors, does not wait for completion
+ */
+void OneWireNode::startConversion() {
+    uint8_t maxRes = 9;
+    for (auto *n: nodes) {
+        auto *node = static_cast<OneWireNode*>(n);
+        if (node->resChanged) {
+            ds.setResolution(node->adr, node->resolution, true);
+            node->resChanged = false;
+        }
+        maxRes = std::max(maxRes, node->resolution);
+    }
+
+    ds.requestTemperatures();
+    // DS18B20 needs 93.75 ms at 9 bit, doubling with each extra bit
+    convTime = (750 >> (12 - maxRes)) + OW_CONV_MARGIN;
+    convStart = millis();
+    state = OW_CONVERTING;
+}
+
+/**
+ * Reads scratchpad of this node and checks its CRC
+ */
+void OneWireNode::read() {
+    ScratchPad sp;
+    if (!ds.readScratchPad(adr, sp)) {
+        temp = DEVICE_DISCONNECTED_C;
+        return;
+    }
+
+    if (OneWire::crc8(sp, 8) != sp[8]) {
+        bool allZero = true;
+        for (int i=0; i<9; i++)
+            allZero &= (sp[i] == 0);
+        if (!allZero) // all zero means no device responding
+            crcErrors++;
+        temp = DEVICE_DISCONNECTED_C;
+        return;
+    }
+
+    int16_t raw = (sp[1] << 8) | sp[0];
+    double t;
+    if (adr[0] == DS18S20MODEL) {
+        // 0.5 °C base resolution, extended by COUNT_REMAIN
+        t = (raw >> 1) - 0.25 + (16 - sp[6]) / 16.0;
+    }
+    else {
+        // undefined low bits at reduced resolution
+        raw &= ~((1 << (12 - resolution)) - 1);
+        t = raw / 16.0;
+    }
+    temp = round(t * 10) / 10;
+}
+
+/**
+ * Forwards temperature of this node to all sensors it is assigned to
+ */
+void OneWireNode::publish() {
+    if (temp == DEVICE_DISCONNECTED_C)
+        return;
+
+    for (size_t i=0; i<sizeof(roomTemp) / sizeof(roomTemp[0]); i++)
+        roomTemp[i].setOneWire(this, temp);
+    outsideTemp.setOneWire(this, temp);
 }
 
 void OneWireNode::loop() {
-    static uint32_t next = 0;
-    if (millis() > next) {
-        OneWireNode *node = last;
-        DallasTemperature ds(&oneWire);
-        ds.requestTemperatures();
-        while (node) {
-            node->temp = round(ds.getTempC(node->adr) * 10) / 10;
-            if (node->temp != DEVICE_DISCONNECTED_C) {
-                for (int i=0; i<sizeof(roomTemp) / sizeof(roomTemp[0]); i++) {
-                    if (roomTemp[i].own == node)
-                        roomTemp[i].set(node->temp, Sensor::SOURCE_1WIRE);
-                }
-                if (outsideTemp.own == node)
-                    outsideTemp.set(node->temp, Sensor::SOURCE_1WIRE);
-            }
-            node = static_cast<OneWireNode*>(node->next);
+    switch (state) {
+    case OW_IDLE:
+        if (!nodes.empty() && ((millis() - convStart) >= OW_INTERVAL))
+            startConversion();
+        break;
+
+    case OW_CONVERTING:
+        if ((millis() - convStart) >= convTime) {
+            readIdx = 0;
+            state = OW_READING;
         }
-        next = millis() + 5000;
+        break;
+
+    case OW_READING:
+        // one node per call to keep loop time short
+        if (readIdx < nodes.size()) {
+            auto *node = static_cast<OneWireNode*>(nodes[readIdx++]);
+            node->read();
+            node->publish();
+        }
+        if (readIdx >= nodes.size())
+            state = OW_IDLE;
+        break;
     }
 }
 
+void OneWireNode::getStats(JsonObject &status) {
+    status[F("crcErrors")] = crcErrors;
+    status[F("convTime")] = convTime;
+}
+
 void OneWireNode::writeJson(JsonVariant val) {
     if (this->temp != DEVICE_DISCONNECTED_C)
         val.set(this->temp);
@@ -316,12 +828,12 @@ void OneWireNode::writeJson(JsonVariant val) {
         val.set(nullptr);
 }
 
-OneWireNode *OneWireNode::find(String adr) {
-    return static_cast<OneWireNode*>(AddressableSensor::find(adr, last));
+OneWireNode *OneWireNode::find(const uint8_t *adr) {
+    return static_cast<OneWireNode*>(AddressableSensor::find(adr, nodes));
 }
 
 bool OneWireNode::sendDiscoveryAll() {
-    return AddressableSensor::sendDiscoveryAll(last);
+    return AddressableSensor::sendDiscoveryAll(nodes);
 }
 
 bool OneWireNode::sendDiscovery() {
@@ -338,7 +850,7 @@ bool OneWireNode::sendDiscovery() {
 }
 
 void OneWireNode::writeJsonAll(JsonObject &status) {
-    AddressableSensor::writeJsonAll(status, last);
+    AddressableSensor::writeJsonAll(status, nodes);
 }
 
 
@@ -349,27 +861,174 @@ class scanCallbacks : public NimBLEScanCallbacks {
 } scanCallbacks;
 
 BLESensor::BLESensor(const uint8_t *adr):
-        AddressableSensor(adr, 6, (AddressableSensor**) &last) {
+        AddressableSensor(adr, 6, sensors),
+        rssi(0),
+        lastSeen(millis()),
+        advInterval(0) {
+    temp = 0;
+    memset(&reading, 0, sizeof(reading));
+}
+
+/**
+ * Sets addresses of BLE sensors to track, empty list allows all
+ */
+void BLESensor::setAllowList(JsonArrayConst list) {
+    SensorLock lock;
+    if (!lock)
+        return;
+
+    allowCount = 0;
+    for (JsonVariantConst v: list) {
+        if (allowCount >= BLE_MAX_SENSORS)
+            break;
+        if (parseAdr(v | "", allowList[allowCount], 6))
+            allowCount++;
+    }
+    // give the user some time to find new sensors
+    discoveryStart = millis();
+}
+
+bool BLESensor::isAllowed(const uint8_t *adr) {
+    if (allowCount == 0)
+        return true;
+
+    for (uint8_t i=0; i<allowCount; i++)
+        if (memcmp(allowList[i], adr, 6) == 0)
+            return true;
+    return false;
+}
+
+/**
+ * Pinned sensors are allowlisted or assigned to a sensor input, they are never evicted
+ */
+bool BLESensor::isPinned(const uint8_t *adr) {
+    if ((allowCount > 0) && isAllowed(adr))
+        return true;
+
+    for (size_t i=0; i<sizeof(roomTemp) / sizeof(roomTemp[0]); i++)
+        if (roomTemp[i].usesBle(adr))
+            return true;
+    return outsideTemp.usesBle(adr);
+}
+
+/**
+ * Removes the least recently seen unpinned sensor, must be called with lock held
+ * @param staleOnly only remove it if not seen for BLE_STALE_TIME
+ * @return true if a sensor has been removed
+ */
+bool BLESensor::evict(const bool staleOnly) {
+    auto lru = sensors.end();
+    uint32_t maxAge = 0;
+    for (auto it = sensors.begin(); it != sensors.end(); it++) {
+        auto *sensor = static_cast<BLESensor*>(*it);
+        const uint32_t age = millis() - sensor->lastSeen;
+        if ((age >= maxAge) && !isPinned(sensor->adr)) {
+            maxAge = age;
+            lru = it;
+        }
+    }
+
+    if ((lru == sensors.end()) || (staleOnly && (maxAge < BLE_STALE_TIME)))
+        return false;
+
+    delete *lru;
+    sensors.erase(lru);
+    numEvicted++;
+    return true;
 }
 
 void BLESensor::begin() {
+    sensors.reserve(BLE_MAX_SENSORS);
     BLEDevice::init("");
     BLEDevice::setPower(9);
-    NimBLEScan* pBLEScan = NimBLEDevice::getScan();
-    pBLEScan->setScanCallbacks(&scanCallbacks, true);
-    pBLEScan->setActiveScan(false);
-    pBLEScan->setMaxResults(0);
-    pBLEScan->setInterval(160);
-    pBLEScan->setWindow(80);
-    pBLEScan->start(0, false, true);
+    scan = NimBLEDevice::getScan();
+    scan->setScanCallbacks(&scanCallbacks, true);
+    scan->setActiveScan(false);
+    scan->setMaxResults(0);
+    scan->setInterval(BLE_SCAN_INTERVAL);
+    scan->setWindow(BLE_SCAN_WINDOW);
+    discoveryStart = millis();
+    setScan(true);
+}
+
+/**
+ * Checks if a configured sensor is missing or its next advertisement is due,
+ * must be called with lock held
+ */
+bool BLESensor::scanNeeded(const uint8_t *adr) {
+    const BLESensor *sensor = find(adr);
+    if ((sensor == nullptr) || (sensor->advInterval == 0))
+        return true;
+
+    return (millis() - sensor->lastSeen + BLE_SCAN_LEAD) >= sensor->advInterval;
+}
+
+/**
+ * The radio is shared with WiFi, so scanning is limited to the time after boot
+ * and config changes, searching for missing sensors and short bursts around
+ * the expected advertisements of configured sensors
+ */
+bool BLESensor::scanNeeded() {
+    if ((millis() - discoveryStart) < BLE_DISCOVERY_TIME)
+        return true;
+
+    SensorLock lock;
+    if (!lock)
+        return scan->isScanning(); // keep current state
+
+    for (uint8_t i=0; i<allowCount; i++)
+        if (scanNeeded(allowList[i]))
+            return true;
+
+    for (uint8_t idx=0; idx<Sensor::MAX_INPUTS; idx++) {
+        for (size_t i=0; i<sizeof(roomTemp) / sizeof(roomTemp[0]); i++) {
+            const uint8_t *adr = roomTemp[i].getBleAdr(idx);
+            if ((adr != nullptr) && scanNeeded(adr))
+                return true;
+        }
+        const uint8_t *adr = outsideTemp.getBleAdr(idx);
+        if ((adr != nullptr) && scanNeeded(adr))
+            return true;
+    }
+    return false;
+}
+
+void BLESensor::setScan(const bool on) {
+    if (on == scan->isScanning())
+        return;
+
+    if (on) {
+        scan->start(0, false, true);
+        scanStart = millis();
+    }
+    else {
+        scan->stop();
+        scanTime += millis() - scanStart;
+    }
+}
+
+void BLESensor::loop() {
+    if (scan == nullptr)
+        return;
+
+    if ((millis() - lastScanCheck) < BLE_SCAN_CHECK)
+        return;
+    lastScanCheck = millis();
+
+    setScan(scanNeeded());
 }
 
 void BLESensor::onDiscovery(const NimBLEAdvertisedDevice* dev) {
-    auto srvdata = dev->getServiceData(NimBLEUUID("fcd2"));
-    if (srvdata.length() == 0)
+    // decode straight from the raw payload, avoids copying service data into a std::string
+    const auto &payload = dev->getPayload();
+    const uint8_t *srvdata;
+    size_t srvLen;
+    if (!BTHome::findServiceData(payload.data(), payload.size(), srvdata, srvLen))
         return;
 
-    if (srvdata[0] != 0x40)
+    BTHome::Reading r;
+    BTHome::decode(srvdata, srvLen, r);
+    if (r.valid == 0)
         return;
 
     SensorLock lock;
@@ -377,81 +1036,119 @@ void BLESensor::onDiscovery(const NimBLEAdvertisedDevice* dev) {
     if (!lock)
         return;
 
-    BLESensor *sensor = find(dev->getAddress().getVal());
+    if ((millis() - lastPurge) >= BLE_PURGE_INTERVAL) {
+        while (evict(true));
+        lastPurge = millis();
+    }
+
+    const uint8_t *adr = dev->getAddress().getVal();
+    BLESensor *sensor = find(adr);
     if (sensor == nullptr) {
-        sensor = new BLESensor(dev->getAddress().getVal());
+        if (!isAllowed(adr)) {
+            numRejected++;
+            return;
+        }
+        if ((sensors.size() >= BLE_MAX_SENSORS) && !evict(false)) {
+            numRejected++;
+            return;
+        }
+        sensor = new BLESensor(adr);
         sensor->sendDiscovery();
     }
     
-    sensor->parse(srvdata);
+    sensor->update(r);
     sensor->rssi = dev->getRSSI();
-}
 
-void BLESensor::parse(std::string &data) {
-    int i = 1;
-    while (i < data.length()) {
-        switch (data[i++]) {
-        case 0x00:
-            // packet ID
-            i++;
-            break;
-
-        case 0x01:
-            this->bat = data[i++];
-            break;
-
-        case 0x02: {
-            int16_t temp = ((data[i] | (data[i+1] << 8)) + 5) / 10;
-            this->temp = temp / 10.0;
-            i += 2;
-            break;
-        }
-
-        case 0x03: {
-            this->rh = (data[i] | (data[i+1] << 8)) / 100;
-            i += 2;
-            break;
-        }
-
-        case 0x0C: {
-            //uint16_t v = data[i] | (data[i+1] << 8);
-            i += 2;
-            break;
-        }
+    // learn advertising interval, shrinks at once, grows slowly when advertisements were missed
+    const uint32_t dt = millis() - sensor->lastSeen;
+    if (dt >= BLE_MIN_ADV_INTERVAL) {
+        if ((sensor->advInterval == 0) || (dt < sensor->advInterval))
+            sensor->advInterval = dt;
+        else
+            sensor->advInterval += (dt - sensor->advInterval) / 8;
+    }
+    sensor->lastSeen = millis();
+}
 
-        default:
-            return;
-        }
+/**
+ * Takes over all fields of a decoded packet, fields not contained keep their last value
+ */
+void BLESensor::update(const BTHome::Reading &r) {
+    for (uint8_t f=0; f<BTHome::NUM_FIELDS; f++) {
+        if (r.has((BTHome::Field) f))
+            reading.values[f] = r.values[f];
     }
+    reading.valid |= r.valid;
+
+    if (r.has(BTHome::FIELD_TEMP))
+        temp = round(r.values[BTHome::FIELD_TEMP] * 10) / 10;
 }
 
 BLESensor* BLESensor::find(const uint8_t *adr) {
-    BLESensor *node = last;
-    while (node) {
-        if (memcmp(adr, node->adr, 6) == 0)
-            return node;
-        node = static_cast<BLESensor*>(node->next);
-    }
-    return nullptr;
+    return static_cast<BLESensor*>(AddressableSensor::find(adr, sensors));
 }
 
 void BLESensor::writeJsonAll(JsonObject &status) {
-    AddressableSensor::writeJsonAll(status, last);
+    AddressableSensor::writeJsonAll(status, sensors);
 }
 
 void BLESensor::writeJson(JsonVariant val) {
     JsonObject obj = val.to<JsonObject>();
     obj[F("temp")] = this->temp;
-    obj[F("rh")] = this->rh;
-    obj[F("bat")] = this->bat;
+    obj[F("rh")] = round(reading.values[BTHome::FIELD_HUMIDITY]);
+    obj[F("bat")] = round(reading.values[BTHome::FIELD_BATTERY]);
     obj[F("rssi")] = this->rssi;
+    // further fields only if the sensor sends them
+    for (uint8_t f=BTHome::FIELD_DEWPOINT; f<BTHome::NUM_FIELDS; f++) {
+        if (reading.has((BTHome::Field) f))
+            obj[BTHome::fieldName((BTHome::Field) f)] = round(reading.values[f] * 100) / 100;
+    }
+    obj[F("age")] = (millis() - lastSeen) / 1000;
+}
+
+/**
+ * @param time set to millis of last advertisement
+ * @return false if the sensor didn't send a temperature yet
+ */
+bool BLESensor::getTemp(double &t, uint32_t &time) const {
+    if (!reading.has(BTHome::FIELD_TEMP))
+        return false;
+    t = temp;
+    time = lastSeen;
+    return true;
+}
+
+void BLESensor::getStats(JsonObject &status) {
+    SensorLock lock;
+    if (!lock)
+        return;
+
+    status[F("count")] = sensors.size();
+    status[F("capacity")] = BLE_MAX_SENSORS;
+    status[F("evicted")] = numEvicted;
+    status[F("rejected")] = numRejected;
+    status[F("heap")] = sensors.size() * sizeof(BLESensor) + sensors.capacity() * sizeof(BLESensor*);
+
+    if (scan != nullptr) {
+        const bool scanning = scan->isScanning();
+        uint32_t total = scanTime;
+        if (scanning)
+            total += millis() - scanStart;
+        status[F("scanning")] = scanning;
+        // radio time in percent of uptime, scan window vs. scan interval
+        status[F("radioShare")] = round(1000.0 * total * BLE_SCAN_WINDOW / BLE_SCAN_INTERVAL / millis()) / 10;
+    }
 }
 
 bool BLESensor::sendDiscoveryAll() {
-    return AddressableSensor::sendDiscoveryAll(last);
+    return AddressableSensor::sendDiscoveryAll(sensors);
 }
 
 bool BLESensor::sendDiscovery() {
+    // only sensors in use are announced, not every neighbour's thermometer
+    if (!isPinned(adr))
+        return true;
+
     bool result = true;
 
     String path1 = F("{{ value_json['BLE']['");
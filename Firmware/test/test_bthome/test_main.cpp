@@ -0,0 +1,179 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <math.h>
+#include <vector>
+#include "bthome.h"
+#include "sensors.h"
+
+// BTHome decoder with known packets and random input. Each input is copied into a heap
+// buffer of its exact size, so sanitizer builds report any read past the end.
+
+static const uint8_t ADV[] = { // flags, BTHome v2: packet id, battery 97 %, temperature 25.06 °C, humidity 50.55 %
+    0x02, 0x01, 0x06,
+    0x0E, 0x16, 0xD2, 0xFC, 0x40, 0x00, 0x01, 0x01, 0x61, 0x02, 0xCA, 0x09, 0x03, 0xBF, 0x13
+};
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(const uint32_t n) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % n;
+}
+
+static bool decode(const std::vector<uint8_t> &in, BTHome::Reading &r) {
+    uint8_t *buf = new uint8_t[in.size()];
+    if (!in.empty())
+        memcpy(buf, in.data(), in.size());
+    const bool ok = BTHome::decode(buf, in.size(), r);
+    delete[] buf;
+    return ok;
+}
+
+/** checks what decode() and findServiceData() promise for any input */
+static void checkInvariants(const std::vector<uint8_t> &in) {
+    uint8_t *buf = new uint8_t[in.size()];
+    if (!in.empty())
+        memcpy(buf, in.data(), in.size());
+
+    const uint8_t *data;
+    size_t len;
+    if (BTHome::findServiceData(buf, in.size(), data, len)) {
+        TEST_ASSERT_TRUE((data >= buf) && (data + len <= buf + in.size()));
+        BTHome::Reading r;
+        BTHome::decode(data, len, r);
+    }
+
+    BTHome::Reading r;
+    BTHome::decode(buf, in.size(), r);
+    TEST_ASSERT_EQUAL(0, r.valid & ~((1UL << BTHome::NUM_FIELDS) - 1));
+    TEST_ASSERT_FALSE(r.has(BTHome::FIELD_NONE));
+    for (uint8_t f=0; f<BTHome::NUM_FIELDS; f++)
+        if (r.has((BTHome::Field) f))
+            TEST_ASSERT_TRUE(isfinite(r.values[f]));
+    delete[] buf;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_known_packet() {
+    const uint8_t *data;
+    size_t len;
+    TEST_ASSERT_TRUE(BTHome::findServiceData(ADV, sizeof(ADV), data, len));
+    TEST_ASSERT_EQUAL(11, len);
+    BTHome::Reading r;
+    TEST_ASSERT_TRUE(BTHome::decode(data, len, r));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 25.06, r.values[BTHome::FIELD_TEMP]);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 50.55, r.values[BTHome::FIELD_HUMIDITY]);
+    TEST_ASSERT_EQUAL_FLOAT(97, r.values[BTHome::FIELD_BATTERY]);
+    TEST_ASSERT_TRUE(r.has(BTHome::FIELD_PACKET_ID));
+
+    // every truncation fails or decodes a subset
+    for (size_t n=0; n<len; n++) {
+        BTHome::Reading t;
+        std::vector<uint8_t> in(data, data + n);
+        decode(in, t);
+        TEST_ASSERT_EQUAL(0, t.valid & ~r.valid);
+    }
+}
+
+static void test_special_objects() {
+    BTHome::Reading r;
+    // negative temperature -12.5 °C (0x45, 0.1 scale), text object skipped, then humidity
+    TEST_ASSERT_TRUE(decode({0x40, 0x45, 0x83, 0xFF, 0x53, 0x03, 'a', 'b', 'c', 0x2E, 0x37}, r));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, -12.5, r.values[BTHome::FIELD_TEMP]);
+    TEST_ASSERT_EQUAL_FLOAT(55, r.values[BTHome::FIELD_HUMIDITY]);
+
+    TEST_ASSERT_FALSE(decode({0x41, 0x02, 0xCA, 0x09}, r)); // encrypted
+    TEST_ASSERT_FALSE(decode({0x20, 0x02, 0xCA, 0x09}, r)); // version 1
+    TEST_ASSERT_FALSE(decode({0x40, 0x53, 0x05, 'a'}, r)); // text longer than packet
+    TEST_ASSERT_FALSE(decode({0x40, 0x53}, r)); // text without length
+    TEST_ASSERT_FALSE(decode({0x40, 0x61, 0x00}, r)); // unknown object
+    TEST_ASSERT_FALSE(decode({}, r));
+}
+
+static void test_fuzz_random() {
+    for (uint32_t i=0; i<500000; i++) {
+        std::vector<uint8_t> in(rnd(48));
+        for (auto &b: in)
+            b = rnd(256);
+        if (!in.empty() && rnd(2))
+            in[0] = 0x40; // valid info byte to get past the header more often
+        checkInvariants(in);
+    }
+}
+
+static void test_fuzz_mutations() {
+    const std::vector<uint8_t> base(ADV, ADV + sizeof(ADV));
+    for (uint32_t i=0; i<500000; i++) {
+        std::vector<uint8_t> in = base;
+        for (uint32_t m=1 + rnd(4); m>0; m--) {
+            switch (rnd(4)) {
+            case 0:
+                in[rnd(in.size())] ^= 1 << rnd(8);
+                break;
+            case 1:
+                in[rnd(in.size())] = rnd(256);
+                break;
+            case 2:
+                in.insert(in.begin() + rnd(in.size() + 1), rnd(256));
+                break;
+            default:
+                if (in.size() > 1)
+                    in.resize(rnd(in.size()));
+                break;
+            }
+            if (in.empty())
+                in.push_back(0);
+        }
+        checkInvariants(in);
+    }
+}
+
+static void test_fuzz_scan_results() {
+    // random advertisements of many devices through the scan callback into the registry
+    for (uint32_t i=0; i<200000; i++) {
+        uint8_t adr[6] = {0xA4, 0xC1, 0x38, 0, 0, (uint8_t) rnd(64)};
+        std::vector<uint8_t> payload(ADV, ADV + sizeof(ADV));
+        payload[rnd(payload.size())] = rnd(256);
+        NimBLEAdvertisedDevice dev(adr, payload, -40 - rnd(50));
+        BLESensor::onDiscovery(&dev);
+        if ((i % 1000) == 0)
+            delay(rnd(120000));
+    }
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    BLESensor::getStats(obj);
+    TEST_ASSERT_LESS_OR_EQUAL(BLE_MAX_SENSORS, obj["count"].as<int>());
+    TEST_ASSERT_GREATER_THAN(0, obj["count"].as<int>());
+
+    // with an allowlist none of them is pinned, an hour later all are purged and unknown devices rejected
+    JsonDocument allow;
+    allow.add("a4c138000100");
+    BLESensor::setAllowList(allow.as<JsonArrayConst>());
+    delay(3600000);
+    const uint8_t other[6] = {0xA4, 0xC1, 0x38, 0, 0, 0xFF};
+    NimBLEAdvertisedDevice dev(other, std::vector<uint8_t>(ADV, ADV + sizeof(ADV)), -60);
+    BLESensor::onDiscovery(&dev);
+    BLESensor::getStats(obj);
+    TEST_ASSERT_EQUAL(0, obj["count"].as<int>());
+    BLESensor::setAllowList(JsonArrayConst());
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_known_packet);
+    RUN_TEST(test_special_objects);
+    RUN_TEST(test_fuzz_random);
+    RUN_TEST(test_fuzz_mutations);
+    RUN_TEST(test_fuzz_scan_results);
+    return UNITY_END();
+}
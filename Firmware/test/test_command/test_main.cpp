@@ -0,0 +1,182 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "command.h"
+#include "sensors.h"
+
+// Command port under load: client limit, fragmented input, slow readers and connection churn.
+// The test is the remote end of each connection, sanitizer builds catch use after free.
+
+static AsyncServer *server;
+
+static JsonDocument status() {
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    command.getJson(obj);
+    return doc;
+}
+
+static AsyncClient* connect() {
+    AsyncClient *c = new AsyncClient;
+    server->hostAccept(c);
+    return c;
+}
+
+static std::vector<std::string> lines(const std::string &data) {
+    std::vector<std::string> result;
+    size_t pos = 0, eol;
+    while ((eol = data.find("\r\n", pos)) != std::string::npos) {
+        result.push_back(data.substr(pos, eol - pos));
+        pos = eol + 2;
+    }
+    TEST_ASSERT_EQUAL(data.size(), pos); // only whole lines
+    return result;
+}
+
+static void writeLine(const uint32_t seq) {
+    char line[16];
+    const int n = snprintf(line, sizeof(line), "T%08lx", (unsigned long) seq);
+    command.writeClients(line, n);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+    command.loop(); // deletes the clients disconnected by the test
+}
+
+static void test_client_limit() {
+    std::vector<AsyncClient*> cl;
+    for (int i=0; i<CMD_MAX_CLIENTS; i++)
+        cl.push_back(connect());
+    TEST_ASSERT_EQUAL(CMD_MAX_CLIENTS, status()["clients"].as<int>());
+    for (int i=0; i<10; i++)
+        connect(); // rejected and deleted by the port
+    TEST_ASSERT_EQUAL(CMD_MAX_CLIENTS, status()["clients"].as<int>());
+    TEST_ASSERT_EQUAL(10, status()["rejected"].as<int>());
+
+    cl.back()->hostDisconnect(); // frees a slot
+    cl.pop_back();
+    cl.push_back(connect());
+    TEST_ASSERT_EQUAL(CMD_MAX_CLIENTS, status()["clients"].as<int>());
+    for (auto *c: cl)
+        c->hostDisconnect();
+    TEST_ASSERT_EQUAL(0, status()["clients"].as<int>());
+    command.writeClients("x", 1); // skips the disconnected clients
+}
+
+static void test_fragmented_commands() {
+    AsyncClient *c = connect();
+    const char input[] = "OT=5\r\nmm=50\nXX=1\r\n" "TT=abc\r\n" "OT=1234567890123456789012345678901234567890\r\n" "PR=A\n";
+    for (const char *p = input; *p; p++)
+        c->hostReceive(p, 1); // worst case, one byte per segment
+    std::vector<std::string> l = lines(c->sent);
+    TEST_ASSERT_EQUAL(6, l.size());
+    TEST_ASSERT_EQUAL_STRING("OT: 5.00", l[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("MM: 50", l[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("NG", l[2].c_str());
+    TEST_ASSERT_EQUAL_STRING("BV", l[3].c_str());
+    TEST_ASSERT_EQUAL_STRING("SE", l[4].c_str()); // line too long
+    TEST_ASSERT_EQUAL_STRING("PR: A=OT-Thing native", l[5].c_str());
+
+    c->sent.clear();
+    c->hostReceive(input, sizeof(input) - 1); // all in one segment
+    TEST_ASSERT_EQUAL(6, lines(c->sent).size());
+    c->hostDisconnect();
+}
+
+static void test_slow_reader() {
+    AsyncClient *fast = connect();
+    AsyncClient *slow = connect();
+    const uint32_t dropped0 = status()["dropped"];
+    const uint32_t total = 5000;
+    for (uint32_t i=0; i<total; i++) {
+        writeLine(i);
+        fast->hostAck();
+        if ((i % 1000) == 999)
+            slow->hostAck(); // reads now and then
+    }
+    slow->hostAck();
+
+    // the fast client gets everything, the slow one complete lines in order with gaps
+    std::vector<std::string> lf = lines(fast->sent);
+    TEST_ASSERT_EQUAL(total, lf.size());
+    std::vector<std::string> ls = lines(slow->sent);
+    TEST_ASSERT_LESS_THAN(total, ls.size());
+    uint32_t prev = 0;
+    for (size_t i=0; i<ls.size(); i++) {
+        TEST_ASSERT_EQUAL(9, ls[i].size());
+        const uint32_t seq = strtoul(ls[i].c_str() + 1, nullptr, 16);
+        if (i > 0)
+            TEST_ASSERT_GREATER_THAN(prev, seq);
+        prev = seq;
+    }
+    TEST_ASSERT_EQUAL(total - ls.size(), status()["dropped"].as<uint32_t>() - dropped0);
+    TEST_ASSERT_LESS_OR_EQUAL(AsyncClient::SND_BUF, slow->hostInFlight());
+    fast->hostDisconnect();
+    slow->hostDisconnect();
+}
+
+static void test_churn() {
+    // random connects, disconnects, input and output
+    std::vector<AsyncClient*> cl;
+    uint32_t seed = 12345;
+    auto rnd = [&seed](const uint32_t n) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % n;
+    };
+    for (uint32_t i=0; i<200000; i++) {
+        switch (rnd(8)) {
+        case 0: {
+            AsyncClient *c = new AsyncClient;
+            const bool accepted = status()["clients"].as<size_t>() < CMD_MAX_CLIENTS;
+            server->hostAccept(c);
+            if (accepted)
+                cl.push_back(c);
+            break;
+        }
+        case 1:
+            if (!cl.empty()) {
+                const size_t k = rnd(cl.size());
+                cl[k]->hostDisconnect();
+                cl.erase(cl.begin() + k);
+            }
+            break;
+        case 2:
+            if (!cl.empty())
+                cl[rnd(cl.size())]->hostReceive("PS=0\r\nTT", 8);
+            break;
+        case 3:
+            if (!cl.empty()) {
+                AsyncClient *c = cl[rnd(cl.size())];
+                c->hostAck(rnd(1000));
+                if (c->sent.size() > 100000)
+                    c->sent.clear();
+            }
+            break;
+        default:
+            writeLine(i);
+            break;
+        }
+    }
+    TEST_ASSERT_EQUAL(cl.size(), status()["clients"].as<size_t>());
+    for (auto *c: cl)
+        c->hostDisconnect();
+    TEST_ASSERT_EQUAL(0, status()["clients"].as<int>());
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+    command.begin();
+    server = AsyncServer::hostFind(25238);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_client_limit);
+    RUN_TEST(test_fragmented_commands);
+    RUN_TEST(test_slow_reader);
+    RUN_TEST(test_churn);
+    return UNITY_END();
+}
@@ -0,0 +1,147 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <stdlib.h>
+#include "devconfig.h"
+#include "sensors.h"
+
+// Config upload, validation and PATCH merge on the LittleFS shim
+
+static int send(uint32_t &id, const DevConfig::UploadMode mode, const char *json, const size_t chunk, String &err) {
+    const size_t total = strlen(json);
+    size_t index = 0;
+    int status;
+    do {
+        const size_t len = std::min(chunk, total - index);
+        status = devconfig.receive(id, mode, (const uint8_t*) json + index, len, index, total, err);
+        index += len;
+    } while ((status == 0) && (index < total));
+    return status;
+}
+
+static JsonDocument readConfig() {
+    JsonDocument doc;
+    File f = devconfig.getFile();
+    if (f) {
+        deserializeJson(doc, f);
+        f.close();
+    }
+    return doc;
+}
+
+void setUp() {
+    devconfig.remove();
+}
+
+void tearDown() {
+}
+
+static void test_upload_replaces_config() {
+    String err;
+    uint32_t id;
+    TEST_ASSERT_EQUAL(200, send(id, DevConfig::UPLOAD_REPLACE, R"({"hostname":"boiler","otMode":1,"heating":[{"chOn":true}]})", 7, err));
+    const String etag = devconfig.getETag();
+    TEST_ASSERT_EQUAL(10, etag.length());
+    JsonDocument doc = readConfig();
+    TEST_ASSERT_EQUAL_STRING("boiler", doc["hostname"] | "");
+
+    devconfig.loop(); // applies it
+    TEST_ASSERT_EQUAL_STRING("boiler", devconfig.getHostname().c_str());
+
+    TEST_ASSERT_EQUAL(200, send(id, DevConfig::UPLOAD_REPLACE, R"({"hostname":"boiler2"})", 64, err));
+    TEST_ASSERT_FALSE(etag == devconfig.getETag());
+}
+
+static void test_invalid_upload_keeps_config() {
+    String err;
+    uint32_t id;
+    TEST_ASSERT_EQUAL(200, send(id, DevConfig::UPLOAD_REPLACE, R"({"otMode":1})", 64, err));
+    TEST_ASSERT_EQUAL(200, send(id, DevConfig::UPLOAD_REPLACE,
+        R"({"otMode":1,"outsideTemp":{"source":2,"adr":"","lat":52.5,"lon":13.4,"filter":{"type":"ema","alpha":0.2},"fallback":[{"source":0}]},"ble":{"allow":["A4C1385E0107"]}})", 64, err));
+    const String etag = devconfig.getETag();
+
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"otMode":"x"})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("otMode: wrong type", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"otMode":)", 4, err));
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"mqtt":{"port":70000}})", 64, err));
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"heating":[{},{},{}]})", 64, err));
+
+    // nested sections
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"heating":[{"roomtemp":{"source":9}}]})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("heating.0.roomtemp.source: out of range", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"outsideTemp":{"source":0,"fallback":[{"source":2,"adr":"x"}]}})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("outsideTemp.fallback.0.adr: invalid address", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"outsideTemp":{"source":0,"fallback":[1]}})", 64, err));
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"outsideTemp":{"source":4,"lat":"52"}})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("outsideTemp.lat: wrong type", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"outsideTemp":{"filter":{"type":"median","n":20}}})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("outsideTemp.filter.n: out of range", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"ble":{"allow":["a4c1385e0107","nope"]}})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("ble.allow: invalid address", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"mqtt":{"host":1}})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("mqtt.host: wrong type", err.c_str());
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_REPLACE, R"({"mqtt":{"keepAlive":-1}})", 64, err));
+
+    TEST_ASSERT_TRUE(etag == devconfig.getETag());
+    TEST_ASSERT_EQUAL(1, readConfig()["otMode"].as<int>());
+    TEST_ASSERT_FALSE(LittleFS.exists("/config.tmp"));
+}
+
+static void test_patch_merges() {
+    String err;
+    uint32_t id;
+    TEST_ASSERT_EQUAL(200, send(id, DevConfig::UPLOAD_REPLACE, R"({"hostname":"a","mqtt":{"host":"b","port":1883},"timezone":0})", 64, err));
+    TEST_ASSERT_EQUAL(200, send(id, DevConfig::UPLOAD_PATCH, R"({"mqtt":{"port":8883,"tls":true},"timezone":null})", 5, err));
+    JsonDocument doc = readConfig();
+    TEST_ASSERT_EQUAL_STRING("a", doc["hostname"] | "");
+    TEST_ASSERT_EQUAL_STRING("b", doc["mqtt"]["host"] | "");
+    TEST_ASSERT_EQUAL(8883, doc["mqtt"]["port"].as<int>());
+    TEST_ASSERT_TRUE(doc["mqtt"]["tls"].as<bool>());
+    TEST_ASSERT_TRUE(doc["timezone"].isNull());
+
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_PATCH, R"([1])", 64, err));
+    TEST_ASSERT_EQUAL(400, send(id, DevConfig::UPLOAD_PATCH, R"({"hostname":5})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("a", readConfig()["hostname"] | "");
+}
+
+static void test_one_upload_at_a_time() {
+    const char json[] = R"({"hostname":"first"})";
+    uint32_t a, b;
+    String err;
+    TEST_ASSERT_EQUAL(0, devconfig.receive(a, DevConfig::UPLOAD_REPLACE, (const uint8_t*) json, 5, 0, strlen(json), err));
+    TEST_ASSERT_EQUAL(409, send(b, DevConfig::UPLOAD_REPLACE, R"({"hostname":"second"})", 64, err));
+    TEST_ASSERT_EQUAL(200, devconfig.receive(a, DevConfig::UPLOAD_REPLACE, (const uint8_t*) json + 5, strlen(json) - 5, 5, strlen(json), err));
+    TEST_ASSERT_EQUAL_STRING("first", readConfig()["hostname"] | "");
+
+    // an abandoned upload is taken over after the timeout
+    TEST_ASSERT_EQUAL(0, devconfig.receive(a, DevConfig::UPLOAD_REPLACE, (const uint8_t*) json, 5, 0, strlen(json), err));
+    delay(11000);
+    TEST_ASSERT_EQUAL(200, send(b, DevConfig::UPLOAD_REPLACE, R"({"hostname":"second"})", 64, err));
+    TEST_ASSERT_EQUAL_STRING("second", readConfig()["hostname"] | "");
+}
+
+static void test_too_large() {
+    String err;
+    uint32_t a;
+    TEST_ASSERT_EQUAL(413, devconfig.receive(a, DevConfig::UPLOAD_REPLACE, (const uint8_t*) "{", 1, 0, CFG_MAX_SIZE + 1, err));
+}
+
+int main() {
+    char dir[] = "/tmp/otthing-test-XXXXXX";
+    if (mkdtemp(dir) == nullptr)
+        return 1;
+    LittleFS.hostSetRoot(dir);
+    hostClockManual(true);
+    AddressableSensor::begin();
+    devconfig.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_upload_replaces_config);
+    RUN_TEST(test_invalid_upload_keeps_config);
+    RUN_TEST(test_patch_merges);
+    RUN_TEST(test_one_upload_at_a_time);
+    RUN_TEST(test_too_large);
+    const int failures = UNITY_END();
+    LittleFS.format();
+    LittleFS.remove(""); // the directory itself
+    return failures;
+}
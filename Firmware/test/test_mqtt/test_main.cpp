@@ -0,0 +1,121 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <algorithm>
+#include "mqtt.h"
+#include "sensors.h"
+
+// MQTT client life cycle and command topics against the esp-mqtt stand-in
+
+static const char BASE[] = "otthing/A1B2C3"; // from the shim's MAC 24:0A:C4:A1:B2:C3
+
+static void configureSensor(Sensor &s, const char *json) {
+    JsonDocument doc;
+    deserializeJson(doc, json);
+    JsonObject obj = doc.as<JsonObject>();
+    s.setConfig(obj);
+}
+
+static void deliver(const char *name, const char *payload, const int chunkSize = 1024) {
+    String topic = BASE;
+    topic += '/';
+    topic += name;
+    hostMqttDeliver(hostMqttClient(), topic.c_str(), payload, chunkSize);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_topics() {
+    TEST_ASSERT_EQUAL_STRING(BASE, mqtt.getBaseTopic().c_str());
+    TEST_ASSERT_EQUAL_STRING("otthing/A1B2C3/outsideTemp/set", mqtt.getCmdTopic(Mqtt::TOPIC_OUTSIDETEMP).c_str());
+    TEST_ASSERT_EQUAL_STRING("roomSetpoint2", Mqtt::getTopicString(Mqtt::TOPIC_ROOMSETPOINT2).c_str());
+}
+
+static void test_connect_subscribes() {
+    MqttConfig cfg {};
+    cfg.host = "broker.local";
+    cfg.port = 1883;
+    cfg.keepAlive = 30;
+    mqtt.setConfig(cfg);
+    mqtt.loop();
+
+    esp_mqtt_client_handle_t cli = hostMqttClient();
+    TEST_ASSERT_NOT_NULL(cli);
+    TEST_ASSERT_TRUE(cli->started);
+    TEST_ASSERT_EQUAL_STRING("broker.local", cli->host.c_str());
+    TEST_ASSERT_EQUAL_STRING("otthing/A1B2C3/status", cli->willTopic.c_str());
+    TEST_ASSERT_FALSE(mqtt.connected());
+
+    hostMqttConnect(cli);
+    mqtt.loop();
+    TEST_ASSERT_TRUE(mqtt.connected());
+    auto &subs = cli->subscriptions;
+    TEST_ASSERT_TRUE(std::find(subs.begin(), subs.end(), "otthing/A1B2C3/+/set") != subs.end());
+    TEST_ASSERT_TRUE(std::find(subs.begin(), subs.end(), "homeassistant/status") != subs.end());
+}
+
+static void test_commands() {
+    configureSensor(outsideTemp, R"({"source":0})");
+    configureSensor(roomSetPoint[0], R"({"source":0})");
+    configureSensor(roomTemp[1], R"({"source":0})");
+
+    double d;
+    deliver("outsideTemp/set", "7.5");
+    TEST_ASSERT_TRUE(outsideTemp.get(d));
+    TEST_ASSERT_EQUAL_FLOAT(7.5, d);
+
+    deliver("roomTemp2/set", "19.8");
+    TEST_ASSERT_TRUE(roomTemp[1].get(d));
+    TEST_ASSERT_EQUAL_FLOAT(19.8, d);
+
+    // not a number, unknown name, other device, missing suffix: ignored
+    deliver("outsideTemp/set", "7.5x");
+    deliver("outsideTem/set", "1");
+    deliver("outsideTempX/set", "1");
+    deliver("outsideTemp", "1");
+    hostMqttDeliver(hostMqttClient(), "otthing/000000/outsideTemp/set", "1");
+    TEST_ASSERT_TRUE(outsideTemp.get(d));
+    TEST_ASSERT_EQUAL_FLOAT(7.5, d);
+}
+
+static void test_chunked_payload() {
+    double d;
+    deliver("roomSetpoint1/set", "21.5", 1); // one byte per event
+    TEST_ASSERT_TRUE(roomSetPoint[0].get(d));
+    TEST_ASSERT_EQUAL_FLOAT(21.5, d);
+
+    // longer than the reassembly buffer: dropped
+    String big = "22";
+    while (big.length() < 100)
+        big += '0';
+    deliver("roomSetpoint1/set", big.c_str(), 16);
+    TEST_ASSERT_TRUE(roomSetPoint[0].get(d));
+    TEST_ASSERT_EQUAL_FLOAT(21.5, d);
+}
+
+static void test_disconnect() {
+    hostMqttDisconnect(hostMqttClient());
+    mqtt.loop();
+    TEST_ASSERT_FALSE(mqtt.connected());
+    TEST_ASSERT_EQUAL(1, mqtt.getNumDisc());
+    hostMqttConnect(hostMqttClient());
+    mqtt.loop();
+    TEST_ASSERT_TRUE(mqtt.connected());
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+    mqtt.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_topics);
+    RUN_TEST(test_connect_subscribes);
+    RUN_TEST(test_commands);
+    RUN_TEST(test_chunked_payload);
+    RUN_TEST(test_disconnect);
+    return UNITY_END();
+}
@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <string>
+#include "sensors.h"
+
+// OpenWeather client against a local HTTP stand-in on the AsyncTCP shim. Responses are
+// delivered in small segments to exercise the incremental parser.
+
+static struct WeatherServer {
+    bool up {true};
+    bool silent {false};
+    std::string response;
+    size_t segment {1460};
+    bool closeAfter {false}; // server closes the connection after the response
+    int connects {0};
+    std::vector<std::string> requests;
+} server;
+
+static void serve(AsyncClient *client, const char *data, size_t len) {
+    server.requests.emplace_back(data, len);
+    if (server.silent)
+        return;
+    for (size_t i=0; i<server.response.size(); i+=server.segment)
+        client->hostReceive(server.response.data() + i, std::min(server.segment, server.response.size() - i));
+    if (server.closeAfter)
+        client->hostDisconnect();
+}
+
+static std::string contentLength(const char *body, const int status = 200) {
+    char head[128];
+    snprintf(head, sizeof(head), "HTTP/1.1 %d OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\n\r\n",
+        status, (unsigned) strlen(body));
+    return std::string(head) + body;
+}
+
+static const char BODY[] = R"({"coord":{"lon":13.405,"lat":52.52},"weather":[{"id":800,"main":"Clear"}],"main":{"temp":12.34,"feels_like":11.5,"humidity":71},"name":"Berlin","cod":200})";
+
+static void runFor(const uint32_t ms) {
+    const uint32_t start = millis();
+    while (millis() - start < ms) {
+        Sensor::loopAll();
+        delay(10);
+    }
+}
+
+static bool get(double &d) {
+    return outsideTemp.get(d);
+}
+
+static void configure(const char *json) {
+    JsonDocument doc;
+    deserializeJson(doc, json);
+    JsonObject obj = doc.as<JsonObject>();
+    outsideTemp.setConfig(obj);
+}
+
+void setUp() {
+    server.up = true;
+    server.silent = false;
+    server.segment = 1460;
+    server.closeAfter = false;
+    server.connects = 0;
+    server.requests.clear();
+    server.response = contentLength(BODY);
+    configure(R"({"source":4,"lat":52.52,"lon":13.405,"apikey":"k3y","host":"api.test","port":8080,"interval":60})");
+}
+
+void tearDown() {
+}
+
+static void test_request_and_keep_alive() {
+    server.segment = 7;
+    runFor(100);
+    double d;
+    TEST_ASSERT_TRUE(get(d));
+    TEST_ASSERT_EQUAL_FLOAT(12.3, d);
+    TEST_ASSERT_EQUAL_STRING("Ok", outsideTemp.owResult.c_str());
+    TEST_ASSERT_EQUAL(1, server.requests.size());
+    TEST_ASSERT_EQUAL_STRING("GET /data/2.5/weather?units=metric&lat=52.5200&lon=13.4050&appid=k3y HTTP/1.1\r\n"
+        "Host: api.test\r\nConnection: keep-alive\r\n\r\n", server.requests[0].c_str());
+
+    runFor(60000); // next request on the same connection
+    TEST_ASSERT_EQUAL(2, server.requests.size());
+    TEST_ASSERT_EQUAL(1, server.connects);
+}
+
+static void test_chunked() {
+    server.segment = 1;
+    server.response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "10;ext=1\r\n{\"main\":{\"temp\":\r\n"
+        "6\r\n-3.45}\r\n"
+        "1\r\n}\r\n"
+        "0\r\nX-Trailer: 1\r\n\r\n";
+    runFor(100);
+    double d;
+    TEST_ASSERT_TRUE(get(d));
+    TEST_ASSERT_EQUAL_FLOAT(-3.5, d);
+    TEST_ASSERT_EQUAL_STRING("Ok", outsideTemp.owResult.c_str());
+}
+
+static void test_body_until_close() {
+    server.response = std::string("HTTP/1.0 200 OK\r\n\r\n") + BODY;
+    server.segment = 100;
+    server.closeAfter = true;
+    runFor(100);
+    double d;
+    TEST_ASSERT_TRUE(get(d));
+    TEST_ASSERT_EQUAL_FLOAT(12.3, d);
+
+    runFor(60000); // reconnects
+    TEST_ASSERT_EQUAL(2, server.connects);
+}
+
+static void test_error_and_backoff() {
+    runFor(100);
+    server.response = contentLength(R"({"cod":401, "message": "Invalid API key"})", 401);
+    runFor(60000);
+    double d;
+    TEST_ASSERT_FALSE(get(d));
+    TEST_ASSERT_EQUAL_STRING("HTTP 401: Invalid API key", outsideTemp.owResult.c_str());
+
+    // retried after 1, 2, 4 and 8 minutes: the interval until the doubled backoff exceeds it
+    server.requests.clear();
+    runFor(15 * 60000 + 100);
+    TEST_ASSERT_EQUAL(4, server.requests.size());
+}
+
+static void test_malformed() {
+    std::string big = std::string("{\"x\":\"") + std::string(2000, 'a') + "\"}";
+    server.response = contentLength(big.c_str());
+    runFor(100);
+    TEST_ASSERT_EQUAL_STRING("invalid response", outsideTemp.owResult.c_str());
+
+    configure(R"({"source":4,"host":"api.test","port":8080})");
+    server.response = "FTP nonsense\r\n\r\n";
+    runFor(100);
+    TEST_ASSERT_EQUAL_STRING("invalid response", outsideTemp.owResult.c_str());
+
+    configure(R"({"source":4,"host":"api.test","port":8080})");
+    server.response = contentLength("{\"main\":");
+    runFor(100);
+    TEST_ASSERT_EQUAL_STRING("invalid JSON", outsideTemp.owResult.c_str());
+}
+
+static void test_unreachable() {
+    server.silent = true;
+    runFor(5100);
+    TEST_ASSERT_EQUAL_STRING("timeout", outsideTemp.owResult.c_str());
+
+    configure(R"({"source":4,"host":"api.test","port":8080})");
+    server.up = false;
+    runFor(5100);
+    TEST_ASSERT_EQUAL_STRING("connect failed", outsideTemp.owResult.c_str());
+    TEST_ASSERT_EQUAL(1, server.requests.size()); // only the unanswered one
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+    AsyncClient::hostConnectHandler = [](AsyncClient *client, const char *host, uint16_t port) {
+        if (!server.up || (strcmp(host, "api.test") != 0) || (port != 8080))
+            return false;
+        server.connects++;
+        client->hostSendHandler = serve;
+        return true;
+    };
+
+    UNITY_BEGIN();
+    RUN_TEST(test_request_and_keep_alive);
+    RUN_TEST(test_chunked);
+    RUN_TEST(test_body_until_close);
+    RUN_TEST(test_error_and_backoff);
+    RUN_TEST(test_malformed);
+    RUN_TEST(test_unreachable);
+    return UNITY_END();
+}
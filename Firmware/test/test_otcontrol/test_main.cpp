@@ -0,0 +1,146 @@
+#include <unity.h>
+#include <Arduino.h>
+#include <map>
+#include <vector>
+#include "otcontrol.h"
+#include "otvalues.h"
+#include "sensors.h"
+
+// OTControl in master mode against a boiler answering on the OpenTherm HAL shim, in simulated time
+
+class TestBoiler: public OpenThermPeer {
+public:
+    bool silent {false};
+    uint32_t turnaround {50000}; // us
+    std::map<uint8_t, uint16_t> data; // read replies, other IDs are unknown
+    std::vector<unsigned long> requests;
+    void onFrame(OpenTherm &hal, const unsigned long frame) override {
+        requests.push_back(frame);
+        if (silent)
+            return;
+        const OpenThermMessageID id = OpenTherm::getDataID(frame);
+        unsigned long resp;
+        if (OpenTherm::getMessageType(frame) == OpenThermMessageType::WRITE_DATA)
+            resp = OpenTherm::buildResponse(OpenThermMessageType::WRITE_ACK, id, frame & 0xFFFF);
+        else if (data.count(id))
+            resp = OpenTherm::buildResponse(OpenThermMessageType::READ_ACK, id, data[id]);
+        else
+            resp = OpenTherm::buildResponse(OpenThermMessageType::UNKNOWN_DATA_ID, id, frame & 0xFFFF);
+        hal.hostReceive(resp, micros() + turnaround);
+    }
+    bool sent(const OpenThermMessageType mt, const OpenThermMessageID id, uint16_t &value) const {
+        for (auto it = requests.rbegin(); it != requests.rend(); it++) {
+            if ((OpenTherm::getMessageType(*it) == mt) && (OpenTherm::getDataID(*it) == id)) {
+                value = *it & 0xFFFF;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static TestBoiler boiler;
+
+static void runFor(const uint32_t ms) {
+    const uint32_t start = millis();
+    while (millis() - start < ms)
+        otcontrol.loop();
+}
+
+static void configure(const char *json) {
+    JsonDocument doc;
+    deserializeJson(doc, json);
+    otcontrol.setConfig(doc.as<JsonObjectConst>(), JsonObjectConst());
+}
+
+static JsonDocument status() {
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    otcontrol.getJson(obj);
+    return doc;
+}
+
+void setUp() {
+    boiler.silent = false;
+    boiler.requests.clear();
+}
+
+void tearDown() {
+}
+
+static void test_master_polls_boiler() {
+    boiler.data[Status] = 0x000A; // CH mode, flame
+    boiler.data[Tboiler] = 55 * 256 + 128;
+    boiler.data[SConfigSMemberIDcode] = 0x0100; // DHW present
+    configure(R"({"otMode":1,"heating":[{"chOn":true,"flow":42,"flowMax":60}],"boiler":{"dhwOn":true,"dhwTemperature":50}})");
+    runFor(20000);
+
+    uint16_t v;
+    TEST_ASSERT_TRUE(boiler.sent(OpenThermMessageType::READ_DATA, Status, v));
+    TEST_ASSERT_EQUAL_HEX16(0x0300, v & 0xFF00); // CH and DHW enabled
+    TEST_ASSERT_TRUE(boiler.sent(OpenThermMessageType::WRITE_DATA, TSet, v));
+    TEST_ASSERT_EQUAL(42 * 256, v);
+    TEST_ASSERT_TRUE(boiler.sent(OpenThermMessageType::WRITE_DATA, TdhwSet, v));
+    TEST_ASSERT_EQUAL(50 * 256, v);
+
+    TEST_ASSERT_EQUAL(55 * 256 + 128, OTValue::getSlaveValue(Tboiler)->getValue());
+    TEST_ASSERT_TRUE(static_cast<OTValueStatus*>(OTValue::getSlaveValue(Status))->getFlame());
+
+    JsonDocument doc = status();
+    TEST_ASSERT_TRUE(doc["slave"]["connected"].as<bool>());
+    TEST_ASSERT_EQUAL(0, doc["slave"]["timeouts"].as<int>());
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 55.5, doc["slave"]["flow_t"].as<double>());
+}
+
+static void test_requests_keep_bus_timing() {
+    configure(R"({"otMode":1,"heating":[{"chOn":true}]})");
+    runFor(10000);
+    // one request per response, at least 100 ms idle in between: at most one frame every 184 ms
+    const size_t n = boiler.requests.size();
+    TEST_ASSERT_GREATER_THAN(10, n);
+    TEST_ASSERT_LESS_OR_EQUAL(10000 / 184 + 1, n);
+}
+
+static void test_silent_boiler_times_out() {
+    configure(R"({"otMode":1,"heating":[{"chOn":true}]})");
+    runFor(1000);
+    boiler.silent = true;
+    runFor(5000);
+    JsonDocument doc = status();
+    TEST_ASSERT_FALSE(doc["slave"]["connected"].as<bool>());
+    const int timeouts = doc["slave"]["timeouts"];
+    TEST_ASSERT_GREATER_OR_EQUAL(3, timeouts);
+    TEST_ASSERT_LESS_OR_EQUAL(5, timeouts); // 1 s each
+
+    boiler.silent = false;
+    runFor(2000);
+    TEST_ASSERT_TRUE(status()["slave"]["connected"].as<bool>());
+}
+
+static void test_room_temp_sent() {
+    JsonDocument cfg;
+    deserializeJson(cfg, R"({"source":0})"); // MQTT
+    JsonObject obj = cfg.as<JsonObject>();
+    roomTemp[0].setConfig(obj);
+    roomTemp[0].set(20.5, Sensor::SOURCE_MQTT);
+    configure(R"({"otMode":1,"heating":[{"chOn":true}]})");
+    runFor(61000); // Tr is sent once a minute
+
+    uint16_t v;
+    TEST_ASSERT_TRUE(boiler.sent(OpenThermMessageType::WRITE_DATA, Tr, v));
+    TEST_ASSERT_EQUAL((uint16_t) (20.5 * 256), v);
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+    otcontrol.begin();
+    OpenTherm::hostFind(false)->setPeer(&boiler);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_master_polls_boiler);
+    RUN_TEST(test_requests_keep_bus_timing);
+    RUN_TEST(test_silent_boiler_times_out);
+    RUN_TEST(test_room_temp_sent);
+    return UNITY_END();
+}
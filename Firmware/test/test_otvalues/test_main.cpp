@@ -0,0 +1,77 @@
+#include <unity.h>
+#include <Arduino.h>
+#include "otvalues.h"
+#include "otcontrol.h"
+
+// decoding of slave replies into OTValue objects and their JSON representation
+
+void setUp() {
+    for (auto id: {Status, Tboiler, SConfigSMemberIDcode, RelModLevel})
+        OTValue::getSlaveValue(id)->init(true);
+}
+
+void tearDown() {
+}
+
+static void test_lookup() {
+    TEST_ASSERT_NOT_NULL(OTValue::getSlaveValue(Tboiler));
+    TEST_ASSERT_EQUAL(Tboiler, OTValue::getSlaveValue(Tboiler)->getId());
+    TEST_ASSERT_NOT_NULL(OTValue::getThermostatValue(TSet));
+    TEST_ASSERT_NULL(OTValue::getSlaveValue(TSet)); // written by the master, not read from the slave
+    TEST_ASSERT_NOT_NULL(OTValue::getSlaveConfig());
+}
+
+static void test_float_reply() {
+    OTValue *val = OTValue::getSlaveValue(Tboiler);
+    TEST_ASSERT_FALSE(val->isSet());
+    val->setValue(OpenThermMessageType::READ_ACK, (uint16_t) (int16_t) (55.5 * 256));
+    TEST_ASSERT_TRUE(val->isSet());
+
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    val->getJson(obj);
+    TEST_ASSERT_TRUE(obj["flow_t"].is<double>());
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 55.5, obj["flow_t"].as<double>());
+}
+
+static void test_unknown_id_disables() {
+    OTValue *val = OTValue::getSlaveValue(RelModLevel);
+    val->setValue(OpenThermMessageType::UNKNOWN_DATA_ID, 0);
+    TEST_ASSERT_FALSE(val->isSet());
+    TEST_ASSERT_FALSE(val->process()); // not polled again
+
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    val->getJson(obj);
+    TEST_ASSERT_FALSE(obj["rel_mod"].is<double>());
+}
+
+static void test_status_flags() {
+    auto *status = static_cast<OTValueStatus*>(OTValue::getSlaveValue(Status));
+    TEST_ASSERT_FALSE(status->getFlame());
+    status->setValue(OpenThermMessageType::READ_ACK, 0x000A); // CH mode, flame
+    TEST_ASSERT_TRUE(status->getFlame());
+    TEST_ASSERT_TRUE(status->getChActive(0));
+    TEST_ASSERT_FALSE(status->getChActive(1));
+    TEST_ASSERT_FALSE(status->getDhwActive());
+}
+
+static void test_slave_config() {
+    OTValueSlaveConfigMember *cfg = OTValue::getSlaveConfig();
+    cfg->setValue(OpenThermMessageType::READ_ACK, 0x2100); // DHW and CH2 present
+    TEST_ASSERT_TRUE(cfg->hasDHW());
+    TEST_ASSERT_TRUE(cfg->hasCh2());
+    cfg->setValue(OpenThermMessageType::READ_ACK, 0x0000);
+    TEST_ASSERT_FALSE(cfg->hasDHW());
+    TEST_ASSERT_FALSE(cfg->hasCh2());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_lookup);
+    RUN_TEST(test_float_reply);
+    RUN_TEST(test_unknown_id_disables);
+    RUN_TEST(test_status_flags);
+    RUN_TEST(test_slave_config);
+    return UNITY_END();
+}
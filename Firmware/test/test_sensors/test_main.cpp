@@ -0,0 +1,116 @@
+#include <unity.h>
+#include <Arduino.h>
+#include "sensors.h"
+
+// Sensor source selection, fallback chain and value ageing in simulated time
+
+static void configure(Sensor &s, const char *json) {
+    JsonDocument doc;
+    deserializeJson(doc, json);
+    JsonObject obj = doc.as<JsonObject>();
+    s.setConfig(obj);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_configured_source() {
+    Sensor s;
+    configure(s, R"({"source":0})");
+    double v;
+    TEST_ASSERT_FALSE(s.get(v));
+    s.set(21.34, Sensor::SOURCE_OT); // not configured
+    TEST_ASSERT_FALSE(s.get(v));
+    s.set(21.34, Sensor::SOURCE_MQTT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 21.3, v); // rounded to 0.1
+    TEST_ASSERT_TRUE(s.isMqttSource());
+    TEST_ASSERT_EQUAL(Sensor::SOURCE_MQTT, s.activeSource());
+}
+
+static void test_default_value() {
+    Sensor s;
+    configure(s, R"({"source":0})");
+    double v;
+    s.set(18, Sensor::SOURCE_NA);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(18, v);
+    s.set(20, Sensor::SOURCE_MQTT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(20, v);
+}
+
+static void test_fallback_and_max_age() {
+    Sensor s;
+    configure(s, R"({"source":0,"maxAge":60,"fallback":[{"source":1}]})");
+    double v;
+    s.set(20, Sensor::SOURCE_MQTT);
+    s.set(19, Sensor::SOURCE_OT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(20, v);
+
+    delay(40000);
+    s.set(19.5, Sensor::SOURCE_OT);
+    delay(30000); // MQTT value is 70 s old now
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(19.5, v);
+    TEST_ASSERT_EQUAL(Sensor::SOURCE_OT, s.activeSource());
+
+    delay(40000); // both expired
+    TEST_ASSERT_FALSE(s.get(v));
+    TEST_ASSERT_FALSE((bool) s);
+
+    s.set(21, Sensor::SOURCE_MQTT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(21, v);
+    s.invalidate(Sensor::SOURCE_MQTT);
+    TEST_ASSERT_FALSE(s.get(v));
+}
+
+static void test_auto_override() {
+    AutoSensor s;
+    configure(s, R"({"source":5})"); // auto: latest change of any source
+    double v;
+    s.set(20, Sensor::SOURCE_OT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(20, v);
+    s.set(21, Sensor::SOURCE_MQTT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(21, v);
+    s.set(20, Sensor::SOURCE_OT); // unchanged, ignored
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(21, v);
+
+    s.setOverride(23, AutoSensor::OVERRIDE_TEMP);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(23, v);
+    s.set(21, Sensor::SOURCE_MQTT); // unchanged, override stays
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(23, v);
+    s.set(19, Sensor::SOURCE_OT); // program changed, override ends
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(19, v);
+
+    s.setOverride(22, AutoSensor::OVERRIDE_CONST);
+    s.set(18, Sensor::SOURCE_OT);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(22, v);
+    s.setOverride(0, AutoSensor::OVERRIDE_CONST);
+    TEST_ASSERT_TRUE(s.get(v));
+    TEST_ASSERT_EQUAL_FLOAT(18, v);
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_configured_source);
+    RUN_TEST(test_default_value);
+    RUN_TEST(test_fallback_and_max_age);
+    RUN_TEST(test_auto_override);
+    return UNITY_END();
+}
@@ -0,0 +1,122 @@
+#include <unity.h>
+#include <Arduino.h>
+#include "mqtt.h"
+#include "sensors.h"
+
+// Status records captured while the broker is unreachable and replayed on the history topic
+
+static const char HISTORY[] = "otthing/A1B2C3/history";
+
+static JsonDocument telemStatus() {
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    mqtt.getTelemStatus(obj);
+    return doc;
+}
+
+static void runFor(const uint32_t ms) {
+    const uint32_t start = millis();
+    while (millis() - start < ms) {
+        mqtt.loop();
+        delay(100);
+    }
+}
+
+/** uptime of the replayed records in order of publishing */
+static std::vector<uint32_t> replayed() {
+    std::vector<uint32_t> result;
+    for (auto &msg: hostMqttClient()->published) {
+        if (msg.topic != HISTORY)
+            continue;
+        JsonDocument doc;
+        TEST_ASSERT_FALSE(deserializeJson(doc, msg.payload.c_str()));
+        TEST_ASSERT_TRUE(doc["state"].is<JsonObject>());
+        TEST_ASSERT_FALSE(msg.retain);
+        result.push_back(doc["uptime"]);
+    }
+    return result;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void test_capture_and_replay() {
+    MqttConfig cfg {};
+    cfg.host = "broker.local";
+    cfg.port = 1883;
+    mqtt.setConfig(cfg);
+    runFor(5 * 60000 + 1000); // broker down, a record per minute
+    TEST_ASSERT_EQUAL(5, telemStatus()["telemPending"].as<int>());
+    TEST_ASSERT_TRUE(replayed().empty());
+
+    hostMqttConnect(hostMqttClient());
+    runFor(500); // replay is paced
+    TEST_ASSERT_LESS_THAN(5, (int) replayed().size());
+    runFor(2000);
+    std::vector<uint32_t> up = replayed();
+    TEST_ASSERT_EQUAL(5, up.size());
+    for (size_t i=1; i<up.size(); i++)
+        TEST_ASSERT_EQUAL(60, up[i] - up[i - 1]); // oldest first
+    JsonDocument st = telemStatus();
+    TEST_ASSERT_EQUAL(0, st["telemPending"].as<int>());
+    TEST_ASSERT_EQUAL(5, st["telemReplayed"].as<int>());
+    TEST_ASSERT_EQUAL(0, st["telemDropped"].as<int>());
+}
+
+static void test_full_outbox_retries() {
+    esp_mqtt_client_handle_t cli = hostMqttClient();
+    hostMqttDisconnect(cli);
+    runFor(3 * 60000);
+    const int pending = telemStatus()["telemPending"];
+    TEST_ASSERT_GREATER_OR_EQUAL(2, pending);
+
+    cli->published.clear();
+    cli->outboxFull = true;
+    hostMqttConnect(cli);
+    runFor(2000);
+    TEST_ASSERT_EQUAL(pending, telemStatus()["telemPending"].as<int>()); // nothing lost
+    cli->outboxFull = false;
+    runFor(2000);
+    TEST_ASSERT_EQUAL(pending, replayed().size());
+    TEST_ASSERT_EQUAL(0, telemStatus()["telemPending"].as<int>());
+}
+
+static void test_oldest_dropped_when_full() {
+    esp_mqtt_client_handle_t cli = hostMqttClient();
+    hostMqttDisconnect(cli);
+    for (int i=0; i<24 * 3600; i++) { // a day offline
+        delay(1000);
+        mqtt.loop();
+    }
+    const uint32_t now = millis() / 1000;
+    JsonDocument st = telemStatus();
+    const int pending = st["telemPending"];
+    TEST_ASSERT_GREATER_THAN(0, st["telemDropped"].as<int>());
+    TEST_ASSERT_LESS_THAN(24 * 60, pending);
+
+    cli->published.clear();
+    hostMqttConnect(cli);
+    runFor(pending * 200 + 1000);
+    std::vector<uint32_t> up = replayed();
+    TEST_ASSERT_EQUAL(pending, up.size());
+    // newest records kept, in order
+    TEST_ASSERT_GREATER_OR_EQUAL(now - 61, up.back());
+    TEST_ASSERT_GREATER_THAN(now - 12 * 3600, up.front());
+    for (size_t i=1; i<up.size(); i++)
+        TEST_ASSERT_GREATER_THAN(up[i - 1], up[i]);
+}
+
+int main() {
+    hostClockManual(true);
+    AddressableSensor::begin();
+    mqtt.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_capture_and_replay);
+    RUN_TEST(test_full_outbox_retries);
+    RUN_TEST(test_oldest_dropped_when_full);
+    return UNITY_END();
+}